@@ -29,7 +29,10 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_VENDOR_SHARED_LIBRARIES)/hw
 LOCAL_MODULE := hwcomposer2.$(TARGET_BOARD_PLATFORM)
 
 LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libhardware \
 	liblog \
+	libsync \
 	libutils
 
 LOCAL_SRC_FILES := \
@@ -37,15 +40,32 @@ LOCAL_SRC_FILES := \
 	hwc2.cpp \
 	hwc2_buffer.cpp \
 	hwc2_callback.cpp \
+	hwc2_compositor.cpp \
 	hwc2_config.cpp \
 	hwc2_dev.cpp \
 	hwc2_display.cpp \
-	hwc2_layer.cpp
+	hwc2_governor.cpp \
+	hwc2_gralloc.cpp \
+	hwc2_layer.cpp \
+	hwc2_lut.cpp \
+	hwc2_plane.cpp \
+	hwc2_recorder.cpp \
+	hwc2_region.cpp \
+	hwc2_scheduler.cpp \
+	hwc2_stats.cpp \
+	hwc2_surface_pool.cpp \
+	hwc2_trace.cpp \
+	hwc2_vsync_model.cpp
 
 LOCAL_MODLE_TAGS := optional
 
 LOCAL_CFLAGS += -DLOG_TAG=\"hwcomposer\"
 
+# Scoped trace spans, see hwc2_trace in hwc2.h
+ifeq ($(TARGET_HWC2_TRACE),true)
+LOCAL_CFLAGS += -DHWC2_TRACE
+endif
+
 # The liboemcrypto.a prebuilt was built before we introduced the workaround for
 # -Bsymbolic, so it was built without -fPIC. Work around this by using
 # -Bsymbolic for projects that depend on it.
@@ -41,29 +41,41 @@ hw_module_t HAL_MODULE_INFO_SYM = {
 };
 
 
-hwc2_error_t create_virtual_display(hwc2_device_t* /*device*/,
-        uint32_t /*width*/, uint32_t /*height*/,
-        android_pixel_format_t* /*format*/,
-        hwc2_display_t* /*out_display*/)
+hwc2_error_t create_virtual_display(hwc2_device_t *device, uint32_t width,
+        uint32_t height, android_pixel_format_t *format,
+        hwc2_display_t *out_display)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    hwc2_error_t ret = dev->create_virtual_display(width, height, format,
+            out_display);
+    if (ret == HWC2_ERROR_NONE)
+        dev->get_recorder().record(HWC2_FUNCTION_CREATE_VIRTUAL_DISPLAY,
+                {width, height, static_cast<uint64_t>(*format), *out_display});
+    return ret;
 }
 
-hwc2_error_t destroy_virtual_display(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/)
+hwc2_error_t destroy_virtual_display(hwc2_device_t *device,
+        hwc2_display_t display)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_DESTROY_VIRTUAL_DISPLAY,
+            {display});
+    return dev->destroy_virtual_display(display);
 }
 
-void dump(hwc2_device_t* /*device*/, uint32_t* /*out_size*/,
-        char* /*out_buffer*/)
+void dump(hwc2_device_t *device, uint32_t *out_size, char *out_buffer)
 {
-    return;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->dump(out_size, out_buffer);
 }
 
 uint32_t get_max_virtual_display_count(hwc2_device_t* /*device*/)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    return HWC2_MAX_VIRTUAL_DISPLAYS;
 }
 
 hwc2_error_t register_callback(hwc2_device_t *device,
@@ -71,62 +83,80 @@ hwc2_error_t register_callback(hwc2_device_t *device,
         hwc2_callback_data_t callback_data, 
         hwc2_function_pointer_t pointer)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
     return dev->register_callback(descriptor, callback_data, pointer);
 }
 
-hwc2_error_t accept_display_changes(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/)
+hwc2_error_t accept_display_changes(hwc2_device_t *device,
+        hwc2_display_t display)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES, {display});
+    return dev->accept_display_changes(display);
 }
 
 hwc2_error_t create_layer(hwc2_device_t *device, hwc2_display_t display,
         hwc2_layer_t *out_layer)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
-    return dev->create_layer(display, out_layer);
+    hwc2_error_t ret = dev->create_layer(display, out_layer);
+    if (ret == HWC2_ERROR_NONE)
+        dev->get_recorder().record(HWC2_FUNCTION_CREATE_LAYER,
+                {display, *out_layer});
+    return ret;
 }
 
 hwc2_error_t destroy_layer(hwc2_device_t *device, hwc2_display_t display,
         hwc2_layer_t layer)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_DESTROY_LAYER, {display, layer});
     return dev->destroy_layer(display, layer);
 }
 
 hwc2_error_t get_active_config(hwc2_device_t *device, hwc2_display_t display,
         hwc2_config_t *out_config)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
     return dev->get_active_config(display, out_config);
 }
 
-hwc2_error_t get_changed_composition_types(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, uint32_t* /*out_num_elements*/,
-        hwc2_layer_t* /*out_layers*/, hwc2_composition_t* /*out_types*/)
+hwc2_error_t get_changed_composition_types(hwc2_device_t *device,
+        hwc2_display_t display, uint32_t *out_num_elements,
+        hwc2_layer_t *out_layers, hwc2_composition_t *out_types)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    return dev->get_changed_composition_types(display, out_num_elements,
+            out_layers, out_types);
 }
 
 hwc2_error_t get_client_target_support(hwc2_device_t* /*device*/,
         hwc2_display_t /*display*/, uint32_t /*width*/, uint32_t /*height*/,
         android_pixel_format_t /*format*/, android_dataspace_t /*dataspace*/)
 {
+    HWC2_TRACE_SCOPE(__func__);
     return HWC2_ERROR_NONE;
 }
 
-hwc2_error_t get_color_modes(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, uint32_t* /*out_num_modes*/,
-        android_color_mode_t* /*out_modes*/)
+hwc2_error_t get_color_modes(hwc2_device_t *device, hwc2_display_t display,
+        uint32_t *out_num_modes, android_color_mode_t *out_modes)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    return dev->get_color_modes(display, out_num_modes, out_modes);
 }
 
 hwc2_error_t get_display_attribute(hwc2_device_t *device,
         hwc2_display_t display, hwc2_config_t config,
         hwc2_attribute_t attribute, int32_t *out_value)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
     return dev->get_display_attribute(display, config, attribute, out_value);
 }
@@ -135,6 +165,7 @@ hwc2_error_t get_display_configs(hwc2_device_t *device,
         hwc2_display_t display, uint32_t *out_num_configs,
         hwc2_config_t *out_configs)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
     return dev->get_display_configs(display, out_num_configs, out_configs);
 }
@@ -142,22 +173,26 @@ hwc2_error_t get_display_configs(hwc2_device_t *device,
 hwc2_error_t get_display_name(hwc2_device_t *device, hwc2_display_t display,
         uint32_t *out_size, char *out_name)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
     return dev->get_display_name(display, out_size, out_name);
 }
 
-hwc2_error_t get_display_requests(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/,
-        hwc2_display_request_t* /*out_display_requests*/,
-        uint32_t* /*out_num_elements*/, hwc2_layer_t* /*out_layers*/,
-        hwc2_layer_request_t* /*out_layer_requests*/)
+hwc2_error_t get_display_requests(hwc2_device_t *device,
+        hwc2_display_t display, int32_t *out_display_requests,
+        uint32_t *out_num_elements, hwc2_layer_t *out_layers,
+        int32_t *out_layer_requests)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    return dev->get_display_requests(display, out_display_requests,
+            out_num_elements, out_layers, out_layer_requests);
 }
 
 hwc2_error_t get_display_type(hwc2_device_t *device, hwc2_display_t display,
         hwc2_display_type_t *out_type)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
     return dev->get_display_type(display, out_type);
 }
@@ -165,6 +200,7 @@ hwc2_error_t get_display_type(hwc2_device_t *device, hwc2_display_t display,
 hwc2_error_t get_doze_support(hwc2_device_t *device, hwc2_display_t display,
         int32_t *out_support)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
     return dev->get_doze_support(display, out_support);
 }
@@ -174,165 +210,249 @@ hwc2_error_t get_hdr_capabilities(hwc2_device_t* /*device*/,
         android_hdr_t* /*out_types*/, float* /*out_max_luminance*/,
         float* /*out_max_average_luminance*/, float* /*out_min_luminance*/)
 {
+    HWC2_TRACE_SCOPE(__func__);
     return HWC2_ERROR_NONE;
 }
 
-hwc2_error_t get_release_fences(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, uint32_t* /*out_num_elements*/,
-        hwc2_layer_t* /*out_layers*/, int32_t* /*out_fences*/)
+hwc2_error_t get_release_fences(hwc2_device_t *device,
+        hwc2_display_t display, uint32_t *out_num_elements,
+        hwc2_layer_t *out_layers, int32_t *out_fences)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    return dev->get_release_fences(display, out_num_elements, out_layers,
+            out_fences);
 }
 
-hwc2_error_t present_display(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, int32_t* /*out_present_fence*/)
+hwc2_error_t present_display(hwc2_device_t *device, hwc2_display_t display,
+        int32_t *out_present_fence)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_PRESENT_DISPLAY, {display});
+    return dev->present_display(display, out_present_fence);
 }
 
 hwc2_error_t set_active_config(hwc2_device_t *device, hwc2_display_t display,
         hwc2_config_t config)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_ACTIVE_CONFIG,
+            {display, config});
     return dev->set_active_config(display, config);
 }
 
-hwc2_error_t set_client_target(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, buffer_handle_t /*target*/,
-        int32_t /*acquire_fence*/, android_dataspace_t /*dataspace*/,
-        hwc_region_t /*damage*/)
+hwc2_error_t set_client_target(hwc2_device_t *device,
+        hwc2_display_t display, buffer_handle_t target,
+        int32_t acquire_fence, android_dataspace_t dataspace,
+        hwc_region_t damage)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record_buffer(target, acquire_fence, true);
+    dev->get_recorder().record(HWC2_FUNCTION_SET_CLIENT_TARGET,
+            {display, reinterpret_cast<uintptr_t>(target),
+            static_cast<uint64_t>(dataspace)}, damage.rects,
+            damage.numRects * sizeof(hwc_rect_t));
+    return dev->set_client_target(display, target, acquire_fence, dataspace,
+            damage);
 }
 
-hwc2_error_t set_color_mode(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, android_color_mode_t /*mode*/)
+hwc2_error_t set_color_mode(hwc2_device_t *device, hwc2_display_t display,
+        android_color_mode_t mode)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_COLOR_MODE,
+            {display, static_cast<uint64_t>(mode)});
+    return dev->set_color_mode(display, mode);
 }
 
-hwc2_error_t set_color_transform(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, const float* /*matrix*/,
-        android_color_transform_t /*hint*/)
+hwc2_error_t set_color_transform(hwc2_device_t *device,
+        hwc2_display_t display, const float *matrix,
+        android_color_transform_t hint)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_COLOR_TRANSFORM,
+            {display, static_cast<uint64_t>(hint)}, matrix,
+            matrix? 16 * sizeof(float): 0);
+    return dev->set_color_transform(display, matrix, hint);
 }
 
-hwc2_error_t set_output_buffer(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, buffer_handle_t /*buffer*/,
-        int32_t /*release_fence*/)
+hwc2_error_t set_output_buffer(hwc2_device_t *device, hwc2_display_t display,
+        buffer_handle_t buffer, int32_t release_fence)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record_buffer(buffer, -1, false);
+    dev->get_recorder().record(HWC2_FUNCTION_SET_OUTPUT_BUFFER,
+            {display, reinterpret_cast<uintptr_t>(buffer)});
+    return dev->set_output_buffer(display, buffer, release_fence);
 }
 
 hwc2_error_t set_power_mode(hwc2_device_t *device, hwc2_display_t display,
         hwc2_power_mode_t mode)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_POWER_MODE,
+            {display, static_cast<uint64_t>(mode)});
     return dev->set_power_mode(display, mode);
 }
 
 hwc2_error_t set_vsync_enabled(hwc2_device_t *device, hwc2_display_t display,
         hwc2_vsync_t enabled)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_VSYNC_ENABLED,
+            {display, static_cast<uint64_t>(enabled)});
     return dev->set_vsync_enabled(display, static_cast<hwc2_vsync_t>(enabled));
 }
 
-hwc2_error_t validate_display(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, uint32_t* /*out_num_types*/,
-        uint32_t* /*out_num_requests*/)
+hwc2_error_t validate_display(hwc2_device_t *device, hwc2_display_t display,
+        uint32_t *out_num_types, uint32_t *out_num_requests)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_VALIDATE_DISPLAY, {display});
+    return dev->validate_display(display, out_num_types, out_num_requests);
 }
 
-hwc2_error_t set_cursor_position(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/, int32_t /*x*/,
-        int32_t /*y*/)
+hwc2_error_t set_cursor_position(hwc2_device_t *device,
+        hwc2_display_t display, hwc2_layer_t layer, int32_t x, int32_t y)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_CURSOR_POSITION,
+            {display, layer, static_cast<uint64_t>(x), static_cast<uint64_t>(y)});
+    return dev->set_cursor_position(display, layer, x, y);
 }
 
-hwc2_error_t set_layer_buffer(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/,
-        buffer_handle_t /*buffer*/, int32_t /*acquire_fence*/)
+hwc2_error_t set_layer_buffer(hwc2_device_t *device, hwc2_display_t display,
+        hwc2_layer_t layer, buffer_handle_t buffer, int32_t acquire_fence)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record_buffer(buffer, acquire_fence, true);
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_BUFFER,
+            {display, layer, reinterpret_cast<uintptr_t>(buffer)});
+    return dev->set_layer_buffer(display, layer, buffer, acquire_fence);
 }
 
-hwc2_error_t set_layer_surface_damage(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/,
-        hwc_region_t /*damage*/)
+hwc2_error_t set_layer_surface_damage(hwc2_device_t *device,
+        hwc2_display_t display, hwc2_layer_t layer, hwc_region_t damage)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE,
+            {display, layer}, damage.rects,
+            damage.numRects * sizeof(hwc_rect_t));
+    return dev->set_layer_surface_damage(display, layer, damage);
 }
 
 hwc2_error_t set_layer_blend_mode(hwc2_device_t *device, hwc2_display_t display,
         hwc2_layer_t layer, hwc2_blend_mode_t mode)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_BLEND_MODE,
+            {display, layer, static_cast<uint64_t>(mode)});
     return dev->set_layer_blend_mode(display, layer, mode);
 }
 
-hwc2_error_t set_layer_color(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/,
-        hwc_color_t /*color*/)
+hwc2_error_t set_layer_color(hwc2_device_t *device, hwc2_display_t display,
+        hwc2_layer_t layer, hwc_color_t color)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_COLOR, {display, layer},
+            &color, sizeof(color));
+    return dev->set_layer_color(display, layer, color);
 }
 
 hwc2_error_t set_layer_composition_type(hwc2_device_t *device,
         hwc2_display_t display, hwc2_layer_t layer, hwc2_composition_t type)
 {
+    HWC2_TRACE_SCOPE(__func__);
     hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE,
+            {display, layer, static_cast<uint64_t>(type)});
     return dev->set_layer_composition_type(display, layer, type);
 }
 
-hwc2_error_t set_layer_dataspace(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/,
-        android_dataspace_t /*dataspace*/)
+hwc2_error_t set_layer_dataspace(hwc2_device_t *device,
+        hwc2_display_t display, hwc2_layer_t layer,
+        android_dataspace_t dataspace)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_DATASPACE,
+            {display, layer, static_cast<uint64_t>(dataspace)});
+    return dev->set_layer_dataspace(display, layer, dataspace);
 }
 
-hwc2_error_t set_layer_display_frame(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/,
-        hwc_rect_t /*frame*/)
+hwc2_error_t set_layer_display_frame(hwc2_device_t *device,
+        hwc2_display_t display, hwc2_layer_t layer, hwc_rect_t frame)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME,
+            {display, layer}, &frame, sizeof(frame));
+    return dev->set_layer_display_frame(display, layer, frame);
 }
 
-hwc2_error_t set_layer_plane_alpha(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/, float /*alpha*/)
+hwc2_error_t set_layer_plane_alpha(hwc2_device_t *device,
+        hwc2_display_t display, hwc2_layer_t layer, float alpha)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA,
+            {display, layer}, &alpha, sizeof(alpha));
+    return dev->set_layer_plane_alpha(display, layer, alpha);
 }
 
-hwc2_error_t set_layer_source_crop(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/,
-        hwc_frect_t /*crop*/)
+hwc2_error_t set_layer_source_crop(hwc2_device_t *device,
+        hwc2_display_t display, hwc2_layer_t layer, hwc_frect_t crop)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_SOURCE_CROP,
+            {display, layer}, &crop, sizeof(crop));
+    return dev->set_layer_source_crop(display, layer, crop);
 }
 
-hwc2_error_t set_layer_transform(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/,
-        hwc_transform_t /*transform*/)
+hwc2_error_t set_layer_transform(hwc2_device_t *device,
+        hwc2_display_t display, hwc2_layer_t layer, hwc_transform_t transform)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_TRANSFORM,
+            {display, layer, static_cast<uint64_t>(transform)});
+    return dev->set_layer_transform(display, layer, transform);
 }
 
-hwc2_error_t set_layer_visible_region(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/,
-        hwc_region_t /*visible*/)
+hwc2_error_t set_layer_visible_region(hwc2_device_t *device,
+        hwc2_display_t display, hwc2_layer_t layer, hwc_region_t visible)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION,
+            {display, layer}, visible.rects,
+            visible.numRects * sizeof(hwc_rect_t));
+    return dev->set_layer_visible_region(display, layer, visible);
 }
 
-hwc2_error_t set_layer_z_order(hwc2_device_t* /*device*/,
-        hwc2_display_t /*display*/, hwc2_layer_t /*layer*/, uint32_t /*z*/)
+hwc2_error_t set_layer_z_order(hwc2_device_t *device, hwc2_display_t display,
+        hwc2_layer_t layer, uint32_t z)
 {
-    return HWC2_ERROR_NONE;
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_dev *dev = reinterpret_cast<hwc2_context *>(device)->hwc2_dev;
+    dev->get_recorder().record(HWC2_FUNCTION_SET_LAYER_Z_ORDER,
+            {display, layer, z});
+    return dev->set_layer_z_order(display, layer, z);
 }
 
 /* Indexed using the hwc2_function_descriptor_t enum to find the corresponding
@@ -17,22 +17,663 @@
 #ifndef _HWC2_H
 #define _HWC2_H
 
+#include <hardware/gralloc1.h>
 #include <hardware/hwcomposer2.h>
+#include <sched.h>
+#include <stdio.h>
+#include <utils/Timers.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <list>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "nvfb.h"
 
+/* Virtual displays are composed on the CPU like the panel, one is enough
+ * for screen recording and casting */
+#define HWC2_MAX_VIRTUAL_DISPLAYS 1
+
+/* Framebuffer nodes probed at open, the lowest one is the primary panel */
+#define HWC2_MAX_FB_DEVICES 4
+
+/* Buffer updates a layer's frame rate is measured over */
+#define HWC2_CADENCE_WINDOW 16
+
+/* Banded rectangle region. Rects are sorted top to bottom, rects sharing a
+ * top form a band of disjoint spans sorted left to right and identical
+ * neighbouring bands are coalesced. Small regions live in inline storage so
+ * the common cases never touch the heap. */
+class hwc2_region {
+public:
+    hwc2_region();
+    explicit hwc2_region(const hwc_rect_t &rect);
+    explicit hwc2_region(const hwc_region_t &region);
+    hwc2_region(const hwc2_region &other);
+    hwc2_region &operator=(const hwc2_region &other);
+    bool operator==(const hwc2_region &other) const;
+    bool operator!=(const hwc2_region &other) const { return !(*this == other); }
+
+    bool empty() const { return cnt == 0; }
+    size_t size() const { return cnt; }
+    const hwc_rect_t *begin() const { return rects; }
+    const hwc_rect_t *end() const { return rects + cnt; }
+    const hwc_rect_t &get_bounds() const { return bounds; }
+    uint64_t get_area() const;
+    bool contains(const hwc_rect_t &rect) const;
+    bool intersects(const hwc_rect_t &rect) const;
+
+    void clear();
+    void set(const hwc_rect_t &rect);
+    void set(const hwc_region_t &region);
+    /* The returned region points into this object and is only valid until
+     * it is modified */
+    hwc_region_t get_hwc_region() const;
+
+    hwc2_region &translate(int32_t dx, int32_t dy);
+    hwc2_region &unite(const hwc2_region &other);
+    hwc2_region &intersect(const hwc2_region &other);
+    hwc2_region &subtract(const hwc2_region &other);
+
+    static const size_t inline_rects = 8;
+private:
+    enum region_op {
+        op_union,
+        op_intersect,
+        op_subtract,
+    };
+
+    hwc_rect_t local[inline_rects];
+    hwc_rect_t *rects;
+    size_t cnt;
+    size_t cap;
+    std::vector<hwc_rect_t> heap;
+    hwc_rect_t bounds;
+
+    void reserve(size_t size, bool keep);
+    void update_bounds();
+    void coalesce_band(size_t band_start);
+    void append_spans(const hwc_rect_t *a, size_t a_cnt, const hwc_rect_t *b,
+                    size_t b_cnt, int32_t top, int32_t bottom, region_op op);
+    hwc2_region &apply(const hwc2_region &other, region_op op);
+    static bool is_banded(const hwc_region_t &region);
+};
+
+/* A CPU mapping of a pixel buffer, stride is in bytes. For YUV formats data
+ * points at the luma plane and the 2x2 subsampled chroma samples are found
+ * chroma_step bytes apart in the cb and cr planes. */
+struct hwc2_surface {
+    uint8_t *data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    int32_t format;
+    const uint8_t *cb;
+    const uint8_t *cr;
+    uint32_t chroma_stride;
+    uint32_t chroma_step;
+};
+
+class hwc2_gralloc {
+public:
+    static hwc2_gralloc &get_instance();
+
+    int32_t get_format(buffer_handle_t handle) const;
+    int get_dimensions(buffer_handle_t handle, uint32_t *out_width,
+                    uint32_t *out_height) const;
+    int lock(buffer_handle_t handle, hwc2_surface *out_surface,
+                    bool write = false) const;
+    void unlock(buffer_handle_t handle) const;
+private:
+    hwc2_gralloc();
+    ~hwc2_gralloc();
+
+    int lock_ycbcr(buffer_handle_t handle, uint32_t width, uint32_t height,
+                    hwc2_surface *out_surface) const;
+
+    gralloc1_device_t *device;
+    GRALLOC1_PFN_GET_DIMENSIONS pfn_get_dimensions;
+    GRALLOC1_PFN_GET_FORMAT pfn_get_format;
+    GRALLOC1_PFN_GET_NUM_FLEX_PLANES pfn_get_num_flex_planes;
+    GRALLOC1_PFN_GET_STRIDE pfn_get_stride;
+    GRALLOC1_PFN_LOCK pfn_lock;
+    GRALLOC1_PFN_LOCK_FLEX pfn_lock_flex;
+    GRALLOC1_PFN_UNLOCK pfn_unlock;
+};
+
+/* A 3D color lookup table applied to finished frames, used to implement
+ * color modes and panel calibration */
+class hwc2_lut {
+public:
+    hwc2_lut();
+
+    int load(const char *path);
+    void map_row(uint32_t *row, size_t cnt) const;
+    uint32_t map_pixel(uint32_t pixel) const;
+    bool empty() const { return table.empty(); }
+private:
+    uint32_t size;
+    /* size^3 entries of r, g, b and padding with red changing fastest */
+    std::vector<uint16_t> table;
+    uint8_t index[256];
+    uint16_t weight[256];
+};
+
+class hwc2_compositor {
+public:
+    hwc2_compositor();
+
+    static void init_kernels();
+    static bool set_isa(const char *isa);
+    static const char *get_isa();
+    static bool is_supported_format(int32_t format);
+    static bool is_yuv_format(int32_t format);
+    static bool has_alpha(int32_t format);
+    static uint32_t get_bpp(int32_t format);
+    static uint32_t get_fill_color(const hwc_color_t &color,
+                    hwc2_blend_mode_t blend_mode, float plane_alpha);
+    static uint32_t blend_pixel(uint32_t src, uint32_t dst);
+    static bool is_linear(android_dataspace_t dataspace);
+    static void stream_copy(uint8_t *dst, const uint8_t *src, size_t size);
+
+    int set_color_transform(const float *matrix,
+                    android_color_transform_t hint);
+    bool is_color_transform_identity() const
+                    { return transform == transform_identity; }
+    void set_nearest_scaling(bool nearest) { nearest_scaling = nearest; }
+    uint32_t transform_pixel(uint32_t pixel) const;
+    void transform_row(uint32_t *row, size_t cnt) const;
+
+    /* Fills and clears always go through the color transform */
+    void clear(const hwc2_surface &dst, const hwc2_region &region);
+    void fill(const hwc2_surface &dst, uint32_t color,
+                    const hwc2_region &region);
+    void blend_fill(const hwc2_surface &dst, uint32_t color,
+                    const hwc2_region &region);
+    void draw(const hwc2_surface &dst, const hwc2_surface &src,
+                    const hwc_frect_t &source_crop,
+                    const hwc_rect_t &display_frame,
+                    hwc2_blend_mode_t blend_mode, float plane_alpha,
+                    const hwc2_region &clip, bool color_transform,
+                    android_dataspace_t dataspace);
+    void map(const hwc2_surface &dst, const hwc2_lut &lut,
+                    const hwc2_region &region);
+    void scale(const hwc2_surface &dst, const hwc2_surface &src,
+                    const hwc_rect_t &frame, const hwc2_region &clip);
+private:
+    enum transform_kind {
+        transform_identity,
+        transform_inverse,
+        transform_matrix,
+    };
+
+    std::vector<uint32_t> row;
+    /* Luma and chroma samples of one row of a YUV source */
+    std::vector<uint8_t> yuv_row;
+    /* Box sums or the second source row, and the output row followed by
+     * the sample positions of scale() */
+    std::vector<uint32_t> scale_acc;
+    std::vector<uint32_t> scale_out;
+    transform_kind transform;
+    /* Q12 coefficients for r, g, b and the translation of every channel */
+    int16_t coef[3][4];
+    /* Set by the quality governor, scale() then samples the nearest pixel */
+    bool nearest_scaling;
+
+    void scale_box(const hwc2_surface &dst, const hwc2_surface &src,
+                    const hwc_rect_t &frame, const hwc2_region &clip);
+    void scale_bilinear(const hwc2_surface &dst, const hwc2_surface &src,
+                    const hwc_rect_t &frame, const hwc2_region &clip);
+    void scale_nearest(const hwc2_surface &dst, const hwc2_surface &src,
+                    const hwc_rect_t &frame, const hwc2_region &clip);
+};
+
 class hwc2_buffer {
 public:
     hwc2_buffer();
+    ~hwc2_buffer();
 
+    buffer_handle_t get_buffer_handle() const { return handle; }
+    hwc2_blend_mode_t get_blend_mode() const { return blend_mode; }
+    const hwc_rect_t &get_display_frame() const { return display_frame; }
+    const hwc_frect_t &get_source_crop() const { return source_crop; }
+    float get_plane_alpha() const { return plane_alpha; }
+    uint32_t get_z_order() const { return z_order; }
+    hwc_transform_t get_transform() const { return transform; }
+    android_dataspace_t get_dataspace() const { return dataspace; }
+    const hwc_color_t &get_color() const { return color; }
+    const hwc2_region &get_visible_region() const { return visible_region; }
+    const hwc2_region &get_surface_damage() const { return surface_damage; }
+    bool get_full_damage() const { return full_damage; }
+    bool is_geometry_changed() const { return geometry_changed; }
+    bool is_content_changed() const { return content_changed; }
+    void clear_changed() { geometry_changed = content_changed = false; }
+    bool is_opaque() const;
+    int wait_acquire_fence();
+    void close_acquire_fence();
+    hwc2_error_t set_buffer(buffer_handle_t handle, int32_t acquire_fence);
     hwc2_error_t set_blend_mode(hwc2_blend_mode_t blend_mode);
+    hwc2_error_t set_display_frame(const hwc_rect_t &display_frame);
+    hwc2_error_t set_source_crop(const hwc_frect_t &source_crop);
+    hwc2_error_t set_plane_alpha(float plane_alpha);
+    hwc2_error_t set_z_order(uint32_t z_order);
+    hwc2_error_t set_transform(hwc_transform_t transform);
+    hwc2_error_t set_dataspace(android_dataspace_t dataspace);
+    hwc2_error_t set_color(const hwc_color_t &color);
+    hwc2_error_t set_visible_region(const hwc_region_t &visible_region);
+    hwc2_error_t set_surface_damage(const hwc_region_t &surface_damage);
 private:
+    buffer_handle_t handle;
+    int32_t acquire_fence;
     hwc2_blend_mode_t blend_mode;
+    hwc_rect_t display_frame;
+    hwc_frect_t source_crop;
+    float plane_alpha;
+    uint32_t z_order;
+    hwc_transform_t transform;
+    android_dataspace_t dataspace;
+    hwc_color_t color;
+    hwc2_region visible_region;
+    hwc2_region surface_damage;
+    /* Set when SurfaceFlinger did not provide any damage, in which case the
+     * whole buffer has to be treated as damaged */
+    bool full_damage;
+    /* Whether anything affecting the placement or the pixels of the buffer
+     * was set since the last present */
+    bool geometry_changed;
+    bool content_changed;
+};
+
+#ifdef HWC2_TRACE
+/* Spans kept per thread, the oldest are overwritten once a ring is full */
+#define HWC2_TRACE_EVENTS 4096
+
+/* Scoped trace spans recorded into per thread rings and written out as
+ * Chrome trace event JSON. Tracing is turned on with the debug.hwc2.trace
+ * property, which is looked at whenever dump is called, and every dump
+ * while it is on writes the rings to HWC2_TRACE_PATH. */
+class hwc2_trace {
+public:
+    static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+    static void record(const char *name, nsecs_t start, nsecs_t end);
+    static void update(std::string *out);
+
+    class span {
+    public:
+        span(const char *name)
+            : name(name),
+              start(is_enabled()? systemTime(SYSTEM_TIME_MONOTONIC): 0) { }
+        ~span()
+        {
+            if (start)
+                record(name, start, systemTime(SYSTEM_TIME_MONOTONIC));
+        }
+    private:
+        const char *name;
+        nsecs_t start;
+    };
+
+private:
+    struct event {
+        const char *name;
+        nsecs_t start;
+        nsecs_t end;
+    };
+
+    /* Only the owning thread writes a ring, head counts every event ever
+     * written to it */
+    struct ring {
+        std::array<event, HWC2_TRACE_EVENTS> events;
+        std::atomic<uint32_t> head;
+        int tid;
+    };
+
+    static std::atomic<bool> enabled;
+    static std::mutex rings_mutex;
+    static std::vector<ring *> rings;
+    static thread_local ring *local_ring;
+
+    static int write_json(const char *path);
+};
+
+#define HWC2_TRACE_CONCAT2(a, b) a##b
+#define HWC2_TRACE_CONCAT(a, b) HWC2_TRACE_CONCAT2(a, b)
+#define HWC2_TRACE_SCOPE(name) \
+    hwc2_trace::span HWC2_TRACE_CONCAT(trace_span_, __LINE__)(name)
+#else
+#define HWC2_TRACE_SCOPE(name) do { } while (0)
+#endif
+
+/* Per display counters, bumped on the hot path */
+enum hwc2_stat_counter {
+    HWC2_STAT_FRAMES_PRESENTED,
+    HWC2_STAT_FRAMES_SKIPPED,
+    HWC2_STAT_LAYERS_DEVICE,
+    HWC2_STAT_LAYERS_CLIENT,
+    HWC2_STAT_LAYERS_SOLID_COLOR,
+    HWC2_STAT_LAYERS_CURSOR,
+    HWC2_STAT_LAYERS_PLANE,
+    HWC2_STAT_BYTES_WRITTEN,
+    HWC2_STAT_CACHE_HITS,
+    HWC2_STAT_CACHE_MISSES,
+    HWC2_STAT_VSYNC_MISSES,
+    HWC2_STAT_DEADLINE_MISSES,
+    HWC2_STAT_IDLE_ENTRIES,
+    HWC2_STAT_CNT,
+};
+
+enum hwc2_stat_timing {
+    HWC2_TIMING_VALIDATE,
+    HWC2_TIMING_PRESENT,
+    HWC2_TIMING_COMPOSE,
+    HWC2_TIMING_CNT,
+};
+
+/* Latency buckets double in size from 1 us, the last one takes everything
+ * from 16 ms up */
+#define HWC2_TIMING_BUCKETS 16
+
+/* Counters and latency histograms of a display. Updates are relaxed atomic
+ * adds so the vsync thread can bump them too and dump can read them
+ * without taking any lock. */
+class hwc2_stats {
+public:
+    hwc2_stats();
+
+    void add(hwc2_stat_counter counter, uint64_t value = 1)
+    {
+        counters[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+    void record(hwc2_stat_timing timing, nsecs_t duration)
+    {
+        uint32_t us = duration > 0? duration / 1000: 0;
+        uint32_t bucket = us? std::min(32 - __builtin_clz(us),
+                HWC2_TIMING_BUCKETS - 1): 0;
+        buckets[timing][bucket].fetch_add(1, std::memory_order_relaxed);
+        totals[timing].fetch_add(us, std::memory_order_relaxed);
+    }
+    void dump(std::string *out) const;
+
+    /* Records the time from its creation to the end of the scope */
+    class timer {
+    public:
+        timer(hwc2_stats &stats, hwc2_stat_timing timing)
+            : stats(stats),
+              timing(timing),
+              start(systemTime(SYSTEM_TIME_MONOTONIC)) { }
+        ~timer()
+        {
+            stats.record(timing, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+        }
+    private:
+        hwc2_stats &stats;
+        hwc2_stat_timing timing;
+        nsecs_t start;
+    };
+
+private:
+    std::array<std::atomic<uint64_t>, HWC2_STAT_CNT> counters;
+    std::array<std::array<std::atomic<uint32_t>, HWC2_TIMING_BUCKETS>,
+            HWC2_TIMING_CNT> buckets;
+    /* Sum of the recorded times in us */
+    std::array<std::atomic<uint64_t>, HWC2_TIMING_CNT> totals;
+};
+
+/*
+ * Vsync timestamps filtered into a period and phase estimate, and a running
+ * average of what composing a frame into the panel costs. present_display
+ * uses it to count frames that were still being written when the panel
+ * started scanning them out. The vsync thread feeds it, so it keeps its own
+ * lock.
+ */
+class hwc2_vsync_model {
+public:
+    hwc2_vsync_model();
+
+    void reset(int64_t period);
+    void add_sample(nsecs_t timestamp);
+    nsecs_t get_next_vsync(nsecs_t now) const;
+    bool add_compose_time(nsecs_t duration, nsecs_t end, nsecs_t deadline);
+    void dump(std::string *out) const;
+
+private:
+    mutable std::mutex mutex;
+    int64_t nominal_period;
+    int64_t period;
+    /* Filtered timestamp of the last vsync and samples since the last
+     * resync, the estimate is used once there are a few of them */
+    nsecs_t phase;
+    uint32_t sample_cnt;
+    nsecs_t compose_cost;
+};
+
+/* Quality tiers of the governor, each one keeps the savings of the ones
+ * before it */
+enum hwc2_quality_tier {
+    HWC2_QUALITY_FULL,
+    /* Mirrors are scaled with nearest sampling */
+    HWC2_QUALITY_NEAREST_SCALING,
+    /* Scaled and YUV layers are left to the client */
+    HWC2_QUALITY_CLIENT_SCALED,
+    /* Every layer but solid colors and the cursor is left to the client */
+    HWC2_QUALITY_CLIENT_ALL,
+    HWC2_QUALITY_CNT,
+};
+
+/*
+ * Watches how long composition takes against the frame budget and steps
+ * quality down while it keeps running over, then back up once it has been
+ * well under for a while. A step up that has to be taken back right away
+ * makes the next one wait twice as long.
+ */
+class hwc2_governor {
+public:
+    hwc2_governor(bool scaling);
+
+    hwc2_quality_tier get_tier() const { return tier; }
+    const char *get_tier_name() const;
+    bool add_compose_time(nsecs_t duration, int64_t budget);
+
+private:
+    /* Whether the display scales frames, see HWC2_QUALITY_NEAREST_SCALING */
+    bool scaling;
+    hwc2_quality_tier tier;
+    nsecs_t average;
+    uint32_t over_frames;
+    uint32_t under_frames;
+    /* Frames at the current tier, whether it was reached by stepping up and
+     * how many frames well under budget the next step up needs */
+    uint32_t tier_frames;
+    bool stepped_up;
+    uint32_t up_frames;
+};
+
+/* Call stream files written by hwc2_recorder and read by hwc2_replay: a
+ * header followed by records, all in host byte order */
+#define HWC2_RECORD_MAGIC 0x32435748
+#define HWC2_RECORD_VERSION 1
+
+/* Records of HAL calls use the function descriptor as type. A buffer record
+ * describes a buffer before its first use and whenever its contents were
+ * sampled: handle, width, height, format and the size of a pixel row, which
+ * is 0 when the record carries no pixels. */
+#define HWC2_RECORD_BUFFER 0x100
+
+struct hwc2_record_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+/* Followed by word_cnt 64 bit words, the rest of size is the blob */
+struct hwc2_record {
+    uint32_t size;
+    uint16_t type;
+    uint16_t word_cnt;
+    int64_t timestamp;
+};
+
+/*
+ * Appends every call that changes HAL state, with its arguments, to a file
+ * that hwc2_replay can drive the HAL with again. Turned on by setting
+ * debug.hwc2.record to the file to write before the composer starts.
+ * debug.hwc2.record.sample makes one in that many buffer updates save the
+ * buffer contents as well, which waits for the buffer to be ready.
+ */
+class hwc2_recorder {
+public:
+    hwc2_recorder();
+    ~hwc2_recorder();
+
+    int open(const char *path, uint32_t sample_rate);
+    void record(int32_t type, std::initializer_list<uint64_t> words,
+                    const void *blob = nullptr, size_t blob_size = 0)
+    {
+        if (file)
+            write_record(type, words, blob, blob_size);
+    }
+    void record_buffer(buffer_handle_t handle, int32_t acquire_fence,
+                    bool sample)
+    {
+        if (file && handle)
+            write_buffer(handle, acquire_fence, sample);
+    }
+
+private:
+    std::mutex mutex;
+    FILE *file;
+    uint32_t sample_rate;
+    uint64_t sample_cnt;
+    /* Width, height and format last described for each buffer */
+    std::unordered_map<buffer_handle_t, std::array<uint32_t, 3>> buffers;
+    std::vector<uint8_t> pixels;
+
+    void write_record(int32_t type, std::initializer_list<uint64_t> words,
+                    const void *blob, size_t blob_size);
+    void write_buffer(buffer_handle_t handle, int32_t acquire_fence,
+                    bool sample);
+};
+
+/*
+ * Memory for large intermediate surfaces. Blocks are rounded up to a size
+ * class and kept mapped once given back, so that the next surface of that
+ * class costs neither a mapping nor page faults. New blocks are faulted in
+ * right away, on transparent huge pages when asked to. Everything mapped is
+ * held to a byte budget: free blocks are unmapped least recently used first
+ * to make room, and a request still over it fails.
+ */
+class hwc2_surface_pool {
+public:
+    /* A block handed out, it goes back to the pool when destroyed or reset */
+    class buffer {
+    public:
+        buffer()
+            : pool(nullptr),
+              ptr(nullptr),
+              len(0) { }
+        buffer(buffer &&other);
+        buffer &operator=(buffer &&other);
+        ~buffer() { reset(); }
+
+        uint8_t *data() const { return ptr; }
+        size_t size() const { return len; }
+        bool empty() const { return !ptr; }
+        void reset();
+
+    private:
+        friend class hwc2_surface_pool;
+        buffer(hwc2_surface_pool *pool, uint8_t *ptr, size_t len)
+            : pool(pool),
+              ptr(ptr),
+              len(len) { }
+
+        hwc2_surface_pool *pool;
+        uint8_t *ptr;
+        size_t len;
+    };
+
+    hwc2_surface_pool();
+    ~hwc2_surface_pool();
+
+    void configure(size_t budget, bool hugepages);
+    buffer acquire(size_t size);
+    void dump(std::string *out) const;
+
+private:
+    struct block {
+        uint8_t *data;
+        uint64_t last_use;
+    };
+
+    mutable std::mutex mutex;
+    size_t budget;
+    bool hugepages;
+    /* Free blocks by size class, least recently used first */
+    std::unordered_map<size_t, std::vector<block>> free_blocks;
+    size_t mapped_size;
+    size_t used_size;
+    uint64_t use_cnt;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t reclaims;
+    uint64_t failures;
+
+    void release(uint8_t *data, size_t size);
+    bool reclaim();
+    uint8_t *map_block(size_t size);
+    static size_t get_size_class(size_t size);
+};
+
+/*
+ * Starts the threads of the HAL with the scheduling set up for their role:
+ * a SCHED_FIFO priority and the CPUs they may run on, read once from a
+ * config file when the device is opened. Threads are named after what they
+ * serve and their run time and involuntary context switches show in dump.
+ */
+class hwc2_scheduler {
+public:
+    hwc2_scheduler();
+
+    int load(const char *path);
+    std::thread create(const char *role, const std::string &name,
+                    std::function<void()> fn);
+    void dump(std::string *out) const;
+
+private:
+    /* Priority 0 leaves a thread at SCHED_OTHER, an empty cpus string lets
+     * it run anywhere */
+    struct policy {
+        int priority;
+        std::string cpus;
+        cpu_set_t mask;
+    };
+
+    /* What the thread actually got, a policy that failed to apply leaves
+     * it at SCHED_OTHER or on any CPU */
+    struct thread_info {
+        std::string name;
+        pid_t tid;
+        int priority;
+        std::string cpus;
+    };
+
+    /* Only written by load, before any thread is created */
+    std::unordered_map<std::string, policy> policies;
+    mutable std::mutex mutex;
+    std::list<thread_info> threads;
+
+    void run(const std::string &role, const std::string &name,
+                    const std::function<void()> &fn);
+    static bool parse_cpus(const char *cpus, cpu_set_t *out_mask);
 };
 
 class hwc2_callback {
@@ -43,6 +684,7 @@ public:
             hwc2_function_pointer_t pointer);
 
     void call_hotplug(hwc2_display_t dpy_id, hwc2_connection_t connection);
+    void call_refresh(hwc2_display_t dpy_id);
 	void call_vsync(hwc2_display_t dpy_id, int64_t timestamp);
 private:
     std::mutex state_mutex;
@@ -63,6 +705,12 @@ public:
     int32_t get_attribute(hwc2_attribute_t attribute) const;
 	int set_attribute(hwc2_attribute_t attribute, int32_t value);
 
+    /* Panel timings applied when the config is made active, virtual display
+     * configs have none */
+    const struct fb_var_screeninfo *get_mode() const
+                    { return has_mode? &mode: nullptr; }
+    void set_mode(const struct fb_var_screeninfo &mode);
+
 private:
     int32_t width;
     int32_t height;
@@ -71,6 +719,9 @@ private:
 
     int32_t dpi_x;
     int32_t dpi_y;
+
+    struct fb_var_screeninfo mode;
+    bool has_mode;
 };
 
 class hwc2_layer {
@@ -79,16 +730,82 @@ public:
 
     hwc2_layer_t get_id() const { return id; }
     hwc2_composition_t  get_comp_type() const { return comp_type; }
+    hwc2_buffer &get_buffer() { return buffer; }
+    const hwc2_buffer &get_buffer() const { return buffer; }
+    uint32_t get_z_order() const { return buffer.get_z_order(); }
+    const hwc2_region &get_comp_region() const { return comp_region; }
+    void set_comp_region(const hwc2_region &comp_region)
+                    { this->comp_region = comp_region; }
+    bool is_device_supported() const;
+    bool is_opaque() const;
+    bool is_type_changed() const { return type_changed; }
+    bool is_changed() const;
+    void clear_changed();
     hwc2_error_t set_comp_type(hwc2_composition_t comp_type);
+    hwc2_error_t set_buffer(buffer_handle_t handle, int32_t acquire_fence);
     hwc2_error_t set_blend_mode(hwc2_blend_mode_t blend_mode);
+    hwc2_error_t set_display_frame(const hwc_rect_t &display_frame);
+    hwc2_error_t set_source_crop(const hwc_frect_t &source_crop);
+    hwc2_error_t set_plane_alpha(float plane_alpha);
+    hwc2_error_t set_z_order(uint32_t z_order);
+    hwc2_error_t set_transform(hwc_transform_t transform);
+    hwc2_error_t set_dataspace(android_dataspace_t dataspace);
+    hwc2_error_t set_color(const hwc_color_t &color);
+    hwc2_error_t set_visible_region(const hwc_region_t &visible_region);
+    hwc2_error_t set_surface_damage(const hwc_region_t &surface_damage);
+    nsecs_t get_update_interval(nsecs_t now) const;
     static hwc2_layer_t get_next_id();
 private:
     hwc2_layer_t id;
     hwc2_buffer buffer;
     hwc2_composition_t comp_type;
+    /* When the last buffers were set, as a ring indexed by update_cnt */
+    std::array<nsecs_t, HWC2_CADENCE_WINDOW> update_times;
+    uint32_t update_cnt;
+    /* The part of the layer that is not hidden by opaque layers above it,
+     * computed by the occlusion pass in validate_display */
+    hwc2_region comp_region;
+    bool type_changed;
     static uint64_t layer_cnt;
 };
 
+/* What a plane can do, as found by the backend that provides it */
+enum hwc2_plane_cap {
+    HWC2_PLANE_CAP_RGB = 1 << 0,
+    HWC2_PLANE_CAP_YUV = 1 << 1,
+    HWC2_PLANE_CAP_SCALING = 1 << 2,
+    HWC2_PLANE_CAP_BLENDING = 1 << 3,
+    HWC2_PLANE_CAP_CURSOR = 1 << 4,
+};
+
+/*
+ * A display controller window next to the one scanning out the framebuffer.
+ * Windows below it show through where the framebuffer is transparent, those
+ * above it are blended over it. validate_display puts layers on the windows
+ * able to show them and composes only the rest.
+ */
+class hwc2_plane {
+public:
+    hwc2_plane(uint32_t id, bool above, uint32_t caps);
+
+    uint32_t get_id() const { return id; }
+    bool is_above() const { return above; }
+    bool is_cursor() const { return cursor; }
+    bool can_show(const hwc2_layer &lyr) const;
+    void dump(std::string *out) const;
+
+private:
+    uint32_t id;
+    bool above;
+    /* Formats it scans out, whether it scales and blends translucent
+     * buffers, and whether it only takes the cursor */
+    bool rgb;
+    bool yuv;
+    bool scaling;
+    bool blending;
+    bool cursor;
+};
+
 class hwc2_display {
 public:
     hwc2_display(hwc2_display_t id, 
@@ -96,6 +813,8 @@ public:
                     hwc2_connection_t connection,
                     hwc2_power_mode_t power_mode,
                     hwc2_display_type_t type);
+    hwc2_display(hwc2_display_t id, uint32_t width, uint32_t height,
+                    const hwc2_display *mirror_source);
     ~hwc2_display();
     hwc2_error_t get_name(uint32_t *out_size, char *out_name) const;
     void init_name();
@@ -103,6 +822,9 @@ public:
     hwc2_display_type_t get_type() const { return type; }
     hwc2_connection_t get_connection() const { return connection; }
     hwc2_vsync_t get_vsync_enabled() const { return vsync_enabled; }
+    int open_fb(hwc2_surface_pool &pool);
+    void start_vsync_thread(hwc2_callback *callback,
+                    hwc2_scheduler &scheduler);
     int retrieve_display_configs();
     hwc2_error_t get_display_attribute(hwc2_config_t config,
                     hwc2_attribute_t attribute, int32_t *out_value) const;
@@ -120,6 +842,50 @@ public:
                     hwc2_composition_t comp_type);
     hwc2_error_t set_layer_blend_mode(hwc2_layer_t lyr_id,
                     hwc2_blend_mode_t blend_mode);
+    hwc2_error_t set_layer_visible_region(hwc2_layer_t lyr_id,
+                    const hwc_region_t &visible_region);
+    hwc2_error_t set_layer_surface_damage(hwc2_layer_t lyr_id,
+                    const hwc_region_t &surface_damage);
+    hwc2_error_t set_layer_buffer(hwc2_layer_t lyr_id, buffer_handle_t handle,
+                    int32_t acquire_fence);
+    hwc2_error_t set_layer_display_frame(hwc2_layer_t lyr_id,
+                    const hwc_rect_t &display_frame);
+    hwc2_error_t set_layer_source_crop(hwc2_layer_t lyr_id,
+                    const hwc_frect_t &source_crop);
+    hwc2_error_t set_layer_plane_alpha(hwc2_layer_t lyr_id, float plane_alpha);
+    hwc2_error_t set_layer_z_order(hwc2_layer_t lyr_id, uint32_t z_order);
+    hwc2_error_t set_layer_transform(hwc2_layer_t lyr_id,
+                    hwc_transform_t transform);
+    hwc2_error_t set_layer_color(hwc2_layer_t lyr_id, const hwc_color_t &color);
+    hwc2_error_t set_layer_dataspace(hwc2_layer_t lyr_id,
+                    android_dataspace_t dataspace);
+    hwc2_error_t set_cursor_position(hwc2_layer_t lyr_id, int32_t x, int32_t y);
+    hwc2_error_t set_color_transform(const float *matrix,
+                    android_color_transform_t hint);
+    void load_color_modes();
+    hwc2_error_t get_color_modes(uint32_t *out_num_modes,
+                    android_color_mode_t *out_modes) const;
+    hwc2_error_t set_color_mode(android_color_mode_t mode);
+    hwc2_error_t set_client_target(buffer_handle_t target,
+                    int32_t acquire_fence, android_dataspace_t dataspace,
+                    const hwc_region_t &damage);
+    hwc2_error_t set_output_buffer(buffer_handle_t buffer,
+                    int32_t release_fence);
+    hwc2_error_t validate_display(uint32_t *out_num_types,
+                    uint32_t *out_num_requests);
+    hwc2_error_t get_changed_composition_types(uint32_t *out_num_elements,
+                    hwc2_layer_t *out_layers,
+                    hwc2_composition_t *out_types) const;
+    hwc2_error_t get_display_requests(int32_t *out_display_requests,
+                    uint32_t *out_num_elements, hwc2_layer_t *out_layers,
+                    int32_t *out_layer_requests) const;
+    hwc2_error_t accept_display_changes();
+    hwc2_error_t present_display(int32_t *out_present_fence);
+    hwc2_error_t get_release_fences(uint32_t *out_num_elements,
+                    hwc2_layer_t *out_layers, int32_t *out_fences) const;
+    void set_planes(std::vector<hwc2_plane> planes);
+    uint32_t get_layer_plane(hwc2_layer_t lyr_id) const;
+    void dump(std::string *out) const;
     static hwc2_display_t get_next_id();
     static void reset_ids() { display_cnt = 0; }
 private:
@@ -129,11 +895,160 @@ private:
     hwc2_display_t id;
     struct nvfb_device fb_dev;
     std::unordered_map<hwc2_layer_t, hwc2_layer> layers;
+    hwc2_buffer client_target;
+    /* Where virtual displays are composed to, its fence has to signal
+     * before the buffer may be written */
+    hwc2_buffer output_buffer;
     std::string name;
     hwc2_power_mode_t power_mode;
     hwc2_display_type_t type;
     hwc2_vsync_t vsync_enabled;
+
+    /* Panels report vsync from their own thread, which sleeps while vsync
+     * is disabled. vsync_mutex guards vsync_enabled, vsync_period,
+     * vsync_exit, vsync_retry_hw and the idle state against it. */
+    std::thread vsync_thread;
+    std::mutex vsync_mutex;
+    std::condition_variable vsync_cond;
+    int64_t vsync_period;
+    bool vsync_exit;
+    /* Vsyncs delivered since the screen last changed, up to
+     * HWC2_IDLE_FRAMES. With that many the panel goes idle when
+     * SurfaceFlinger turns vsync off, and stays so until the next change
+     * or until vsync is turned back on. */
+    uint32_t static_vsyncs;
+    bool idle;
+    /* Set when the panel is turned on, so that a vsync thread that fell
+     * back to the timer after FBIO_WAITFORVSYNC failed tries it again */
+    bool vsync_retry_hw;
+    hwc2_callback *callback;
+
+    /* Hardware vsync seen by the vsync thread */
+    hwc2_vsync_model vsync_model;
+
+    /* Config whose timings the panel runs at. It leaves active_config while
+     * the refresh rate follows the frame rate of video content, once
+     * content_config has been picked for HWC2_CONTENT_RATE_FRAMES frames
+     * in a row and vsync events are enabled, which is the only way
+     * SurfaceFlinger learns about the change. */
+    hwc2_config_t applied_config;
+    hwc2_config_t content_config;
+    uint32_t content_frames;
+
+    hwc2_stats stats;
+    hwc2_governor governor;
+
+    /* Composition state, valid between validate_display and present_display.
+     * comp_layers is sorted by z order, bottom layer first. */
+    hwc2_compositor compositor;
+    std::vector<hwc2_layer *> comp_layers;
+    std::unordered_map<hwc2_layer_t, hwc2_composition_t> changed_types;
+    hwc2_region clear_region;
+    hwc2_region client_region;
+    hwc2_region client_opaque_region;
+    /* Set when every layer left after culling is a solid color */
+    bool fill_only;
+    bool validated;
+    bool color_transform_supported;
+    /* Whether the client target still needs the color transform applied */
+    bool transform_client_target;
+
+    /* Color modes with the LUT that implements them, loaded once when the
+     * display is opened. Native has no LUT unless the panel is calibrated. */
+    std::vector<std::pair<android_color_mode_t, hwc2_lut>> color_modes;
+    android_color_mode_t color_mode;
+    const hwc2_lut *color_lut;
+    /* Set by validate_display when nothing but the cursor changed since the
+     * last present, in which case the framebuffer is kept as it is */
+    bool cursor_only;
+    /* Set when the framebuffer no longer holds the last presented frame */
+    bool full_redraw;
+
+    /* The topmost cursor layer is kept out of comp_layers and drawn last,
+     * over a saved copy of the pixels beneath it. Moving it only restores
+     * the old rect and draws the new one. */
+    hwc2_layer *cursor_layer;
+    std::mutex cursor_mutex;
+    buffer_handle_t cursor_handle;
+    std::vector<uint8_t> cursor_image;
+    hwc2_surface cursor_src;
+    std::vector<uint8_t> cursor_save;
+    hwc_rect_t cursor_rect;
+    bool cursor_saved;
+    /* Old and new rects of cursor moves drawn since the last present, which
+     * the damage of the next panel frame has to include for mirrors */
+    hwc2_region cursor_damage;
+
+    /* Windows layers are shown on instead of being composed, bottom one
+     * first. fbdev gives no access to them, so panels have none unless a
+     * backend hands some over with set_planes, which only the host tests
+     * do so far. plane_layers holds what each plane shows this frame and
+     * underlay_region the part of the framebuffer left transparent for
+     * the planes below it. */
+    std::vector<hwc2_plane> planes;
+    std::vector<std::pair<const hwc2_plane *, hwc2_layer *>> plane_layers;
+    hwc2_region underlay_region;
+
+    /* With debug.hwc2.shadow_fb set, panels are composed into a copy of the
+     * framebuffer in cached memory, since blending reads the destination
+     * and the framebuffer mapping is uncached. Rows that changed are marked
+     * in shadow_dirty and copied to the framebuffer after every frame. The
+     * copy comes from the surface pool and goes back to it while the panel
+     * is off. */
+    hwc2_surface_pool *pool;
+    bool use_shadow;
+    hwc2_surface_pool::buffer shadow;
+    std::vector<uint8_t> shadow_dirty;
+
+    /* Frames presented on the panel and the region each of them changed,
+     * oldest first, so that mirrors only update what changed */
+    uint64_t frame_serial;
+    std::deque<std::pair<uint64_t, hwc2_region>> damage_history;
+
+    /* A virtual display showing the same layers as the panel at a smaller
+     * size is scaled down from the panel framebuffer into mirror_frame
+     * instead of being composed again. mirror_buffers remembers the panel
+     * frame each output buffer was last updated to. */
+    const hwc2_display *mirror_source;
+    bool mirroring;
+    uint64_t mirror_serial;
+    hwc_rect_t mirror_frame;
+    std::vector<std::pair<buffer_handle_t, uint64_t>> mirror_buffers;
+
     static uint64_t display_cnt;
+
+    hwc2_surface get_fb_surface() const;
+    hwc2_surface get_scanout_surface() const;
+    void acquire_shadow();
+    void upload_shadow(const hwc2_region &damage);
+    void vsync_loop();
+    void wake_up(bool refresh);
+    int apply_config(hwc2_config_t config);
+    hwc2_config_t get_content_config(nsecs_t now) const;
+    void update_content_rate();
+    bool is_virtual() const { return type == HWC2_DISPLAY_TYPE_VIRTUAL; }
+    bool lock_target(hwc2_surface *out_target);
+    void unlock_target();
+    bool is_frame_changed() const;
+    void count_layers();
+    void cull_occluded_layers();
+    void assign_planes();
+    const hwc2_plane *get_plane(const hwc2_layer &lyr) const;
+    hwc2_composition_t get_effective_comp_type(const hwc2_layer &lyr) const;
+    bool is_demoted(const hwc2_layer &lyr) const;
+    void draw_layer(const hwc2_surface &target, hwc2_layer &lyr);
+    void draw_fill(const hwc2_surface &target, const hwc2_layer &lyr);
+    void draw_client_target(const hwc2_surface &target);
+    void draw_layers(const hwc2_surface &target);
+    void draw_fill_only(const hwc2_surface &target);
+    bool cache_cursor_image(hwc2_buffer &buffer);
+    void save_cursor_under(const hwc2_surface &target, const hwc_rect_t &rect);
+    void restore_cursor_under(const hwc2_surface &target);
+    void draw_cursor(const hwc2_surface &target);
+    hwc2_region get_frame_damage() const;
+    bool get_damage_since(uint64_t serial, hwc2_region *out_damage) const;
+    bool can_mirror();
+    void draw_mirror(const hwc2_surface &target);
 };
 
 class hwc2_dev {
@@ -163,17 +1078,87 @@ public:
                     hwc2_layer_t lyr_id, hwc2_composition_t comp_type);
     hwc2_error_t set_layer_blend_mode(hwc2_display_t dpy_id,
                     hwc2_layer_t lyr_id, hwc2_blend_mode_t blend_mode);
+    hwc2_error_t set_layer_visible_region(hwc2_display_t dpy_id,
+                    hwc2_layer_t lyr_id, const hwc_region_t &visible_region);
+    hwc2_error_t set_layer_surface_damage(hwc2_display_t dpy_id,
+                    hwc2_layer_t lyr_id, const hwc_region_t &surface_damage);
+    hwc2_error_t set_layer_buffer(hwc2_display_t dpy_id, hwc2_layer_t lyr_id,
+                    buffer_handle_t handle, int32_t acquire_fence);
+    hwc2_error_t set_layer_display_frame(hwc2_display_t dpy_id,
+                    hwc2_layer_t lyr_id, const hwc_rect_t &display_frame);
+    hwc2_error_t set_layer_source_crop(hwc2_display_t dpy_id,
+                    hwc2_layer_t lyr_id, const hwc_frect_t &source_crop);
+    hwc2_error_t set_layer_plane_alpha(hwc2_display_t dpy_id,
+                    hwc2_layer_t lyr_id, float plane_alpha);
+    hwc2_error_t set_layer_z_order(hwc2_display_t dpy_id, hwc2_layer_t lyr_id,
+                    uint32_t z_order);
+    hwc2_error_t set_layer_transform(hwc2_display_t dpy_id,
+                    hwc2_layer_t lyr_id, hwc_transform_t transform);
+    hwc2_error_t set_layer_color(hwc2_display_t dpy_id, hwc2_layer_t lyr_id,
+                    const hwc_color_t &color);
+    hwc2_error_t set_layer_dataspace(hwc2_display_t dpy_id,
+                    hwc2_layer_t lyr_id, android_dataspace_t dataspace);
+    hwc2_error_t set_cursor_position(hwc2_display_t dpy_id,
+                    hwc2_layer_t lyr_id, int32_t x, int32_t y);
+    hwc2_error_t set_color_transform(hwc2_display_t dpy_id,
+                    const float *matrix, android_color_transform_t hint);
+    hwc2_error_t get_color_modes(hwc2_display_t dpy_id,
+                    uint32_t *out_num_modes,
+                    android_color_mode_t *out_modes) const;
+    hwc2_error_t set_color_mode(hwc2_display_t dpy_id,
+                    android_color_mode_t mode);
+    hwc2_error_t set_client_target(hwc2_display_t dpy_id,
+                    buffer_handle_t target, int32_t acquire_fence,
+                    android_dataspace_t dataspace, const hwc_region_t &damage);
+    hwc2_error_t create_virtual_display(uint32_t width, uint32_t height,
+                    android_pixel_format_t *format,
+                    hwc2_display_t *out_display);
+    hwc2_error_t destroy_virtual_display(hwc2_display_t dpy_id);
+    hwc2_error_t set_output_buffer(hwc2_display_t dpy_id,
+                    buffer_handle_t buffer, int32_t release_fence);
+    hwc2_error_t validate_display(hwc2_display_t dpy_id,
+                    uint32_t *out_num_types, uint32_t *out_num_requests);
+    hwc2_error_t get_changed_composition_types(hwc2_display_t dpy_id,
+                    uint32_t *out_num_elements, hwc2_layer_t *out_layers,
+                    hwc2_composition_t *out_types) const;
+    hwc2_error_t get_display_requests(hwc2_display_t dpy_id,
+                    int32_t *out_display_requests, uint32_t *out_num_elements,
+                    hwc2_layer_t *out_layers, int32_t *out_layer_requests) const;
+    hwc2_error_t accept_display_changes(hwc2_display_t dpy_id);
+    hwc2_error_t present_display(hwc2_display_t dpy_id,
+                    int32_t *out_present_fence);
+    hwc2_error_t get_release_fences(hwc2_display_t dpy_id,
+                    uint32_t *out_num_elements, hwc2_layer_t *out_layers,
+                    int32_t *out_fences) const;
     void hotplug(hwc2_display_t dpy_id, hwc2_connection_t connection);
     void vsync(hwc2_display_t dpy_id, uint64_t timestamp);
     hwc2_error_t set_vsync_enabled(hwc2_display_t dpy_id, hwc2_vsync_t enabled);
     hwc2_error_t register_callback(hwc2_callback_descriptor_t descriptor,
                     hwc2_callback_data_t callback_data,
                     hwc2_function_pointer_t pointer);
+    void dump(uint32_t *out_size, char *out_buffer);
+    hwc2_recorder &get_recorder() { return recorder; }
 private:
     hwc2_callback callback_handler;
+    hwc2_recorder recorder;
+    /* Both outlive the displays, whose vsync threads and shadow
+     * framebuffers they keep track of */
+    hwc2_scheduler scheduler;
+    hwc2_surface_pool pool;
     std::unordered_map<hwc2_display_t, hwc2_display> displays;
+    /* Built when dump is asked for the size, copied out on the second call */
+    std::string dump_buffer;
+
+    /* External panels are opened on their own threads and announced once
+     * the primary panel has been */
+    std::vector<std::thread> open_threads;
+    std::mutex open_mutex;
+    std::condition_variable open_cond;
+    bool primary_announced;
+    /* When open started, time to the first hotplug is logged against it */
+    nsecs_t open_time;
 
-    int open_fb_display(int fb_id);
+    int open_fb_display(hwc2_display *dpy, bool primary);
 };
 
 struct hwc2_context {
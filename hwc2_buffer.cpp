@@ -15,11 +15,94 @@
  */
 
 #include <cutils/log.h>
+#include <sync/sync.h>
+#include <unistd.h>
 
 #include "hwc2.h"
 
+/* How long a composition is allowed to wait for a buffer producer */
+#define HWC2_FENCE_TIMEOUT_MS 3000
+
+static bool operator!=(const hwc_rect_t &a, const hwc_rect_t &b)
+{
+    return a.left != b.left || a.top != b.top || a.right != b.right
+            || a.bottom != b.bottom;
+}
+
+static bool operator!=(const hwc_frect_t &a, const hwc_frect_t &b)
+{
+    return a.left != b.left || a.top != b.top || a.right != b.right
+            || a.bottom != b.bottom;
+}
+
+static bool operator!=(const hwc_color_t &a, const hwc_color_t &b)
+{
+    return a.r != b.r || a.g != b.g || a.b != b.b || a.a != b.a;
+}
+
 hwc2_buffer::hwc2_buffer()
-    : blend_mode(HWC2_BLEND_MODE_NONE) { }
+    : handle(nullptr),
+      acquire_fence(-1),
+      blend_mode(HWC2_BLEND_MODE_NONE),
+      display_frame({0, 0, 0, 0}),
+      source_crop({0.0f, 0.0f, 0.0f, 0.0f}),
+      plane_alpha(1.0f),
+      z_order(0),
+      transform(static_cast<hwc_transform_t>(0)),
+      dataspace(HAL_DATASPACE_UNKNOWN),
+      color({0, 0, 0, 0}),
+      visible_region(),
+      surface_damage(),
+      full_damage(true),
+      geometry_changed(true),
+      content_changed(true) { }
+
+hwc2_buffer::~hwc2_buffer()
+{
+    close_acquire_fence();
+}
+
+bool hwc2_buffer::is_opaque() const
+{
+    return blend_mode == HWC2_BLEND_MODE_NONE && plane_alpha >= 1.0f;
+}
+
+int hwc2_buffer::wait_acquire_fence()
+{
+    if (acquire_fence < 0)
+        return 0;
+
+    HWC2_TRACE_SCOPE(__func__);
+    int ret = sync_wait(acquire_fence, HWC2_FENCE_TIMEOUT_MS);
+    if (ret < 0)
+        ALOGW("failed to wait for acquire fence %d", acquire_fence);
+
+    close_acquire_fence();
+    return ret;
+}
+
+void hwc2_buffer::close_acquire_fence()
+{
+    if (acquire_fence >= 0) {
+        close(acquire_fence);
+        acquire_fence = -1;
+    }
+}
+
+hwc2_error_t hwc2_buffer::set_buffer(buffer_handle_t handle,
+        int32_t acquire_fence)
+{
+    /* A fence that was never waited on belongs to a frame that got dropped */
+    close_acquire_fence();
+
+    if (handle != this->handle)
+        content_changed = true;
+
+    this->handle = handle;
+    this->acquire_fence = acquire_fence;
+
+    return HWC2_ERROR_NONE;
+}
 
 hwc2_error_t hwc2_buffer::set_blend_mode(hwc2_blend_mode_t blend_mode)
 {
@@ -28,7 +111,119 @@ hwc2_error_t hwc2_buffer::set_blend_mode(hwc2_blend_mode_t blend_mode)
         return HWC2_ERROR_BAD_PARAMETER;
     }
 
+    if (blend_mode != this->blend_mode)
+        geometry_changed = true;
+
     this->blend_mode = blend_mode;
 
     return HWC2_ERROR_NONE;
 }
+
+hwc2_error_t hwc2_buffer::set_display_frame(const hwc_rect_t &display_frame)
+{
+    if (display_frame != this->display_frame)
+        geometry_changed = true;
+
+    this->display_frame = display_frame;
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_buffer::set_source_crop(const hwc_frect_t &source_crop)
+{
+    if (source_crop != this->source_crop)
+        geometry_changed = true;
+
+    this->source_crop = source_crop;
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_buffer::set_plane_alpha(float plane_alpha)
+{
+    if (plane_alpha < 0.0f || plane_alpha > 1.0f) {
+        ALOGE("invalid plane alpha %f", plane_alpha);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    if (plane_alpha != this->plane_alpha)
+        geometry_changed = true;
+
+    this->plane_alpha = plane_alpha;
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_buffer::set_z_order(uint32_t z_order)
+{
+    if (z_order != this->z_order)
+        geometry_changed = true;
+
+    this->z_order = z_order;
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_buffer::set_transform(hwc_transform_t transform)
+{
+    if (transform != this->transform)
+        geometry_changed = true;
+
+    this->transform = transform;
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_buffer::set_dataspace(android_dataspace_t dataspace)
+{
+    if (dataspace != this->dataspace)
+        content_changed = true;
+
+    this->dataspace = dataspace;
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_buffer::set_color(const hwc_color_t &color)
+{
+    if (color != this->color)
+        content_changed = true;
+
+    this->color = color;
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_buffer::set_visible_region(const hwc_region_t &visible_region)
+{
+    if (visible_region.numRects && !visible_region.rects) {
+        ALOGE("invalid visible region");
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    hwc2_region region(visible_region);
+    if (region != this->visible_region) {
+        this->visible_region = region;
+        geometry_changed = true;
+    }
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_buffer::set_surface_damage(const hwc_region_t &surface_damage)
+{
+    if (surface_damage.numRects && !surface_damage.rects) {
+        ALOGE("invalid surface damage");
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    /* No rects at all means unknown damage while a single empty rect means
+     * nothing changed, which is why the two cannot share the region */
+    this->surface_damage.set(surface_damage);
+    full_damage = !surface_damage.numRects;
+
+    if (full_damage || !this->surface_damage.empty())
+        content_changed = true;
+
+    return HWC2_ERROR_NONE;
+}
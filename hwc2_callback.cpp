@@ -74,6 +74,14 @@ void hwc2_callback::call_hotplug(hwc2_display_t dpy_id,
         hotplug_pending.push(std::make_pair(dpy_id, connection));
 }
 
+void hwc2_callback::call_refresh(hwc2_display_t dpy_id)
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+
+    if (refresh)
+        refresh(refresh_data, dpy_id);
+}
+
 void hwc2_callback::call_vsync(hwc2_display_t dpy_id, int64_t timestamp)
 {
     std::lock_guard<std::mutex> lock(state_mutex);
@@ -0,0 +1,1670 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cutils/log.h>
+#include <errno.h>
+#include <mutex>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "hwc2.h"
+
+/*
+ * Rows are converted to a canonical 32 bit pixel before they are blended:
+ * R in bits 0-7, G in bits 8-15, B in bits 16-23 and A in bits 24-31, which
+ * is the in-memory layout of HAL_PIXEL_FORMAT_RGBA_8888. Canonical pixels
+ * are always premultiplied.
+ */
+
+static inline uint32_t scale_pixel(uint32_t pixel, uint32_t alpha)
+{
+    uint32_t rb = (pixel & 0x00ff00ff) * alpha + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+
+    uint32_t ag = ((pixel >> 8) & 0x00ff00ff) * alpha + 0x00800080;
+    ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+
+    return rb | ag;
+}
+
+static inline uint32_t swap_rb(uint32_t pixel)
+{
+    return (pixel & 0xff00ff00) | ((pixel >> 16) & 0xff)
+            | ((pixel & 0xff) << 16);
+}
+
+static inline uint16_t to_rgb565(uint32_t pixel)
+{
+    return ((pixel & 0xf8) << 8) | ((pixel >> 5) & 0x07e0)
+            | ((pixel >> 19) & 0x1f);
+}
+
+static inline uint32_t load_pixel(const uint8_t *src, int32_t format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+        return *reinterpret_cast<const uint32_t *>(src);
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+        return *reinterpret_cast<const uint32_t *>(src) | 0xff000000;
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        return swap_rb(*reinterpret_cast<const uint32_t *>(src));
+    case HAL_PIXEL_FORMAT_RGB_565: {
+        uint32_t val = *reinterpret_cast<const uint16_t *>(src);
+        uint32_t r = (val >> 11) & 0x1f, g = (val >> 5) & 0x3f, b = val & 0x1f;
+        return ((r << 3) | (r >> 2)) | (((g << 2) | (g >> 4)) << 8)
+                | (((b << 3) | (b >> 2)) << 16) | 0xff000000;
+    }
+    default:
+        return 0;
+    }
+}
+
+static inline void store_pixel(uint8_t *dst, int32_t format, uint32_t pixel)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+        *reinterpret_cast<uint32_t *>(dst) = pixel;
+        break;
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        *reinterpret_cast<uint32_t *>(dst) = swap_rb(pixel);
+        break;
+    case HAL_PIXEL_FORMAT_RGB_565:
+        *reinterpret_cast<uint16_t *>(dst) = to_rgb565(pixel);
+        break;
+    }
+}
+
+/* Converts a canonical pixel to the byte order of a 32 bit format so that
+ * the fill kernels below can work on raw memory */
+static inline uint32_t to_format_order(uint32_t pixel, int32_t format)
+{
+    return format == HAL_PIXEL_FORMAT_BGRA_8888? swap_rb(pixel): pixel;
+}
+
+/* Stores pixel cnt times using the widest stores available */
+static void fill_row32(uint32_t *dst, uint32_t pixel, size_t cnt)
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint32x4_t vec = vdupq_n_u32(pixel);
+    for (; x + 8 <= cnt; x += 8) {
+        vst1q_u32(dst + x, vec);
+        vst1q_u32(dst + x + 4, vec);
+    }
+#elif defined(__SSE2__)
+    __m128i vec = _mm_set1_epi32(pixel);
+    for (; x + 8 <= cnt; x += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), vec);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x + 4), vec);
+    }
+#else
+    uint64_t pair = (static_cast<uint64_t>(pixel) << 32) | pixel;
+    for (; x + 2 <= cnt; x += 2)
+        memcpy(dst + x, &pair, sizeof(pair));
+#endif
+
+    for (; x < cnt; x++)
+        dst[x] = pixel;
+}
+
+static void fill_row16(uint16_t *dst, uint16_t pixel, size_t cnt)
+{
+    size_t x = 0;
+
+    /* Align to 4 bytes so the rest can be stored as pixel pairs */
+    if (cnt && (reinterpret_cast<uintptr_t>(dst) & 2))
+        dst[x++] = pixel;
+
+    size_t pairs = (cnt - x) / 2;
+    fill_row32(reinterpret_cast<uint32_t *>(dst + x),
+            (static_cast<uint32_t>(pixel) << 16) | pixel, pairs);
+    x += pairs * 2;
+
+    if (x < cnt)
+        dst[x] = pixel;
+}
+
+/* dst = color + dst * inv / 255 for every channel, color already in the
+ * byte order of dst */
+static void blend_fill_row32(uint32_t *dst, uint32_t color, uint32_t inv,
+        size_t cnt)
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint8x8_t vinv = vdup_n_u8(inv);
+    uint8x16_t vcolor = vreinterpretq_u8_u32(vdupq_n_u32(color));
+    for (; x + 4 <= cnt; x += 4) {
+        uint8x16_t px = vld1q_u8(reinterpret_cast<uint8_t *>(dst + x));
+        uint16x8_t lo = vmull_u8(vget_low_u8(px), vinv);
+        uint16x8_t hi = vmull_u8(vget_high_u8(px), vinv);
+        uint8x16_t res = vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+                vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+        vst1q_u8(reinterpret_cast<uint8_t *>(dst + x), vqaddq_u8(res, vcolor));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    __m128i vinv = _mm_set1_epi16(inv);
+    __m128i vcolor = _mm_set1_epi32(color);
+    for (; x + 4 <= cnt; x += 4) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<__m128i *>(dst + x));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(
+                _mm_unpacklo_epi8(px, zero), vinv), round);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(
+                _mm_unpackhi_epi8(px, zero), vinv), round);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+                _mm_adds_epu8(_mm_packus_epi16(lo, hi), vcolor));
+    }
+#endif
+
+    for (; x < cnt; x++)
+        dst[x] = color + scale_pixel(dst[x], inv);
+}
+
+/* Color transforms work on premultiplied pixels, so the translation is scaled
+ * by alpha and every channel is kept in [0, alpha]. Coefficients are Q12. */
+#define HWC2_TRANSFORM_SHIFT 12
+
+static inline uint32_t transform_channel(int32_t r, int32_t g, int32_t b,
+        int32_t a, const int16_t *coef)
+{
+    int32_t val = (r * coef[0] + g * coef[1] + b * coef[2] + a * coef[3]
+            + (1 << (HWC2_TRANSFORM_SHIFT - 1))) >> HWC2_TRANSFORM_SHIFT;
+    return std::min(std::max(val, 0), a);
+}
+
+/* c' = a - c for every color channel */
+static void invert_row(uint32_t *row, size_t cnt)
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; x + 8 <= cnt; x += 8) {
+        uint8x8x4_t px = vld4_u8(reinterpret_cast<uint8_t *>(row + x));
+        px.val[0] = vqsub_u8(px.val[3], px.val[0]);
+        px.val[1] = vqsub_u8(px.val[3], px.val[1]);
+        px.val[2] = vqsub_u8(px.val[3], px.val[2]);
+        vst4_u8(reinterpret_cast<uint8_t *>(row + x), px);
+    }
+#elif defined(__SSE2__)
+    const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+    for (; x + 4 <= cnt; x += 4) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<__m128i *>(row + x));
+        __m128i a = _mm_srli_epi32(px, 24);
+        a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+        a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x),
+                _mm_or_si128(_mm_subs_epu8(a, px),
+                _mm_and_si128(px, alpha_mask)));
+    }
+#endif
+
+    for (; x < cnt; x++) {
+        uint32_t a = row[x] >> 24;
+        uint32_t r = row[x] & 0xff, g = (row[x] >> 8) & 0xff,
+                b = (row[x] >> 16) & 0xff;
+        row[x] = (a > r? a - r: 0) | ((a > g? a - g: 0) << 8)
+                | ((a > b? a - b: 0) << 16) | (a << 24);
+    }
+}
+
+/* coef holds four Q12 coefficients (r, g, b, translation) per output channel */
+static void transform_row(uint32_t *row, size_t cnt, const int16_t coef[3][4])
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    const int16x8_t zero = vdupq_n_s16(0);
+    for (; x + 8 <= cnt; x += 8) {
+        uint8x8x4_t px = vld4_u8(reinterpret_cast<uint8_t *>(row + x));
+        int16x8_t ch[4];
+        for (int i = 0; i < 4; i++)
+            ch[i] = vreinterpretq_s16_u16(vmovl_u8(px.val[i]));
+
+        for (int c = 0; c < 3; c++) {
+            int32x4_t lo = vmull_n_s16(vget_low_s16(ch[0]), coef[c][0]);
+            int32x4_t hi = vmull_n_s16(vget_high_s16(ch[0]), coef[c][0]);
+            for (int i = 1; i < 4; i++) {
+                lo = vmlal_n_s16(lo, vget_low_s16(ch[i]), coef[c][i]);
+                hi = vmlal_n_s16(hi, vget_high_s16(ch[i]), coef[c][i]);
+            }
+            int16x8_t val = vcombine_s16(
+                    vqrshrn_n_s32(lo, HWC2_TRANSFORM_SHIFT),
+                    vqrshrn_n_s32(hi, HWC2_TRANSFORM_SHIFT));
+            val = vminq_s16(vmaxq_s16(val, zero), ch[3]);
+            px.val[c] = vqmovun_s16(val);
+        }
+
+        vst4_u8(reinterpret_cast<uint8_t *>(row + x), px);
+    }
+#elif defined(__SSE2__)
+    /* Channels are paired up as 16 bit (r, g) and (b, a) halves of each 32 bit
+     * lane so that madd produces two of the four products per lane */
+    const __m128i low_mask = _mm_set1_epi32(0x000000ff);
+    const __m128i high_mask = _mm_set1_epi32(0x00ff0000);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (HWC2_TRANSFORM_SHIFT - 1));
+    __m128i coef_rg[3], coef_ba[3];
+    for (int c = 0; c < 3; c++) {
+        coef_rg[c] = _mm_set1_epi32(static_cast<uint16_t>(coef[c][0])
+                | (static_cast<uint32_t>(static_cast<uint16_t>(coef[c][1])) << 16));
+        coef_ba[c] = _mm_set1_epi32(static_cast<uint16_t>(coef[c][2])
+                | (static_cast<uint32_t>(static_cast<uint16_t>(coef[c][3])) << 16));
+    }
+
+    for (; x + 4 <= cnt; x += 4) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<__m128i *>(row + x));
+        __m128i rg = _mm_or_si128(_mm_and_si128(px, low_mask),
+                _mm_and_si128(_mm_slli_epi32(px, 8), high_mask));
+        __m128i ba = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(px, 16), low_mask),
+                _mm_and_si128(_mm_srli_epi32(px, 8), high_mask));
+        __m128i a = _mm_srli_epi32(px, 24);
+
+        __m128i out[3];
+        for (int c = 0; c < 3; c++)
+            out[c] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(
+                    _mm_madd_epi16(rg, coef_rg[c]),
+                    _mm_madd_epi16(ba, coef_ba[c])), round),
+                    HWC2_TRANSFORM_SHIFT);
+
+        /* 16 bit planes r0-3 g0-3 and b0-3 a0-3, clamped to [0, a] */
+        __m128i a16 = _mm_packs_epi32(a, a);
+        __m128i rg16 = _mm_min_epi16(_mm_max_epi16(
+                _mm_packs_epi32(out[0], out[1]), zero), a16);
+        __m128i ba16 = _mm_min_epi16(_mm_max_epi16(
+                _mm_packs_epi32(out[2], a), zero), a16);
+
+        /* Transpose the r0-3 g0-3 b0-3 a0-3 bytes back into pixels */
+        __m128i planes = _mm_packus_epi16(rg16, ba16);
+        __m128i rg8 = _mm_unpacklo_epi8(planes, _mm_srli_si128(planes, 4));
+        __m128i ba8 = _mm_unpacklo_epi8(_mm_srli_si128(planes, 8),
+                _mm_srli_si128(planes, 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x),
+                _mm_unpacklo_epi16(rg8, ba8));
+    }
+#endif
+
+    for (; x < cnt; x++) {
+        int32_t r = row[x] & 0xff, g = (row[x] >> 8) & 0xff,
+                b = (row[x] >> 16) & 0xff, a = row[x] >> 24;
+        row[x] = transform_channel(r, g, b, a, coef[0])
+                | (transform_channel(r, g, b, a, coef[1]) << 8)
+                | (transform_channel(r, g, b, a, coef[2]) << 16)
+                | (static_cast<uint32_t>(a) << 24);
+    }
+}
+
+/*
+ * The framebuffer is sRGB encoded. Layers in a linear dataspace are encoded
+ * on the way in, or blended in linear light when they are translucent, using
+ * these tables. Linear light is Q12.
+ */
+#define HWC2_LINEAR_BITS 12
+#define HWC2_LINEAR_MAX ((1 << HWC2_LINEAR_BITS) - 1)
+
+struct transfer_tables {
+    uint16_t to_linear[256];
+    uint16_t expand[256];
+    uint8_t encode[256];
+    uint8_t to_srgb[HWC2_LINEAR_MAX + 1];
+
+    transfer_tables()
+    {
+        for (int val = 0; val < 256; val++) {
+            float enc = val / 255.0f;
+            float lin = enc <= 0.04045f? enc / 12.92f:
+                    powf((enc + 0.055f) / 1.055f, 2.4f);
+            to_linear[val] = lin * HWC2_LINEAR_MAX + 0.5f;
+            expand[val] = (val * HWC2_LINEAR_MAX + 127) / 255;
+        }
+
+        for (int val = 0; val <= HWC2_LINEAR_MAX; val++)
+            to_srgb[val] = encode_value(static_cast<float>(val)
+                    / HWC2_LINEAR_MAX);
+
+        for (int val = 0; val < 256; val++)
+            encode[val] = encode_value(val / 255.0f);
+    }
+
+    static uint8_t encode_value(float lin)
+    {
+        float enc = lin <= 0.0031308f? lin * 12.92f:
+                1.055f * powf(lin, 1.0f / 2.4f) - 0.055f;
+        return std::min(std::max(enc, 0.0f), 1.0f) * 255.0f + 0.5f;
+    }
+};
+
+static const transfer_tables &get_transfer_tables()
+{
+    static const transfer_tables tables;
+    return tables;
+}
+
+/* Opaque linear pixels only need their channels encoded */
+static void encode_row(uint32_t *row, size_t cnt)
+{
+    const uint8_t *encode = get_transfer_tables().encode;
+
+    for (size_t x = 0; x < cnt; x++) {
+        uint32_t px = row[x];
+        row[x] = encode[px & 0xff] | (encode[(px >> 8) & 0xff] << 8)
+                | (encode[(px >> 16) & 0xff] << 16) | (px & 0xff000000);
+    }
+}
+
+/* Blends premultiplied linear pixels over sRGB encoded dst */
+static void blend_linear_row(uint8_t *dst, int32_t format, uint32_t bpp,
+        const uint32_t *row, size_t cnt)
+{
+    const transfer_tables &tables = get_transfer_tables();
+
+    for (size_t x = 0; x < cnt; x++, dst += bpp) {
+        uint32_t src = row[x];
+        uint32_t inv = 255 - (src >> 24);
+        if (inv == 255)
+            continue;
+
+        uint32_t pixel = load_pixel(dst, format);
+        uint32_t res = (src & 0xff000000) + (scale_pixel(pixel, inv)
+                & 0xff000000);
+        for (int shift = 0; shift < 24; shift += 8) {
+            uint32_t lin = tables.expand[(src >> shift) & 0xff]
+                    + (tables.to_linear[(pixel >> shift) & 0xff] * inv + 127)
+                    / 255;
+            res |= tables.to_srgb[std::min(lin,
+                    static_cast<uint32_t>(HWC2_LINEAR_MAX))] << shift;
+        }
+
+        store_pixel(dst, format, res);
+    }
+}
+
+/* YUV to RGB in Q12, luma is offset by y_offset and chroma by 128 */
+struct yuv_coefs {
+    int16_t y_offset;
+    int16_t cy;
+    int16_t crv;
+    int16_t cgu;
+    int16_t cgv;
+    int16_t cbu;
+};
+
+static const yuv_coefs bt601_limited = {16, 4769, 6537, -1605, -3330, 8263};
+static const yuv_coefs bt601_full = {0, 4096, 5743, -1410, -2925, 7258};
+static const yuv_coefs bt709_limited = {16, 4769, 7343, -873, -2183, 8652};
+static const yuv_coefs bt709_full = {0, 4096, 6450, -767, -1917, 7601};
+
+/* Video without a dataspace is assumed to be limited range BT.601 */
+static const yuv_coefs &get_yuv_coefs(android_dataspace_t dataspace)
+{
+    switch (dataspace) {
+    case HAL_DATASPACE_JFIF:
+        return bt601_full;
+    case HAL_DATASPACE_BT601_625:
+    case HAL_DATASPACE_BT601_525:
+        return bt601_limited;
+    case HAL_DATASPACE_BT709:
+        return bt709_limited;
+    default:
+        break;
+    }
+
+    bool bt709 = (dataspace & HAL_DATASPACE_STANDARD_MASK)
+            == HAL_DATASPACE_STANDARD_BT709;
+    bool full = (dataspace & HAL_DATASPACE_RANGE_MASK)
+            == HAL_DATASPACE_RANGE_FULL;
+
+    if (bt709)
+        return full? bt709_full: bt709_limited;
+    return full? bt601_full: bt601_limited;
+}
+
+static inline uint32_t clamp_channel(int32_t val)
+{
+    val = (val + (1 << (HWC2_TRANSFORM_SHIFT - 1))) >> HWC2_TRANSFORM_SHIFT;
+    return std::min(std::max(val, 0), 255);
+}
+
+/* Converts cnt samples to opaque canonical pixels, or to BGRA byte order
+ * when swap_rb is set so that the result can go straight to such a target */
+static void yuv_to_rgb_row(const uint8_t *y, const uint8_t *u,
+        const uint8_t *v, uint32_t *out, size_t cnt, const yuv_coefs &c,
+        bool swap_rb)
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    const int16x8_t y_offset = vdupq_n_s16(c.y_offset);
+    const int16x8_t c_offset = vdupq_n_s16(128);
+    for (; x + 8 <= cnt; x += 8) {
+        int16x8_t yy = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(
+                vld1_u8(y + x))), y_offset);
+        int16x8_t uu = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(
+                vld1_u8(u + x))), c_offset);
+        int16x8_t vv = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(
+                vld1_u8(v + x))), c_offset);
+
+        int32x4_t y_lo = vmull_n_s16(vget_low_s16(yy), c.cy);
+        int32x4_t y_hi = vmull_n_s16(vget_high_s16(yy), c.cy);
+        int32x4_t r_lo = vmlal_n_s16(y_lo, vget_low_s16(vv), c.crv);
+        int32x4_t r_hi = vmlal_n_s16(y_hi, vget_high_s16(vv), c.crv);
+        int32x4_t g_lo = vmlal_n_s16(vmlal_n_s16(y_lo, vget_low_s16(uu), c.cgu),
+                vget_low_s16(vv), c.cgv);
+        int32x4_t g_hi = vmlal_n_s16(vmlal_n_s16(y_hi, vget_high_s16(uu),
+                c.cgu), vget_high_s16(vv), c.cgv);
+        int32x4_t b_lo = vmlal_n_s16(y_lo, vget_low_s16(uu), c.cbu);
+        int32x4_t b_hi = vmlal_n_s16(y_hi, vget_high_s16(uu), c.cbu);
+
+        uint8x8_t r = vqmovun_s16(vcombine_s16(
+                vqrshrn_n_s32(r_lo, HWC2_TRANSFORM_SHIFT),
+                vqrshrn_n_s32(r_hi, HWC2_TRANSFORM_SHIFT)));
+        uint8x8_t g = vqmovun_s16(vcombine_s16(
+                vqrshrn_n_s32(g_lo, HWC2_TRANSFORM_SHIFT),
+                vqrshrn_n_s32(g_hi, HWC2_TRANSFORM_SHIFT)));
+        uint8x8_t b = vqmovun_s16(vcombine_s16(
+                vqrshrn_n_s32(b_lo, HWC2_TRANSFORM_SHIFT),
+                vqrshrn_n_s32(b_hi, HWC2_TRANSFORM_SHIFT)));
+
+        uint8x8x4_t px;
+        px.val[0] = swap_rb? b: r;
+        px.val[1] = g;
+        px.val[2] = swap_rb? r: b;
+        px.val[3] = vdup_n_u8(255);
+        vst4_u8(reinterpret_cast<uint8_t *>(out + x), px);
+    }
+#elif defined(__SSE2__)
+    /* madd on (y, v) and (y, u) pairs gives the red and blue sums, green
+     * needs one more madd for its second chroma term */
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i y_offset = _mm_set1_epi16(c.y_offset);
+    const __m128i c_offset = _mm_set1_epi16(128);
+    const __m128i round = _mm_set1_epi32(1 << (HWC2_TRANSFORM_SHIFT - 1));
+    const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xff));
+    const __m128i coef_r = _mm_set1_epi32(static_cast<uint16_t>(c.cy)
+            | (static_cast<uint32_t>(static_cast<uint16_t>(c.crv)) << 16));
+    const __m128i coef_b = _mm_set1_epi32(static_cast<uint16_t>(c.cy)
+            | (static_cast<uint32_t>(static_cast<uint16_t>(c.cbu)) << 16));
+    const __m128i coef_g = _mm_set1_epi32(static_cast<uint16_t>(c.cy)
+            | (static_cast<uint32_t>(static_cast<uint16_t>(c.cgu)) << 16));
+    const __m128i coef_gv = _mm_set1_epi32(static_cast<uint16_t>(c.cgv));
+
+    for (; x + 8 <= cnt; x += 8) {
+        __m128i yy = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(
+                reinterpret_cast<const __m128i *>(y + x)), zero), y_offset);
+        __m128i uu = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(
+                reinterpret_cast<const __m128i *>(u + x)), zero), c_offset);
+        __m128i vv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(
+                reinterpret_cast<const __m128i *>(v + x)), zero), c_offset);
+
+        __m128i yv_lo = _mm_unpacklo_epi16(yy, vv);
+        __m128i yv_hi = _mm_unpackhi_epi16(yy, vv);
+        __m128i yu_lo = _mm_unpacklo_epi16(yy, uu);
+        __m128i yu_hi = _mm_unpackhi_epi16(yy, uu);
+        __m128i v_lo = _mm_unpacklo_epi16(vv, zero);
+        __m128i v_hi = _mm_unpackhi_epi16(vv, zero);
+
+        __m128i r = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv_lo, coef_r),
+                        round), HWC2_TRANSFORM_SHIFT),
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv_hi, coef_r),
+                        round), HWC2_TRANSFORM_SHIFT));
+        __m128i g = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(
+                        _mm_madd_epi16(yu_lo, coef_g),
+                        _mm_madd_epi16(v_lo, coef_gv)), round),
+                        HWC2_TRANSFORM_SHIFT),
+                _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(
+                        _mm_madd_epi16(yu_hi, coef_g),
+                        _mm_madd_epi16(v_hi, coef_gv)), round),
+                        HWC2_TRANSFORM_SHIFT));
+        __m128i b = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu_lo, coef_b),
+                        round), HWC2_TRANSFORM_SHIFT),
+                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu_hi, coef_b),
+                        round), HWC2_TRANSFORM_SHIFT));
+
+        __m128i r8 = _mm_packus_epi16(swap_rb? b: r, zero);
+        __m128i b8 = _mm_packus_epi16(swap_rb? r: b, zero);
+        __m128i rg = _mm_unpacklo_epi8(r8, _mm_packus_epi16(g, zero));
+        __m128i ba = _mm_unpacklo_epi8(b8, alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x + 4),
+                _mm_unpackhi_epi16(rg, ba));
+    }
+#endif
+
+    for (; x < cnt; x++) {
+        int32_t yy = (y[x] - c.y_offset) * c.cy;
+        int32_t uu = u[x] - 128, vv = v[x] - 128;
+        uint32_t r = clamp_channel(yy + vv * c.crv);
+        uint32_t g = clamp_channel(yy + uu * c.cgu + vv * c.cgv);
+        uint32_t b = clamp_channel(yy + uu * c.cbu);
+        out[x] = (swap_rb? b | (r << 16): r | (b << 16)) | (g << 8)
+                | 0xff000000;
+    }
+}
+
+/* Gathers the samples for cnt pixels starting at the 16.16 position sx */
+static void fetch_yuv_row(const hwc2_surface &src, int32_t sy, uint32_t sx,
+        uint32_t step, size_t cnt, uint8_t *y, uint8_t *u, uint8_t *v)
+{
+    const uint8_t *luma = src.data + sy * src.stride;
+    const uint8_t *cb = src.cb + (sy >> 1) * src.chroma_stride;
+    const uint8_t *cr = src.cr + (sy >> 1) * src.chroma_stride;
+    uint32_t chroma_step = src.chroma_step;
+
+    if (step == 0x10000) {
+        uint32_t x0 = sx >> 16;
+        memcpy(y, luma + x0, cnt);
+        for (size_t x = 0; x < cnt; x++) {
+            uint32_t off = ((x0 + x) >> 1) * chroma_step;
+            u[x] = cb[off];
+            v[x] = cr[off];
+        }
+        return;
+    }
+
+    uint32_t max_x = src.width - 1;
+    for (size_t x = 0; x < cnt; x++, sx += step) {
+        uint32_t px = std::min(sx >> 16, max_x);
+        uint32_t off = (px >> 1) * chroma_step;
+        y[x] = luma[px];
+        u[x] = cb[off];
+        v[x] = cr[off];
+    }
+}
+
+/* Adds the channels of cnt canonical pixels to 32 bit accumulators, four per
+ * pixel */
+static void accumulate_row(uint32_t *acc, const uint32_t *row, size_t cnt)
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; x + 4 <= cnt; x += 4) {
+        uint8x16_t px = vld1q_u8(reinterpret_cast<const uint8_t *>(row + x));
+        uint16x8_t lo = vmovl_u8(vget_low_u8(px));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(px));
+        uint32_t *a = acc + x * 4;
+        vst1q_u32(a, vaddw_u16(vld1q_u32(a), vget_low_u16(lo)));
+        vst1q_u32(a + 4, vaddw_u16(vld1q_u32(a + 4), vget_high_u16(lo)));
+        vst1q_u32(a + 8, vaddw_u16(vld1q_u32(a + 8), vget_low_u16(hi)));
+        vst1q_u32(a + 12, vaddw_u16(vld1q_u32(a + 12), vget_high_u16(hi)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 4 <= cnt; x += 4) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        __m128i lo = _mm_unpacklo_epi8(px, zero);
+        __m128i hi = _mm_unpackhi_epi8(px, zero);
+        __m128i *a = reinterpret_cast<__m128i *>(acc + x * 4);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a),
+                _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1),
+                _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2),
+                _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3),
+                _mm_unpackhi_epi16(hi, zero)));
+    }
+#endif
+
+    for (; x < cnt; x++)
+        for (int c = 0; c < 4; c++)
+            acc[x * 4 + c] += (row[x] >> (c * 8)) & 0xff;
+}
+
+static inline uint32_t lerp_pixel(uint32_t a, uint32_t b, uint32_t w)
+{
+    uint32_t rb = (((a & 0x00ff00ff) * (256 - w) + (b & 0x00ff00ff) * w
+            + 0x00800080) >> 8) & 0x00ff00ff;
+    uint32_t ag = (((a >> 8) & 0x00ff00ff) * (256 - w)
+            + ((b >> 8) & 0x00ff00ff) * w + 0x00800080) & 0xff00ff00;
+    return rb | ag;
+}
+
+/* a = (a * (256 - w) + b * w) / 256 for every channel, w is in 1 - 255 */
+static void lerp_rows(uint32_t *a, const uint32_t *b, uint32_t w, size_t cnt)
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint8x8_t wa = vdup_n_u8(256 - w), wb = vdup_n_u8(w);
+    for (; x + 4 <= cnt; x += 4) {
+        uint8x16_t pa = vld1q_u8(reinterpret_cast<uint8_t *>(a + x));
+        uint8x16_t pb = vld1q_u8(reinterpret_cast<const uint8_t *>(b + x));
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(pa), wa),
+                vget_low_u8(pb), wb);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(pa), wa),
+                vget_high_u8(pb), wb);
+        vst1q_u8(reinterpret_cast<uint8_t *>(a + x),
+                vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    __m128i wa = _mm_set1_epi16(256 - w), wb = _mm_set1_epi16(w);
+    for (; x + 4 <= cnt; x += 4) {
+        __m128i pa = _mm_loadu_si128(reinterpret_cast<__m128i *>(a + x));
+        __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x));
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(
+                _mm_mullo_epi16(_mm_unpacklo_epi8(pa, zero), wa),
+                _mm_mullo_epi16(_mm_unpacklo_epi8(pb, zero), wb)), round);
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(
+                _mm_mullo_epi16(_mm_unpackhi_epi8(pa, zero), wa),
+                _mm_mullo_epi16(_mm_unpackhi_epi8(pb, zero), wb)), round);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(a + x),
+                _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+                _mm_srli_epi16(hi, 8)));
+    }
+#endif
+
+    for (; x < cnt; x++)
+        a[x] = lerp_pixel(a[x], b[x], w);
+}
+
+/* 16.16 source position of the center of output pixel pos, moved back by
+ * half a source pixel so that its integer part is the left sample */
+static inline int32_t get_sample_pos(int32_t pos, uint32_t src_size,
+        uint32_t dst_size)
+{
+    int64_t val = ((2 * static_cast<int64_t>(pos) + 1) * src_size << 16)
+            / (2 * dst_size) - 0x8000;
+    return static_cast<int32_t>(std::max<int64_t>(val, 0));
+}
+
+/* Formats whose pixels can be moved with memcpy when blending is off. The
+ * X byte of RGBX is undefined, so copying it into RGBA would leave the
+ * destination alpha undefined where fetching the row makes it opaque. */
+static bool is_copy_compatible(int32_t src_format, int32_t dst_format)
+{
+    if (src_format == dst_format)
+        return true;
+
+    return src_format == HAL_PIXEL_FORMAT_RGBA_8888
+            && dst_format == HAL_PIXEL_FORMAT_RGBX_8888;
+}
+
+/*
+ * The per pixel stages of draw() are specialized for every source format,
+ * destination format and blend state, so that their inner loops carry no
+ * format or blend mode switches. draw() picks the stages for a layer once
+ * from row_kernels, which is built when the device is opened with the src
+ * over kernel that suits the CPU best.
+ */
+enum {
+    HWC2_FORMAT_IDX_RGBA_8888,
+    HWC2_FORMAT_IDX_RGBX_8888,
+    HWC2_FORMAT_IDX_BGRA_8888,
+    HWC2_FORMAT_IDX_RGB_565,
+    HWC2_FORMAT_IDX_CNT,
+};
+
+enum {
+    HWC2_BLEND_IDX_NONE,
+    HWC2_BLEND_IDX_PREMULTIPLIED,
+    HWC2_BLEND_IDX_COVERAGE,
+    HWC2_BLEND_IDX_CNT,
+};
+
+static int get_format_index(int32_t format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+        return HWC2_FORMAT_IDX_RGBA_8888;
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+        return HWC2_FORMAT_IDX_RGBX_8888;
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        return HWC2_FORMAT_IDX_BGRA_8888;
+    case HAL_PIXEL_FORMAT_RGB_565:
+        return HWC2_FORMAT_IDX_RGB_565;
+    default:
+        return -1;
+    }
+}
+
+static int get_blend_index(hwc2_blend_mode_t blend_mode)
+{
+    switch (blend_mode) {
+    case HWC2_BLEND_MODE_NONE:
+        return HWC2_BLEND_IDX_NONE;
+    case HWC2_BLEND_MODE_COVERAGE:
+        return HWC2_BLEND_IDX_COVERAGE;
+    default:
+        return HWC2_BLEND_IDX_PREMULTIPLIED;
+    }
+}
+
+typedef void (*fetch_row_fn)(uint32_t *row, const uint8_t *in, size_t cnt);
+typedef void (*fetch_scaled_row_fn)(uint32_t *row, const uint8_t *in,
+        uint32_t sx, uint32_t step, uint32_t max_x, size_t cnt);
+typedef void (*prepare_row_fn)(uint32_t *row, size_t cnt, uint32_t alpha);
+typedef void (*store_row_fn)(uint8_t *out, uint32_t *row, size_t cnt);
+typedef void (*src_over_row_fn)(uint32_t *dst, const uint32_t *src,
+        size_t cnt);
+
+struct row_kernels {
+    fetch_row_fn fetch[HWC2_FORMAT_IDX_CNT];
+    fetch_scaled_row_fn fetch_scaled[HWC2_FORMAT_IDX_CNT];
+    /* Indexed by blend mode and whether plane alpha is applied */
+    prepare_row_fn prepare[HWC2_BLEND_IDX_CNT][2];
+    store_row_fn store[HWC2_FORMAT_IDX_CNT];
+    store_row_fn blend[HWC2_FORMAT_IDX_CNT];
+    const char *isa;
+};
+
+static row_kernels kernels;
+
+template<int32_t Format>
+static void fetch_row(uint32_t *row, const uint8_t *in, size_t cnt)
+{
+    const uint32_t bpp = Format == HAL_PIXEL_FORMAT_RGB_565? 2: 4;
+
+    if (Format == HAL_PIXEL_FORMAT_RGBA_8888) {
+        memcpy(row, in, cnt * bpp);
+        return;
+    }
+
+    for (size_t x = 0; x < cnt; x++, in += bpp)
+        row[x] = load_pixel(in, Format);
+}
+
+/* Nearest sampling, sx is the 16.16 position of the first pixel */
+template<int32_t Format>
+static void fetch_scaled_row(uint32_t *row, const uint8_t *in, uint32_t sx,
+        uint32_t step, uint32_t max_x, size_t cnt)
+{
+    const uint32_t bpp = Format == HAL_PIXEL_FORMAT_RGB_565? 2: 4;
+
+    for (size_t x = 0; x < cnt; x++, sx += step)
+        row[x] = load_pixel(in + std::min(sx >> 16, max_x) * bpp, Format);
+}
+
+/* Brings fetched pixels to premultiplied form and applies the plane alpha */
+template<hwc2_blend_mode_t Blend, bool PlaneAlpha>
+static void prepare_row(uint32_t *row, size_t cnt, uint32_t alpha)
+{
+    if (Blend == HWC2_BLEND_MODE_PREMULTIPLIED && !PlaneAlpha)
+        return;
+
+    for (size_t x = 0; x < cnt; x++) {
+        uint32_t pixel = row[x];
+        if (Blend == HWC2_BLEND_MODE_NONE)
+            pixel |= 0xff000000;
+        else if (Blend == HWC2_BLEND_MODE_COVERAGE)
+            pixel = (scale_pixel(pixel, pixel >> 24) & 0x00ffffff)
+                    | (pixel & 0xff000000);
+        if (PlaneAlpha)
+            pixel = scale_pixel(pixel, alpha);
+        row[x] = pixel;
+    }
+}
+
+template<int32_t Format>
+static void store_row(uint8_t *out, uint32_t *row, size_t cnt)
+{
+    if (Format == HAL_PIXEL_FORMAT_RGBA_8888
+            || Format == HAL_PIXEL_FORMAT_RGBX_8888) {
+        memcpy(out, row, cnt * 4);
+        return;
+    }
+
+    const uint32_t bpp = Format == HAL_PIXEL_FORMAT_RGB_565? 2: 4;
+    for (size_t x = 0; x < cnt; x++, out += bpp)
+        store_pixel(out, Format, row[x]);
+}
+
+/* Adds every byte on its own, clamping at 255 like the SIMD kernels do */
+static inline uint32_t add_saturate(uint32_t a, uint32_t b)
+{
+    uint32_t sum = (a & 0x7f7f7f7f) + (b & 0x7f7f7f7f);
+    uint32_t carry = ((a & b) | ((a | b) & sum)) & 0x80808080;
+    return (sum ^ ((a ^ b) & 0x80808080)) | ((carry >> 7) * 0xff);
+}
+
+/* Only zero pixels leave dst alone, a pixel with alpha 0 and some color is
+ * added to it. Sources that are not properly premultiplied saturate. */
+static inline uint32_t src_over_pixel(uint32_t src, uint32_t dst)
+{
+    if (!src)
+        return dst;
+    uint32_t inv = 255 - (src >> 24);
+    return inv? add_saturate(src, scale_pixel(dst, inv)): src;
+}
+
+/* Source over for 32 bit targets, works on raw memory since alpha is the
+ * last byte in all of them. This is the scalar reference for the variants
+ * below, which give the same result bit for bit. */
+static void src_over_row_c(uint32_t *dst, const uint32_t *src, size_t cnt)
+{
+    for (size_t x = 0; x < cnt; x++)
+        dst[x] = src_over_pixel(src[x], dst[x]);
+}
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+static void src_over_row_neon(uint32_t *dst, const uint32_t *src, size_t cnt)
+{
+    size_t x = 0;
+
+    for (; x + 8 <= cnt; x += 8) {
+        uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t *>(src + x));
+        uint8x8x4_t d = vld4_u8(reinterpret_cast<uint8_t *>(dst + x));
+        uint8x8_t inv = vmvn_u8(s.val[3]);
+        for (int c = 0; c < 4; c++) {
+            uint16x8_t t = vmull_u8(d.val[c], inv);
+            d.val[c] = vqadd_u8(s.val[c], vraddhn_u16(t, vrshrq_n_u16(t, 8)));
+        }
+        vst4_u8(reinterpret_cast<uint8_t *>(dst + x), d);
+    }
+
+    src_over_row_c(dst + x, src + x, cnt - x);
+}
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+/* Groups that are fully transparent or fully opaque are common in UI layers
+ * and skip the arithmetic. Transparent means all zero, as in the scalar
+ * kernel. */
+__attribute__((target("sse4.1")))
+static void src_over_row_sse41(uint32_t *dst, const uint32_t *src, size_t cnt)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi32(-1);
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+    const __m128i alpha_shuf = _mm_set_epi8(15, 15, 15, 15, 11, 11, 11, 11,
+            7, 7, 7, 7, 3, 3, 3, 3);
+    size_t x = 0;
+
+    for (; x + 4 <= cnt; x += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+        if (_mm_testz_si128(s, s))
+            continue;
+        if (_mm_testc_si128(s, alpha_mask)) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), s);
+            continue;
+        }
+
+        __m128i inv = _mm_xor_si128(_mm_shuffle_epi8(s, alpha_shuf), ones);
+        __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i *>(dst + x));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+                _mm_unpacklo_epi8(inv, zero)), round);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+                _mm_unpackhi_epi8(inv, zero)), round);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+                _mm_adds_epu8(_mm_packus_epi16(lo, hi), s));
+    }
+
+    src_over_row_c(dst + x, src + x, cnt - x);
+}
+
+/* Same as the SSE4.1 kernel on eight pixels, unpacking and packing both stay
+ * inside of 128 bit lanes so the pixel order is kept */
+__attribute__((target("avx2")))
+static void src_over_row_avx2(uint32_t *dst, const uint32_t *src, size_t cnt)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i round = _mm256_set1_epi16(128);
+    const __m256i alpha_mask = _mm256_set1_epi32(0xff000000);
+    const __m256i alpha_shuf = _mm256_set_epi8(15, 15, 15, 15, 11, 11, 11, 11,
+            7, 7, 7, 7, 3, 3, 3, 3, 15, 15, 15, 15, 11, 11, 11, 11,
+            7, 7, 7, 7, 3, 3, 3, 3);
+    size_t x = 0;
+
+    for (; x + 8 <= cnt; x += 8) {
+        __m256i s = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(src + x));
+        if (_mm256_testz_si256(s, s))
+            continue;
+        if (_mm256_testc_si256(s, alpha_mask)) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), s);
+            continue;
+        }
+
+        __m256i inv = _mm256_xor_si256(_mm256_shuffle_epi8(s, alpha_shuf),
+                ones);
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i *>(dst + x));
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(
+                _mm256_unpacklo_epi8(d, zero),
+                _mm256_unpacklo_epi8(inv, zero)), round);
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(
+                _mm256_unpackhi_epi8(d, zero),
+                _mm256_unpackhi_epi8(inv, zero)), round);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo,
+                _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi,
+                _mm256_srli_epi16(hi, 8)), 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x),
+                _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), s));
+    }
+
+    src_over_row_c(dst + x, src + x, cnt - x);
+}
+#endif
+
+/* Blends canonical pixels onto dst, row is used as scratch space */
+template<int32_t Format, src_over_row_fn SrcOver>
+static void blend_row(uint8_t *out, uint32_t *row, size_t cnt)
+{
+    if (Format == HAL_PIXEL_FORMAT_RGB_565) {
+        for (size_t x = 0; x < cnt; x++, out += 2) {
+            if (!row[x])
+                continue;
+            store_pixel(out, Format,
+                    src_over_pixel(row[x], load_pixel(out, Format)));
+        }
+        return;
+    }
+
+    if (Format == HAL_PIXEL_FORMAT_BGRA_8888)
+        for (size_t x = 0; x < cnt; x++)
+            row[x] = swap_rb(row[x]);
+
+    SrcOver(reinterpret_cast<uint32_t *>(out), row, cnt);
+}
+
+template<src_over_row_fn SrcOver>
+static void build_kernels(row_kernels &k, const char *isa)
+{
+    k.fetch[HWC2_FORMAT_IDX_RGBA_8888] = fetch_row<HAL_PIXEL_FORMAT_RGBA_8888>;
+    k.fetch[HWC2_FORMAT_IDX_RGBX_8888] = fetch_row<HAL_PIXEL_FORMAT_RGBX_8888>;
+    k.fetch[HWC2_FORMAT_IDX_BGRA_8888] = fetch_row<HAL_PIXEL_FORMAT_BGRA_8888>;
+    k.fetch[HWC2_FORMAT_IDX_RGB_565] = fetch_row<HAL_PIXEL_FORMAT_RGB_565>;
+
+    k.fetch_scaled[HWC2_FORMAT_IDX_RGBA_8888] =
+            fetch_scaled_row<HAL_PIXEL_FORMAT_RGBA_8888>;
+    k.fetch_scaled[HWC2_FORMAT_IDX_RGBX_8888] =
+            fetch_scaled_row<HAL_PIXEL_FORMAT_RGBX_8888>;
+    k.fetch_scaled[HWC2_FORMAT_IDX_BGRA_8888] =
+            fetch_scaled_row<HAL_PIXEL_FORMAT_BGRA_8888>;
+    k.fetch_scaled[HWC2_FORMAT_IDX_RGB_565] =
+            fetch_scaled_row<HAL_PIXEL_FORMAT_RGB_565>;
+
+    k.prepare[HWC2_BLEND_IDX_NONE][0] =
+            prepare_row<HWC2_BLEND_MODE_NONE, false>;
+    k.prepare[HWC2_BLEND_IDX_NONE][1] =
+            prepare_row<HWC2_BLEND_MODE_NONE, true>;
+    k.prepare[HWC2_BLEND_IDX_PREMULTIPLIED][0] =
+            prepare_row<HWC2_BLEND_MODE_PREMULTIPLIED, false>;
+    k.prepare[HWC2_BLEND_IDX_PREMULTIPLIED][1] =
+            prepare_row<HWC2_BLEND_MODE_PREMULTIPLIED, true>;
+    k.prepare[HWC2_BLEND_IDX_COVERAGE][0] =
+            prepare_row<HWC2_BLEND_MODE_COVERAGE, false>;
+    k.prepare[HWC2_BLEND_IDX_COVERAGE][1] =
+            prepare_row<HWC2_BLEND_MODE_COVERAGE, true>;
+
+    k.store[HWC2_FORMAT_IDX_RGBA_8888] = store_row<HAL_PIXEL_FORMAT_RGBA_8888>;
+    k.store[HWC2_FORMAT_IDX_RGBX_8888] = store_row<HAL_PIXEL_FORMAT_RGBX_8888>;
+    k.store[HWC2_FORMAT_IDX_BGRA_8888] = store_row<HAL_PIXEL_FORMAT_BGRA_8888>;
+    k.store[HWC2_FORMAT_IDX_RGB_565] = store_row<HAL_PIXEL_FORMAT_RGB_565>;
+
+    k.blend[HWC2_FORMAT_IDX_RGBA_8888] =
+            blend_row<HAL_PIXEL_FORMAT_RGBA_8888, SrcOver>;
+    k.blend[HWC2_FORMAT_IDX_RGBX_8888] =
+            blend_row<HAL_PIXEL_FORMAT_RGBX_8888, SrcOver>;
+    k.blend[HWC2_FORMAT_IDX_BGRA_8888] =
+            blend_row<HAL_PIXEL_FORMAT_BGRA_8888, SrcOver>;
+    k.blend[HWC2_FORMAT_IDX_RGB_565] =
+            blend_row<HAL_PIXEL_FORMAT_RGB_565, SrcOver>;
+
+    k.isa = isa;
+}
+
+hwc2_compositor::hwc2_compositor()
+    : row(),
+      yuv_row(),
+      scale_acc(),
+      scale_out(),
+      transform(transform_identity),
+      coef(),
+      nearest_scaling(false)
+{
+    get_transfer_tables();
+}
+
+/* Builds the kernels for the named instruction set if the CPU has it. The
+ * table is shared by all displays, so it may only change before any of them
+ * composes. */
+bool hwc2_compositor::set_isa(const char *isa)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_cpu_init();
+    if (!strcmp(isa, "avx2") && __builtin_cpu_supports("avx2")) {
+        build_kernels<src_over_row_avx2>(kernels, "avx2");
+        return true;
+    }
+    if (!strcmp(isa, "sse4.1") && __builtin_cpu_supports("sse4.1")) {
+        build_kernels<src_over_row_sse41>(kernels, "sse4.1");
+        return true;
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    /* NEON is a build time choice, the rest of the compositor uses it
+     * unconditionally as well */
+    if (!strcmp(isa, "neon")) {
+        build_kernels<src_over_row_neon>(kernels, "neon");
+        return true;
+    }
+#endif
+    if (!strcmp(isa, "scalar")) {
+        build_kernels<src_over_row_c>(kernels, "scalar");
+        return true;
+    }
+
+    return false;
+}
+
+/* Picks the best kernels for the CPU we run on, once */
+void hwc2_compositor::init_kernels()
+{
+    static std::once_flag once;
+
+    std::call_once(once, []() {
+        for (const char *isa: {"avx2", "sse4.1", "neon", "scalar"})
+            if (set_isa(isa))
+                break;
+        ALOGI("using %s composition kernels", kernels.isa);
+    });
+}
+
+const char *hwc2_compositor::get_isa()
+{
+    return kernels.isa? kernels.isa: "no";
+}
+
+bool hwc2_compositor::is_supported_format(int32_t format)
+{
+    return get_bpp(format) != 0 || is_yuv_format(format);
+}
+
+/* Formats that are mapped through lockFlex, see hwc2_gralloc::lock */
+bool hwc2_compositor::is_yuv_format(int32_t format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_YV12:
+    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+    case HAL_PIXEL_FORMAT_YCbCr_420_888:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool hwc2_compositor::has_alpha(int32_t format)
+{
+    return format == HAL_PIXEL_FORMAT_RGBA_8888
+            || format == HAL_PIXEL_FORMAT_BGRA_8888;
+}
+
+uint32_t hwc2_compositor::get_bpp(int32_t format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        return 4;
+    case HAL_PIXEL_FORMAT_RGB_565:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+/* Turns a layer color into a premultiplied canonical pixel with the plane
+ * alpha already applied */
+uint32_t hwc2_compositor::get_fill_color(const hwc_color_t &color,
+        hwc2_blend_mode_t blend_mode, float plane_alpha)
+{
+    uint32_t alpha = blend_mode == HWC2_BLEND_MODE_NONE? 255: color.a;
+    alpha = (alpha * static_cast<uint32_t>(plane_alpha * 255.0f + 0.5f)
+            + 127) / 255;
+
+    return scale_pixel(color.r | (color.g << 8) | (color.b << 16)
+            | 0xff000000, alpha);
+}
+
+uint32_t hwc2_compositor::blend_pixel(uint32_t src, uint32_t dst)
+{
+    return src + scale_pixel(dst, 255 - (src >> 24));
+}
+
+/* Whether a dataspace stores linear light rather than sRGB-like encoded
+ * values, unspecified transfers are treated as sRGB */
+bool hwc2_compositor::is_linear(android_dataspace_t dataspace)
+{
+    if (dataspace == HAL_DATASPACE_SRGB_LINEAR)
+        return true;
+
+    return (dataspace & HAL_DATASPACE_TRANSFER_MASK)
+            == HAL_DATASPACE_TRANSFER_LINEAR;
+}
+
+/*
+ * Takes a row-major 4x4 matrix that maps [R G B 1] row vectors, so the output
+ * of channel c is R * m[c] + G * m[4 + c] + B * m[8 + c] + m[12 + c]. Fails
+ * when the matrix does not fit the Q12 coefficients of the kernels, in which
+ * case the previous transform is kept.
+ */
+int hwc2_compositor::set_color_transform(const float *matrix,
+        android_color_transform_t hint)
+{
+    static const float identity[16] = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f,
+    };
+    static const float inverse[16] = {
+        -1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, -1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, -1.0f, 0.0f,
+        1.0f, 1.0f, 1.0f, 1.0f,
+    };
+
+    if (hint == HAL_COLOR_TRANSFORM_IDENTITY
+            || !memcmp(matrix, identity, sizeof(identity))) {
+        transform = transform_identity;
+        return 0;
+    }
+
+    if (!memcmp(matrix, inverse, sizeof(inverse))) {
+        transform = transform_inverse;
+        return 0;
+    }
+
+    int16_t val[3][4];
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < 4; i++) {
+            float fixed = roundf(matrix[i * 4 + c]
+                    * (1 << HWC2_TRANSFORM_SHIFT));
+            if (!(fixed >= INT16_MIN && fixed <= INT16_MAX))
+                return -EINVAL;
+            val[c][i] = static_cast<int16_t>(fixed);
+        }
+    }
+
+    memcpy(coef, val, sizeof(coef));
+    transform = transform_matrix;
+    return 0;
+}
+
+uint32_t hwc2_compositor::transform_pixel(uint32_t pixel) const
+{
+    transform_row(&pixel, 1);
+    return pixel;
+}
+
+void hwc2_compositor::transform_row(uint32_t *row, size_t cnt) const
+{
+    switch (transform) {
+    case transform_inverse:
+        invert_row(row, cnt);
+        break;
+    case transform_matrix:
+        ::transform_row(row, cnt, coef);
+        break;
+    default:
+        break;
+    }
+}
+
+void hwc2_compositor::clear(const hwc2_surface &dst, const hwc2_region &region)
+{
+    fill(dst, 0xff000000, region);
+}
+
+void hwc2_compositor::fill(const hwc2_surface &dst, uint32_t color,
+        const hwc2_region &region)
+{
+    uint32_t bpp = get_bpp(dst.format);
+    color = transform_pixel(color);
+
+    for (const hwc_rect_t &rect: region) {
+        size_t cnt = rect.right - rect.left;
+        uint8_t *out = dst.data + rect.top * dst.stride + rect.left * bpp;
+
+        for (int32_t y = rect.top; y < rect.bottom; y++, out += dst.stride) {
+            if (bpp == 2)
+                fill_row16(reinterpret_cast<uint16_t *>(out),
+                        to_rgb565(color), cnt);
+            else
+                fill_row32(reinterpret_cast<uint32_t *>(out),
+                        to_format_order(color, dst.format), cnt);
+        }
+    }
+}
+
+void hwc2_compositor::blend_fill(const hwc2_surface &dst, uint32_t color,
+        const hwc2_region &region)
+{
+    uint32_t inv = 255 - (color >> 24);
+    if (inv == 255)
+        return;
+    if (!inv) {
+        fill(dst, color, region);
+        return;
+    }
+
+    uint32_t bpp = get_bpp(dst.format);
+    color = transform_pixel(color);
+
+    for (const hwc_rect_t &rect: region) {
+        size_t cnt = rect.right - rect.left;
+        uint8_t *out = dst.data + rect.top * dst.stride + rect.left * bpp;
+
+        for (int32_t y = rect.top; y < rect.bottom; y++, out += dst.stride) {
+            if (bpp == 4) {
+                blend_fill_row32(reinterpret_cast<uint32_t *>(out),
+                        to_format_order(color, dst.format), inv, cnt);
+                continue;
+            }
+
+            uint8_t *px = out;
+            for (size_t x = 0; x < cnt; x++, px += bpp)
+                store_pixel(px, dst.format, color
+                        + scale_pixel(load_pixel(px, dst.format), inv));
+        }
+    }
+}
+
+void hwc2_compositor::draw(const hwc2_surface &dst, const hwc2_surface &src,
+        const hwc_frect_t &source_crop, const hwc_rect_t &display_frame,
+        hwc2_blend_mode_t blend_mode, float plane_alpha,
+        const hwc2_region &clip, bool color_transform,
+        android_dataspace_t dataspace)
+{
+    bool yuv = is_yuv_format(src.format);
+    uint32_t src_bpp = yuv? 1: get_bpp(src.format);
+    uint32_t dst_bpp = get_bpp(dst.format);
+    if (!src_bpp || !dst_bpp)
+        return;
+
+    bool linear = !yuv && is_linear(dataspace);
+    const yuv_coefs &coefs = get_yuv_coefs(dataspace);
+
+    /* Keep the crop inside the buffer so that sampling never needs to be
+     * clamped per pixel */
+    float crop_left = std::max(source_crop.left, 0.0f);
+    float crop_top = std::max(source_crop.top, 0.0f);
+    float crop_right = std::min(source_crop.right, static_cast<float>(src.width));
+    float crop_bottom = std::min(source_crop.bottom, static_cast<float>(src.height));
+
+    int32_t frame_w = display_frame.right - display_frame.left;
+    int32_t frame_h = display_frame.bottom - display_frame.top;
+    if (frame_w <= 0 || frame_h <= 0 || crop_right <= crop_left
+            || crop_bottom <= crop_top)
+        return;
+
+    float scale_x = (crop_right - crop_left) / frame_w;
+    float scale_y = (crop_bottom - crop_top) / frame_h;
+    bool scaled = scale_x != 1.0f || scale_y != 1.0f
+            || crop_left != floorf(crop_left) || crop_top != floorf(crop_top);
+
+    uint32_t alpha = static_cast<uint32_t>(plane_alpha * 255.0f + 0.5f);
+    bool opaque = alpha >= 255 && (blend_mode == HWC2_BLEND_MODE_NONE
+            || !has_alpha(src.format));
+    bool transformed = color_transform && transform != transform_identity;
+    /* Opaque video is converted straight into 32 bit targets */
+    bool direct = yuv && opaque && !transformed && dst_bpp == 4;
+
+    uint32_t step = static_cast<uint32_t>(scale_x * 65536.0f);
+    uint32_t max_x = src.width - 1;
+
+    int src_idx = get_format_index(src.format);
+    int dst_idx = get_format_index(dst.format);
+    fetch_row_fn fetch = src_idx < 0? nullptr: kernels.fetch[src_idx];
+    fetch_scaled_row_fn fetch_scaled = src_idx < 0? nullptr:
+            kernels.fetch_scaled[src_idx];
+    prepare_row_fn prepare =
+            kernels.prepare[get_blend_index(blend_mode)][alpha < 255];
+    store_row_fn store = kernels.store[dst_idx];
+    store_row_fn blend = kernels.blend[dst_idx];
+
+    for (const hwc_rect_t &rect: clip) {
+        size_t cnt = rect.right - rect.left;
+        if (row.size() < cnt)
+            row.resize(cnt);
+        if (yuv && yuv_row.size() < cnt * 3)
+            yuv_row.resize(cnt * 3);
+
+        for (int32_t y = rect.top; y < rect.bottom; y++) {
+            int32_t sy = static_cast<int32_t>(crop_top
+                    + (y - display_frame.top + 0.5f) * scale_y);
+            sy = std::min(sy, static_cast<int32_t>(src.height) - 1);
+
+            uint8_t *out = dst.data + y * dst.stride + rect.left * dst_bpp;
+            const uint8_t *in = src.data + sy * src.stride;
+
+            if (yuv) {
+                uint32_t sx = scaled? static_cast<uint32_t>((crop_left
+                        + (rect.left - display_frame.left + 0.5f) * scale_x)
+                        * 65536.0f): static_cast<uint32_t>(crop_left
+                        + rect.left - display_frame.left) << 16;
+                uint8_t *samples = yuv_row.data();
+                fetch_yuv_row(src, sy, sx, scaled? step: 0x10000, cnt,
+                        samples, samples + cnt, samples + cnt * 2);
+
+                if (direct) {
+                    yuv_to_rgb_row(samples, samples + cnt, samples + cnt * 2,
+                            reinterpret_cast<uint32_t *>(out), cnt, coefs,
+                            dst.format == HAL_PIXEL_FORMAT_BGRA_8888);
+                    continue;
+                }
+
+                yuv_to_rgb_row(samples, samples + cnt, samples + cnt * 2,
+                        row.data(), cnt, coefs, false);
+            } else if (!scaled) {
+                int32_t sx = static_cast<int32_t>(crop_left)
+                        + rect.left - display_frame.left;
+                in += sx * src_bpp;
+
+                if (opaque && !transformed && !linear
+                        && is_copy_compatible(src.format, dst.format)) {
+                    memcpy(out, in, cnt * dst_bpp);
+                    continue;
+                }
+
+                fetch(row.data(), in, cnt);
+            } else {
+                uint32_t sx = static_cast<uint32_t>((crop_left
+                        + (rect.left - display_frame.left + 0.5f) * scale_x)
+                        * 65536.0f);
+                fetch_scaled(row.data(), in, sx, step, max_x, cnt);
+            }
+
+            prepare(row.data(), cnt, alpha);
+
+            /* Blending is linear in premultiplied space, so transforming
+             * every source instead of the finished frame gives the same
+             * result without another pass over the framebuffer */
+            if (transformed)
+                transform_row(row.data(), cnt);
+
+            /* Layers in the same dataspace as the framebuffer are blended
+             * as encoded values, just like the client does */
+            if (linear && !opaque) {
+                blend_linear_row(out, dst.format, dst_bpp, row.data(), cnt);
+                continue;
+            } else if (linear) {
+                encode_row(row.data(), cnt);
+            }
+
+            if (opaque)
+                store(out, row.data(), cnt);
+            else
+                blend(out, row.data(), cnt);
+        }
+    }
+}
+
+/*
+ * Resamples the whole of src into frame on dst, writing only the parts in
+ * clip. Used for mirrors of finished frames, so neither blending nor the
+ * color transform are applied. Shrinking by 2 or more averages the box of
+ * source pixels under every output pixel, anything else is bilinear, unless
+ * the quality governor asked for nearest sampling.
+ */
+void hwc2_compositor::scale(const hwc2_surface &dst, const hwc2_surface &src,
+        const hwc_rect_t &frame, const hwc2_region &clip)
+{
+    int src_idx = get_format_index(src.format);
+    int dst_idx = get_format_index(dst.format);
+    uint32_t frame_w = frame.right - frame.left;
+    uint32_t frame_h = frame.bottom - frame.top;
+    if (src_idx < 0 || dst_idx < 0 || !frame_w || !frame_h)
+        return;
+
+    if (nearest_scaling)
+        scale_nearest(dst, src, frame, clip);
+    else if (src.width >= frame_w * 2 && src.height >= frame_h * 2)
+        scale_box(dst, src, frame, clip);
+    else
+        scale_bilinear(dst, src, frame, clip);
+}
+
+void hwc2_compositor::scale_box(const hwc2_surface &dst,
+        const hwc2_surface &src, const hwc_rect_t &frame,
+        const hwc2_region &clip)
+{
+    fetch_row_fn fetch = kernels.fetch[get_format_index(src.format)];
+    store_row_fn store = kernels.store[get_format_index(dst.format)];
+    uint32_t src_bpp = get_bpp(src.format), dst_bpp = get_bpp(dst.format);
+    uint64_t frame_w = frame.right - frame.left;
+    uint64_t frame_h = frame.bottom - frame.top;
+
+    for (const hwc_rect_t &rect: clip) {
+        size_t cnt = rect.right - rect.left;
+        uint32_t sx0 = (rect.left - frame.left) * src.width / frame_w;
+        uint32_t sx1 = (rect.right - frame.left) * src.width / frame_w;
+        size_t src_cnt = sx1 - sx0;
+
+        if (row.size() < src_cnt)
+            row.resize(src_cnt);
+        if (scale_acc.size() < src_cnt * 4)
+            scale_acc.resize(src_cnt * 4);
+        if (scale_out.size() < cnt)
+            scale_out.resize(cnt);
+
+        for (int32_t y = rect.top; y < rect.bottom; y++) {
+            uint32_t sy0 = (y - frame.top) * src.height / frame_h;
+            uint32_t sy1 = (y + 1 - frame.top) * src.height / frame_h;
+
+            std::fill(scale_acc.begin(), scale_acc.begin() + src_cnt * 4, 0);
+            for (uint32_t sy = sy0; sy < sy1; sy++) {
+                fetch(row.data(), src.data + sy * src.stride + sx0 * src_bpp,
+                        src_cnt);
+                accumulate_row(scale_acc.data(), row.data(), src_cnt);
+            }
+
+            /* Box edges are stepped exactly instead of divided out, boxes
+             * are only ever step or step + 1 pixels wide */
+            uint32_t step = src.width / frame_w, rem_step = src.width % frame_w;
+            uint32_t rem = (rect.left - frame.left) * src.width % frame_w;
+            uint32_t recip[2];
+            for (int wide = 0; wide < 2; wide++)
+                recip[wide] = ((1 << 24) + (step + wide) * (sy1 - sy0) - 1)
+                        / ((step + wide) * (sy1 - sy0));
+
+            for (size_t x = 0, bx = 0; x < cnt; x++) {
+                uint32_t width = step;
+                rem += rem_step;
+                if (rem >= frame_w) {
+                    rem -= frame_w;
+                    width++;
+                }
+
+                uint32_t sum[4] = {0, 0, 0, 0};
+                for (uint32_t end = bx + width; bx < end; bx++)
+                    for (int c = 0; c < 4; c++)
+                        sum[c] += scale_acc[bx * 4 + c];
+
+                uint64_t mul = recip[width - step];
+                scale_out[x] = ((sum[0] * mul + (1 << 23)) >> 24)
+                        | (((sum[1] * mul + (1 << 23)) >> 24) << 8)
+                        | (((sum[2] * mul + (1 << 23)) >> 24) << 16)
+                        | (((sum[3] * mul + (1 << 23)) >> 24) << 24);
+            }
+
+            store(dst.data + y * dst.stride + rect.left * dst_bpp,
+                    scale_out.data(), cnt);
+        }
+    }
+}
+
+void hwc2_compositor::scale_bilinear(const hwc2_surface &dst,
+        const hwc2_surface &src, const hwc_rect_t &frame,
+        const hwc2_region &clip)
+{
+    fetch_row_fn fetch = kernels.fetch[get_format_index(src.format)];
+    store_row_fn store = kernels.store[get_format_index(dst.format)];
+    uint32_t src_bpp = get_bpp(src.format), dst_bpp = get_bpp(dst.format);
+    uint32_t frame_w = frame.right - frame.left;
+    uint32_t frame_h = frame.bottom - frame.top;
+    int32_t max_x = src.width - 1, max_y = src.height - 1;
+
+    for (const hwc_rect_t &rect: clip) {
+        size_t cnt = rect.right - rect.left;
+        int32_t sx0 = std::min(get_sample_pos(rect.left - frame.left,
+                src.width, frame_w) >> 16, max_x);
+        int32_t sx1 = std::min((get_sample_pos(rect.right - 1 - frame.left,
+                src.width, frame_w) >> 16) + 1, max_x);
+        size_t src_cnt = sx1 - sx0 + 1;
+
+        if (row.size() < src_cnt)
+            row.resize(src_cnt);
+        if (scale_acc.size() < src_cnt)
+            scale_acc.resize(src_cnt);
+        if (scale_out.size() < cnt * 2)
+            scale_out.resize(cnt * 2);
+
+        /* Sample positions are the same for every row, they are kept past
+         * the output pixels */
+        int32_t *col_pos = reinterpret_cast<int32_t *>(scale_out.data()) + cnt;
+        for (size_t x = 0; x < cnt; x++)
+            col_pos[x] = get_sample_pos(rect.left + x - frame.left,
+                    src.width, frame_w);
+
+        for (int32_t y = rect.top; y < rect.bottom; y++) {
+            int32_t pos = get_sample_pos(y - frame.top, src.height, frame_h);
+            int32_t sy = std::min(pos >> 16, max_y);
+            uint32_t wy = (pos >> 8) & 0xff;
+
+            fetch(row.data(), src.data + sy * src.stride + sx0 * src_bpp,
+                    src_cnt);
+            if (wy && sy < max_y) {
+                fetch(scale_acc.data(), src.data + (sy + 1) * src.stride
+                        + sx0 * src_bpp, src_cnt);
+                lerp_rows(row.data(), scale_acc.data(), wy, src_cnt);
+            }
+
+            for (size_t x = 0; x < cnt; x++) {
+                int32_t idx = std::min(col_pos[x] >> 16, max_x) - sx0;
+                uint32_t wx = (col_pos[x] >> 8) & 0xff;
+
+                scale_out[x] = row[idx];
+                if (wx && idx + sx0 < max_x)
+                    scale_out[x] = lerp_pixel(row[idx], row[idx + 1], wx);
+            }
+
+            store(dst.data + y * dst.stride + rect.left * dst_bpp,
+                    scale_out.data(), cnt);
+        }
+    }
+}
+
+/* Picks the source pixel under the center of every output pixel */
+void hwc2_compositor::scale_nearest(const hwc2_surface &dst,
+        const hwc2_surface &src, const hwc_rect_t &frame,
+        const hwc2_region &clip)
+{
+    fetch_scaled_row_fn fetch =
+            kernels.fetch_scaled[get_format_index(src.format)];
+    store_row_fn store = kernels.store[get_format_index(dst.format)];
+    uint32_t dst_bpp = get_bpp(dst.format);
+    uint64_t frame_w = frame.right - frame.left;
+    uint64_t frame_h = frame.bottom - frame.top;
+    uint32_t step = (static_cast<uint64_t>(src.width) << 16) / frame_w;
+
+    for (const hwc_rect_t &rect: clip) {
+        size_t cnt = rect.right - rect.left;
+        if (row.size() < cnt)
+            row.resize(cnt);
+
+        uint32_t sx = ((rect.left - frame.left) * 2 + 1) * (static_cast<
+                uint64_t>(src.width) << 15) / frame_w;
+        for (int32_t y = rect.top; y < rect.bottom; y++) {
+            uint32_t sy = ((y - frame.top) * 2 + 1) * src.height
+                    / (frame_h * 2);
+            fetch(row.data(), src.data + sy * src.stride, sx, step,
+                    src.width - 1, cnt);
+            store(dst.data + y * dst.stride + rect.left * dst_bpp, row.data(),
+                    cnt);
+        }
+    }
+}
+
+/* Copies to uncached or write combined memory. On x86 the stores bypass
+ * the cache, elsewhere memcpy already writes whole lines in order. */
+void hwc2_compositor::stream_copy(uint8_t *dst, const uint8_t *src,
+        size_t size)
+{
+#if defined(__SSE2__)
+    size_t head = std::min(static_cast<size_t>(-reinterpret_cast<uintptr_t>(
+            dst) & 15), size);
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, dst += 64, src += 64) {
+        const __m128i *in = reinterpret_cast<const __m128i *>(src);
+        __m128i *out = reinterpret_cast<__m128i *>(dst);
+        __m128i a = _mm_loadu_si128(in), b = _mm_loadu_si128(in + 1);
+        __m128i c = _mm_loadu_si128(in + 2), d = _mm_loadu_si128(in + 3);
+        _mm_stream_si128(out, a);
+        _mm_stream_si128(out + 1, b);
+        _mm_stream_si128(out + 2, c);
+        _mm_stream_si128(out + 3, d);
+    }
+    _mm_sfence();
+#endif
+    memcpy(dst, src, size);
+}
+
+/* Runs finished pixels of dst through a color LUT */
+void hwc2_compositor::map(const hwc2_surface &dst, const hwc2_lut &lut,
+        const hwc2_region &region)
+{
+    uint32_t bpp = get_bpp(dst.format);
+
+    for (const hwc_rect_t &rect: region) {
+        size_t cnt = rect.right - rect.left;
+        if (row.size() < cnt)
+            row.resize(cnt);
+
+        uint8_t *out = dst.data + rect.top * dst.stride + rect.left * bpp;
+        for (int32_t y = rect.top; y < rect.bottom; y++, out += dst.stride) {
+            uint8_t *px = out;
+            for (size_t x = 0; x < cnt; x++, px += bpp)
+                row[x] = load_pixel(px, dst.format);
+
+            lut.map_row(row.data(), cnt);
+
+            px = out;
+            for (size_t x = 0; x < cnt; x++, px += bpp)
+                store_pixel(px, dst.format, row[x]);
+        }
+    }
+}
@@ -23,7 +23,9 @@ hwc2_config::hwc2_config()
       height(-1),
       vsync_period(-1),
       dpi_x(-1),
-      dpi_y(-1) { }
+      dpi_y(-1),
+      mode(),
+      has_mode(false) { }
 
 int32_t hwc2_config::get_attribute(hwc2_attribute_t attribute) const
 {
@@ -69,3 +71,9 @@ int hwc2_config::set_attribute(hwc2_attribute_t attribute, int32_t value)
 
     return 0;
 }
+
+void hwc2_config::set_mode(const struct fb_var_screeninfo &mode)
+{
+    this->mode = mode;
+    has_mode = true;
+}
@@ -14,14 +14,24 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include <cstdlib>
-#include <fcntl.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <string.h>
 #include <vector>
 
 #include "hwc2.h"
 
+/* Scheduling of the HAL threads, see hwc2_scheduler::load */
+#define HWC2_THREAD_CONFIG "/vendor/etc/hwc2/threads.conf"
+
+/* Memory intermediate surfaces may take unless debug.hwc2.pool_budget sets
+ * another amount, in MB */
+#define HWC2_POOL_DEFAULT_BUDGET_MB 64
+
 static void hwc2_vsync(void *data, int dpy_id, uint64_t timestamp)
 {
     hwc2_dev *dev = static_cast<hwc2_dev *>(data);
@@ -156,36 +166,83 @@ static void hwc2_hotplug(void *data, int dpy_id, bool connected)
 
 hwc2_dev::hwc2_dev()
 	: callback_handler(),
-	  displays() { }
+	  recorder(),
+	  scheduler(),
+	  pool(),
+	  displays(),
+	  open_threads(),
+	  open_mutex(),
+	  open_cond(),
+	  primary_announced(false),
+	  open_time(0) { }
 
 hwc2_dev::~hwc2_dev() 
 {
+    for (auto &thread: open_threads)
+        thread.join();
+
     hwc2_display::reset_ids();
 }
 
+/*
+ * Every framebuffer node gets a display. They are all created up front,
+ * disconnected, so that the display map is left alone while the panels are
+ * opened: the primary on the calling thread, the others each on their own
+ * thread so that a slow or absent external panel cannot hold up the primary.
+ */
 int hwc2_dev::open_fb_device()
 {
-    int ret = open_fb_display(0);
-    if (ret < 0)
-        goto err;
+    open_time = systemTime(SYSTEM_TIME_MONOTONIC);
+    hwc2_compositor::init_kernels();
+
+    int ret = scheduler.load(HWC2_THREAD_CONFIG);
+    if (ret < 0 && ret != -ENOENT)
+        ALOGW("failed to load %s: %s", HWC2_THREAD_CONFIG, strerror(-ret));
+
+    pool.configure(static_cast<size_t>(property_get_int32(
+            "debug.hwc2.pool_budget", HWC2_POOL_DEFAULT_BUDGET_MB)) << 20,
+            property_get_bool("debug.hwc2.pool_hugepages", false));
+
+    char record_path[PROPERTY_VALUE_MAX];
+    if (property_get("debug.hwc2.record", record_path, "") > 0) {
+        ret = recorder.open(record_path,
+                property_get_int32("debug.hwc2.record.sample", 0));
+        if (ret < 0)
+            ALOGW("failed to open %s: %s", record_path, strerror(-ret));
+    }
 
-	ALOGE("fb%u device: %s successfully opened", 0, strerror(ret));
+    int fb_ids[HWC2_MAX_FB_DEVICES];
+    int cnt = nvfb_device_enumerate(fb_ids, HWC2_MAX_FB_DEVICES);
+    if (cnt <= 0) {
+        ALOGE("no framebuffer devices found");
+        return -ENODEV;
+    }
 
-    for (auto &dpy: displays) {
-        ret = dpy.second.retrieve_display_configs();
-        if (ret < 0) {
-            ALOGE("dpy %" PRIu64 ": failed to retrieve display configs: %s",
-                    dpy.second.get_id(), strerror(ret));
-            goto err;
-        }
+    std::vector<hwc2_display *> panels;
+    for (int idx = 0; idx < cnt; idx++) {
+        struct nvfb_device nvfb_dev = {};
+        nvfb_dev.id = fb_ids[idx];
+        nvfb_dev.fd = -1;
+
+        hwc2_display_t dpy_id = hwc2_display::get_next_id();
+        auto it = displays.emplace(std::piecewise_construct,
+                std::forward_as_tuple(dpy_id),
+                std::forward_as_tuple(dpy_id,
+                                        nvfb_dev,
+                                        HWC2_CONNECTION_DISCONNECTED,
+                                        HWC2_POWER_MODE_ON,
+                                        HWC2_DISPLAY_TYPE_PHYSICAL)).first;
+        panels.push_back(&it->second);
     }
 
-    for (auto &dpy: displays)
-        callback_handler.call_hotplug(dpy.second.get_id(),
-                dpy.second.get_connection());
+    for (size_t idx = 1; idx < panels.size(); idx++) {
+        hwc2_display *dpy = panels[idx];
+        open_threads.push_back(scheduler.create("open", "hwc2 open "
+                + std::to_string(dpy->get_id()),
+                [this, dpy] { open_fb_display(dpy, false); }));
+    }
 
-err:
-    return ret;
+    return open_fb_display(panels[0], true);
 }
 
 hwc2_error_t hwc2_dev::set_layer_composition_type(hwc2_display_t dpy_id,
@@ -202,6 +259,331 @@ hwc2_error_t hwc2_dev::set_layer_blend_mode(hwc2_display_t dpy_id,
             blend_mode);
 }
 
+hwc2_error_t hwc2_dev::set_layer_visible_region(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, const hwc_region_t &visible_region)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_visible_region(lyr_id, visible_region);
+}
+
+hwc2_error_t hwc2_dev::set_layer_surface_damage(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, const hwc_region_t &surface_damage)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_surface_damage(lyr_id, surface_damage);
+}
+
+hwc2_error_t hwc2_dev::set_layer_buffer(hwc2_display_t dpy_id, hwc2_layer_t lyr_id,
+        buffer_handle_t handle, int32_t acquire_fence)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_buffer(lyr_id, handle, acquire_fence);
+}
+
+hwc2_error_t hwc2_dev::set_layer_display_frame(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, const hwc_rect_t &display_frame)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_display_frame(lyr_id, display_frame);
+}
+
+hwc2_error_t hwc2_dev::set_layer_source_crop(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, const hwc_frect_t &source_crop)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_source_crop(lyr_id, source_crop);
+}
+
+hwc2_error_t hwc2_dev::set_layer_plane_alpha(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, float plane_alpha)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_plane_alpha(lyr_id, plane_alpha);
+}
+
+hwc2_error_t hwc2_dev::set_layer_z_order(hwc2_display_t dpy_id, hwc2_layer_t lyr_id,
+        uint32_t z_order)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_z_order(lyr_id, z_order);
+}
+
+hwc2_error_t hwc2_dev::set_layer_transform(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, hwc_transform_t transform)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_transform(lyr_id, transform);
+}
+
+hwc2_error_t hwc2_dev::set_layer_color(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, const hwc_color_t &color)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_color(lyr_id, color);
+}
+
+hwc2_error_t hwc2_dev::set_cursor_position(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, int32_t x, int32_t y)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_cursor_position(lyr_id, x, y);
+}
+
+hwc2_error_t hwc2_dev::set_color_transform(hwc2_display_t dpy_id,
+        const float *matrix, android_color_transform_t hint)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_color_transform(matrix, hint);
+}
+
+hwc2_error_t hwc2_dev::get_color_modes(hwc2_display_t dpy_id,
+        uint32_t *out_num_modes, android_color_mode_t *out_modes) const
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.get_color_modes(out_num_modes, out_modes);
+}
+
+hwc2_error_t hwc2_dev::set_color_mode(hwc2_display_t dpy_id,
+        android_color_mode_t mode)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_color_mode(mode);
+}
+
+hwc2_error_t hwc2_dev::set_layer_dataspace(hwc2_display_t dpy_id,
+        hwc2_layer_t lyr_id, android_dataspace_t dataspace)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_layer_dataspace(lyr_id, dataspace);
+}
+
+hwc2_error_t hwc2_dev::set_client_target(hwc2_display_t dpy_id,
+        buffer_handle_t target, int32_t acquire_fence,
+        android_dataspace_t dataspace, const hwc_region_t &damage)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_client_target(target, acquire_fence, dataspace, damage);
+}
+
+hwc2_error_t hwc2_dev::create_virtual_display(uint32_t width, uint32_t height,
+        android_pixel_format_t *format, hwc2_display_t *out_display)
+{
+    uint32_t cnt = 0;
+    for (auto &dpy: displays)
+        if (dpy.second.get_type() == HWC2_DISPLAY_TYPE_VIRTUAL)
+            cnt++;
+
+    if (cnt >= HWC2_MAX_VIRTUAL_DISPLAYS) {
+        ALOGE("no virtual displays left");
+        return HWC2_ERROR_NO_RESOURCES;
+    }
+
+    if (!width || !height) {
+        ALOGE("invalid virtual display size %ux%u", width, height);
+        return HWC2_ERROR_UNSUPPORTED;
+    }
+
+    /* Output buffers are written by the compositor, so any format it cannot
+     * write is swapped for the canonical one */
+    if (!hwc2_compositor::get_bpp(*format))
+        *format = HAL_PIXEL_FORMAT_RGBA_8888;
+
+    /* Mirrors are taken from the first panel */
+    const hwc2_display *primary = nullptr;
+    for (auto &dpy: displays)
+        if (dpy.second.get_type() == HWC2_DISPLAY_TYPE_PHYSICAL
+                && (!primary || dpy.first < primary->get_id()))
+            primary = &dpy.second;
+
+    hwc2_display_t dpy_id = hwc2_display::get_next_id();
+    displays.emplace(std::piecewise_construct, std::forward_as_tuple(dpy_id),
+            std::forward_as_tuple(dpy_id, width, height, primary));
+
+    *out_display = dpy_id;
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_dev::destroy_virtual_display(hwc2_display_t dpy_id)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    if (it->second.get_type() != HWC2_DISPLAY_TYPE_VIRTUAL) {
+        ALOGE("dpy %" PRIu64 ": not a virtual display", dpy_id);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    displays.erase(it);
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_dev::set_output_buffer(hwc2_display_t dpy_id,
+        buffer_handle_t buffer, int32_t release_fence)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.set_output_buffer(buffer, release_fence);
+}
+
+hwc2_error_t hwc2_dev::validate_display(hwc2_display_t dpy_id,
+        uint32_t *out_num_types, uint32_t *out_num_requests)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.validate_display(out_num_types, out_num_requests);
+}
+
+hwc2_error_t hwc2_dev::get_changed_composition_types(hwc2_display_t dpy_id,
+        uint32_t *out_num_elements, hwc2_layer_t *out_layers,
+        hwc2_composition_t *out_types) const
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.get_changed_composition_types(out_num_elements, out_layers,
+            out_types);
+}
+
+hwc2_error_t hwc2_dev::get_display_requests(hwc2_display_t dpy_id,
+        int32_t *out_display_requests, uint32_t *out_num_elements,
+        hwc2_layer_t *out_layers, int32_t *out_layer_requests) const
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.get_display_requests(out_display_requests,
+            out_num_elements, out_layers, out_layer_requests);
+}
+
+hwc2_error_t hwc2_dev::accept_display_changes(hwc2_display_t dpy_id)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.accept_display_changes();
+}
+
+hwc2_error_t hwc2_dev::present_display(hwc2_display_t dpy_id,
+        int32_t *out_present_fence)
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.present_display(out_present_fence);
+}
+
+hwc2_error_t hwc2_dev::get_release_fences(hwc2_display_t dpy_id,
+        uint32_t *out_num_elements, hwc2_layer_t *out_layers,
+        int32_t *out_fences) const
+{
+    auto it = displays.find(dpy_id);
+    if (it == displays.end()) {
+        ALOGE("dpy %" PRIu64 ": invalid display handle", dpy_id);
+        return HWC2_ERROR_BAD_DISPLAY;
+    }
+
+    return it->second.get_release_fences(out_num_elements, out_layers,
+            out_fences);
+}
+
 void hwc2_dev::hotplug(hwc2_display_t dpy_id, hwc2_connection_t connection)
 {
     auto it = displays.find(dpy_id);
@@ -259,29 +641,62 @@ hwc2_error_t hwc2_dev::register_callback(hwc2_callback_descriptor_t descriptor,
             pointer);
 }
 
-int hwc2_dev::open_fb_display(int fb_id)
+/* dump_buffer is rebuilt whenever the size is asked for, the buffer call
+ * copies out as much of it as fits */
+void hwc2_dev::dump(uint32_t *out_size, char *out_buffer)
 {
-    struct nvfb_device nvfb_dev;
-
-    int ret = nvfb_device_open(fb_id, O_RDWR, &nvfb_dev);
-    if (ret < 0) {
-        ALOGE("failed to open fb%u device: %s", fb_id, strerror(ret));
-        return ret;
+    if (!out_buffer) {
+        dump_buffer = "hwcomposer2 (";
+        dump_buffer.append(hwc2_compositor::get_isa());
+        dump_buffer.append(" kernels)\n");
+
+        std::vector<hwc2_display_t> ids;
+        for (auto &dpy: displays)
+            ids.push_back(dpy.first);
+        std::sort(ids.begin(), ids.end());
+
+        for (hwc2_display_t dpy_id: ids)
+            displays.at(dpy_id).dump(&dump_buffer);
+        pool.dump(&dump_buffer);
+        scheduler.dump(&dump_buffer);
+
+#ifdef HWC2_TRACE
+        hwc2_trace::update(&dump_buffer);
+#endif
+
+        *out_size = dump_buffer.size();
+        return;
     }
 
-    ALOGE("panel height: %d\npanel width: %d", 
-                nvfb_dev.vi.yres, nvfb_dev.vi.xres);
+    *out_size = std::min(*out_size, static_cast<uint32_t>(dump_buffer.size()));
+    memcpy(out_buffer, dump_buffer.data(), *out_size);
+}
 
-    ALOGE("panel virtual height: %d\npanel virtual width: %d", 
-                nvfb_dev.vi.yres_virtual, nvfb_dev.vi.xres_virtual);
+int hwc2_dev::open_fb_display(hwc2_display *dpy, bool primary)
+{
+    int ret = dpy->open_fb(pool);
+    if (ret < 0) {
+        ALOGE("dpy %" PRIu64 ": failed to open framebuffer: %s", dpy->get_id(),
+                strerror(-ret));
+    } else {
+        dpy->start_vsync_thread(&callback_handler, scheduler);
+    }
 
-    hwc2_display_t dpy_id = hwc2_display::get_next_id();
-    displays.emplace(std::piecewise_construct, std::forward_as_tuple(dpy_id),
-            std::forward_as_tuple(dpy_id,
-                                    nvfb_dev,
-                                    HWC2_CONNECTION_CONNECTED,
-                                    HWC2_POWER_MODE_ON,
-                                    HWC2_DISPLAY_TYPE_PHYSICAL));
+    std::unique_lock<std::mutex> lock(open_mutex);
+    if (primary) {
+        if (ret == 0) {
+            callback_handler.call_hotplug(dpy->get_id(),
+                    HWC2_CONNECTION_CONNECTED);
+            ALOGI("dpy %" PRIu64 ": hotplugged %" PRId64 " us after open",
+                    dpy->get_id(),
+                    (systemTime(SYSTEM_TIME_MONOTONIC) - open_time) / 1000);
+        }
+        primary_announced = true;
+        open_cond.notify_all();
+    } else if (ret == 0) {
+        open_cond.wait(lock, [this] { return primary_announced; });
+        callback_handler.call_hotplug(dpy->get_id(), HWC2_CONNECTION_CONNECTED);
+    }
 
-    return 0;
+    return ret;
 }
@@ -14,9 +14,18 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <cutils/log.h>
+#include <cutils/properties.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 #include <vector>
 
@@ -24,6 +33,63 @@
 
 uint64_t hwc2_display::display_cnt = 0;
 
+/* Color mode LUTs are looked up in a per display directory first */
+#define HWC2_LUT_DIR "/vendor/etc/hwc2"
+
+/* Panel frames a mirror can catch up on and output buffers it tracks, enough
+ * for the usual triple buffered virtual display */
+#define HWC2_DAMAGE_HISTORY 4
+#define HWC2_MIRROR_BUFFERS 4
+
+/* Used until the panel reports its refresh rate, and to pace vsync on
+ * drivers that cannot wait for it */
+#define HWC2_DEFAULT_VSYNC_PERIOD 16666667
+
+/* Density reported for panels that do not know their physical size */
+#define HWC2_DEFAULT_DPI 324
+
+#define HWC2_FB_SYSFS_DIR "/sys/class/graphics"
+
+/* Frames a content frame rate has to hold before the panel follows it, and
+ * how far a refresh rate may be off a multiple of it, in 1/1000 */
+#define HWC2_CONTENT_RATE_FRAMES 30
+#define HWC2_CONTENT_RATE_TOLERANCE 10
+
+/* Vsyncs without a change on screen before a panel that has vsync turned
+ * off goes idle */
+#define HWC2_IDLE_FRAMES 60
+
+static const struct {
+    android_color_mode_t mode;
+    const char *name;
+} color_mode_names[] = {
+    {HAL_COLOR_MODE_NATIVE, "native"},
+    {HAL_COLOR_MODE_STANDARD_BT601_625, "bt601_625"},
+    {HAL_COLOR_MODE_STANDARD_BT601_625_UNADJUSTED, "bt601_625_unadjusted"},
+    {HAL_COLOR_MODE_STANDARD_BT601_525, "bt601_525"},
+    {HAL_COLOR_MODE_STANDARD_BT601_525_UNADJUSTED, "bt601_525_unadjusted"},
+    {HAL_COLOR_MODE_STANDARD_BT709, "bt709"},
+    {HAL_COLOR_MODE_DCI_P3, "dci_p3"},
+    {HAL_COLOR_MODE_SRGB, "srgb"},
+    {HAL_COLOR_MODE_ADOBE_RGB, "adobe_rgb"},
+    {HAL_COLOR_MODE_DISPLAY_P3, "display_p3"},
+};
+
+static int32_t get_fb_format(const fb_var_screeninfo &vi)
+{
+    switch (vi.bits_per_pixel) {
+    case 16:
+        return HAL_PIXEL_FORMAT_RGB_565;
+    case 32:
+        if (vi.red.offset == 16)
+            return HAL_PIXEL_FORMAT_BGRA_8888;
+        return vi.transp.length? HAL_PIXEL_FORMAT_RGBA_8888:
+                HAL_PIXEL_FORMAT_RGBX_8888;
+    default:
+        return -1;
+    }
+}
+
 hwc2_display::hwc2_display(hwc2_display_t id,
             const struct nvfb_device &fb_dev,
             hwc2_connection_t connection,
@@ -35,17 +101,316 @@ hwc2_display::hwc2_display(hwc2_display_t id,
       id(id),
       fb_dev(fb_dev),
       layers(),
+      client_target(),
+      output_buffer(),
       name(),
       power_mode(power_mode),
       type(type),
-      vsync_enabled(HWC2_VSYNC_DISABLE) 
+      vsync_enabled(HWC2_VSYNC_DISABLE),
+      vsync_thread(),
+      vsync_mutex(),
+      vsync_cond(),
+      vsync_period(HWC2_DEFAULT_VSYNC_PERIOD),
+      vsync_exit(false),
+      static_vsyncs(0),
+      idle(false),
+      vsync_retry_hw(false),
+      callback(nullptr),
+      vsync_model(),
+      applied_config(0),
+      content_config(0),
+      content_frames(0),
+      stats(),
+      governor(false),
+      compositor(),
+      comp_layers(),
+      changed_types(),
+      clear_region(),
+      client_region(),
+      client_opaque_region(),
+      fill_only(false),
+      validated(false),
+      color_transform_supported(true),
+      transform_client_target(false),
+      color_modes(),
+      color_mode(HAL_COLOR_MODE_NATIVE),
+      color_lut(nullptr),
+      cursor_only(false),
+      full_redraw(true),
+      cursor_layer(nullptr),
+      cursor_mutex(),
+      cursor_handle(nullptr),
+      cursor_image(),
+      cursor_src(),
+      cursor_save(),
+      cursor_rect({0, 0, 0, 0}),
+      cursor_saved(false),
+      cursor_damage(),
+      planes(),
+      plane_layers(),
+      underlay_region(),
+      pool(nullptr),
+      use_shadow(false),
+      shadow(),
+      shadow_dirty(),
+      frame_serial(0),
+      damage_history(),
+      mirror_source(nullptr),
+      mirroring(false),
+      mirror_serial(0),
+      mirror_frame({0, 0, 0, 0}),
+      mirror_buffers()
+{
+    init_name();
+}
+
+/* Virtual displays have no framebuffer, they are composed into whatever
+ * buffer set_output_buffer hands over for the frame */
+hwc2_display::hwc2_display(hwc2_display_t id, uint32_t width, uint32_t height,
+            const hwc2_display *mirror_source)
+    : active_config(0),
+      configs(),
+      connection(HWC2_CONNECTION_CONNECTED),
+      id(id),
+      fb_dev(),
+      layers(),
+      client_target(),
+      output_buffer(),
+      name(),
+      power_mode(HWC2_POWER_MODE_ON),
+      type(HWC2_DISPLAY_TYPE_VIRTUAL),
+      vsync_enabled(HWC2_VSYNC_DISABLE),
+      vsync_thread(),
+      vsync_mutex(),
+      vsync_cond(),
+      vsync_period(HWC2_DEFAULT_VSYNC_PERIOD),
+      vsync_exit(false),
+      static_vsyncs(0),
+      idle(false),
+      vsync_retry_hw(false),
+      callback(nullptr),
+      vsync_model(),
+      applied_config(0),
+      content_config(0),
+      content_frames(0),
+      stats(),
+      governor(mirror_source != nullptr),
+      compositor(),
+      comp_layers(),
+      changed_types(),
+      clear_region(),
+      client_region(),
+      client_opaque_region(),
+      fill_only(false),
+      validated(false),
+      color_transform_supported(true),
+      transform_client_target(false),
+      color_modes(),
+      color_mode(HAL_COLOR_MODE_NATIVE),
+      color_lut(nullptr),
+      cursor_only(false),
+      full_redraw(true),
+      cursor_layer(nullptr),
+      cursor_mutex(),
+      cursor_handle(nullptr),
+      cursor_image(),
+      cursor_src(),
+      cursor_save(),
+      cursor_rect({0, 0, 0, 0}),
+      cursor_saved(false),
+      cursor_damage(),
+      planes(),
+      plane_layers(),
+      underlay_region(),
+      pool(nullptr),
+      use_shadow(false),
+      shadow(),
+      shadow_dirty(),
+      frame_serial(0),
+      damage_history(),
+      mirror_source(mirror_source),
+      mirroring(false),
+      mirror_serial(0),
+      mirror_frame({0, 0, 0, 0}),
+      mirror_buffers()
 {
+    fb_dev.fd = -1;
+    fb_dev.vi.xres = width;
+    fb_dev.vi.yres = height;
+
+    hwc2_config config;
+    config.set_attribute(HWC2_ATTRIBUTE_WIDTH, width);
+    config.set_attribute(HWC2_ATTRIBUTE_HEIGHT, height);
+    configs.emplace(0, config);
+
+    color_modes.emplace_back(HAL_COLOR_MODE_NATIVE, hwc2_lut());
     init_name();
 }
 
 hwc2_display::~hwc2_display()
 {
-    close(fb_dev.fd);
+    if (vsync_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(vsync_mutex);
+            vsync_exit = true;
+        }
+        vsync_cond.notify_one();
+        vsync_thread.join();
+    }
+
+    if (fb_dev.fd >= 0)
+        close(fb_dev.fd);
+}
+
+/* Opens, queries and maps the framebuffer of a panel created disconnected.
+ * Runs before the display is announced, so nothing else touches it yet. */
+int hwc2_display::open_fb(hwc2_surface_pool &pool)
+{
+    struct nvfb_device dev;
+
+    int ret = nvfb_device_open(fb_dev.id, O_RDWR, &dev);
+    if (ret < 0)
+        return ret;
+
+    fb_dev = dev;
+
+    /* Unblanking a panel that is already on is a no-op, so the powerdown
+     * cycle is left out */
+    nvfb_clear(&fb_dev);
+    nvfb_blank(&fb_dev, false);
+
+    ret = retrieve_display_configs();
+    if (ret < 0)
+        return ret;
+
+    int32_t period = configs[active_config].get_attribute(
+            HWC2_ATTRIBUTE_VSYNC_PERIOD);
+    if (period > 0)
+        vsync_period = period;
+    vsync_model.reset(vsync_period);
+
+    this->pool = &pool;
+    use_shadow = property_get_bool("debug.hwc2.shadow_fb", false);
+    if (use_shadow)
+        acquire_shadow();
+
+    load_color_modes();
+    connection = HWC2_CONNECTION_CONNECTED;
+
+    return 0;
+}
+
+void hwc2_display::start_vsync_thread(hwc2_callback *callback,
+        hwc2_scheduler &scheduler)
+{
+    this->callback = callback;
+    vsync_thread = scheduler.create("vsync", "hwc2 vsync " + std::to_string(id),
+            [this] { vsync_loop(); });
+}
+
+/* Sleeps until the next multiple of period after last */
+static int64_t wait_for_timer(int64_t last, int64_t period)
+{
+    int64_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    int64_t next = last + period;
+    if (next <= now)
+        next = now + period - (now - last) % period;
+
+    struct timespec ts;
+    ts.tv_sec = next / 1000000000LL;
+    ts.tv_nsec = next % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr)
+            == EINTR);
+
+    return next;
+}
+
+/* Waits on the panel with FBIO_WAITFORVSYNC, falling back to a timer at the
+ * refresh rate for drivers that do not implement it. Drivers that do may
+ * still fail it while the panel is off or being reconfigured, in which case
+ * the timer stands in until the panel is turned on again. */
+void hwc2_display::vsync_loop()
+{
+    std::unique_lock<std::mutex> lock(vsync_mutex);
+    bool hw_vsync = true;
+    bool hw_vsync_supported = true;
+    int64_t timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    /* Last vsync delivered, 0 after vsync was disabled */
+    int64_t last = 0;
+
+    while (!vsync_exit) {
+        if (vsync_enabled != HWC2_VSYNC_ENABLE) {
+            last = 0;
+            vsync_cond.wait(lock);
+            continue;
+        }
+
+        int64_t period = vsync_period;
+        lock.unlock();
+
+        if (hw_vsync) {
+            uint32_t crtc = 0;
+            if (ioctl(fb_dev.fd, FBIO_WAITFORVSYNC, &crtc) == 0) {
+                timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+            } else if (errno == EINTR) {
+                lock.lock();
+                continue;
+            } else if (errno == ENOTTY || errno == EINVAL) {
+                ALOGW("dpy %" PRIu64 ": no hardware vsync, using a timer", id);
+                hw_vsync = false;
+                hw_vsync_supported = false;
+            } else {
+                ALOGW("dpy %" PRIu64 ": waiting for vsync failed: %s, using "
+                        "a timer until the panel is turned on", id,
+                        strerror(errno));
+                hw_vsync = false;
+            }
+        }
+        if (!hw_vsync)
+            timestamp = wait_for_timer(timestamp, period);
+
+        lock.lock();
+        if (!hw_vsync && hw_vsync_supported && vsync_retry_hw) {
+            hw_vsync = true;
+            vsync_retry_hw = false;
+        }
+        if (vsync_enabled != HWC2_VSYNC_ENABLE || vsync_exit)
+            continue;
+
+        if (last && timestamp - last > period * 3 / 2)
+            stats.add(HWC2_STAT_VSYNC_MISSES,
+                    (timestamp - last + period / 2) / period - 1);
+        last = timestamp;
+
+        lock.unlock();
+        if (hw_vsync)
+            vsync_model.add_sample(timestamp);
+        {
+            HWC2_TRACE_SCOPE("call_vsync");
+            callback->call_vsync(id, timestamp);
+        }
+        lock.lock();
+
+        if (static_vsyncs < HWC2_IDLE_FRAMES)
+            static_vsyncs++;
+    }
+}
+
+/* Called for every change on screen. SurfaceFlinger is not composing for an
+ * idle panel, so it is asked for a frame when the change could not be shown
+ * without one. */
+void hwc2_display::wake_up(bool refresh)
+{
+    bool was_idle;
+    {
+        std::lock_guard<std::mutex> lock(vsync_mutex);
+        static_vsyncs = 0;
+        was_idle = idle;
+        idle = false;
+    }
+
+    if (was_idle && refresh && callback)
+        callback->call_refresh(id);
 }
 
 hwc2_error_t hwc2_display::get_name(uint32_t *out_size, char *out_name) const
@@ -65,7 +430,7 @@ hwc2_error_t hwc2_display::get_name(uint32_t *out_size, char *out_name) const
 void hwc2_display::init_name()
 {
     name.append("dpy-");
-    if (HWC2_DISPLAY_TYPE_PHYSICAL)
+    if (type == HWC2_DISPLAY_TYPE_PHYSICAL)
         name.append("phys-");
     else
         name.append("virt-");
@@ -92,8 +457,26 @@ hwc2_error_t hwc2_display::set_power_mode(hwc2_power_mode_t mode)
         return HWC2_ERROR_BAD_PARAMETER;
     }
 
-    nvfb_blank(&fb_dev, blank);
+    if (!is_virtual()) {
+        nvfb_blank(&fb_dev, blank);
+
+        std::lock_guard<std::mutex> lock(vsync_mutex);
+        if (!blank)
+            vsync_retry_hw = true;
+    }
+
+    /* Nothing is composed while the panel is off, and a panel turned back
+     * on is redrawn in full */
+    if (use_shadow) {
+        std::lock_guard<std::mutex> lock(cursor_mutex);
+        if (blank)
+            shadow.reset();
+        else if (shadow.empty())
+            acquire_shadow();
+    }
+
     power_mode = mode;
+    full_redraw = true;
 
     return HWC2_ERROR_NONE;
 }
@@ -106,42 +489,121 @@ hwc2_error_t hwc2_display::get_doze_support(int32_t *out_support) const
 
 hwc2_error_t hwc2_display::set_vsync_enabled(hwc2_vsync_t enabled)
 {
-    if (enabled == HWC2_VSYNC_INVALID) {
+    if (enabled != HWC2_VSYNC_ENABLE && enabled != HWC2_VSYNC_DISABLE) {
         ALOGE("dpy %" PRIu64 ": invalid vsync enabled", id);
         return HWC2_ERROR_BAD_PARAMETER;
     }
 
-    this->vsync_enabled = enabled;
-
-    bool blank;
-    switch (enabled) {
-    case HWC2_VSYNC_ENABLE:
-        blank = false;
-        break;
-    case HWC2_VSYNC_DISABLE:
-        blank = true;
-        break;
-    default:
-        ALOGW("dpy %" PRIu64 ": invalid vsync enable parameter %u", id,
-                enabled);
-        return HWC2_ERROR_BAD_PARAMETER;
+    std::lock_guard<std::mutex> lock(vsync_mutex);
+    /* Vsync events are delivered for as long as SurfaceFlinger wants them.
+     * Once it turns them off on a screen that has not changed for a while
+     * the panel is idle, turning them back on means it is composing again. */
+    if (enabled == HWC2_VSYNC_DISABLE && vsync_enabled == HWC2_VSYNC_ENABLE
+            && static_vsyncs >= HWC2_IDLE_FRAMES && !idle) {
+        idle = true;
+        stats.add(HWC2_STAT_IDLE_ENTRIES);
+    } else if (enabled == HWC2_VSYNC_ENABLE) {
+        idle = false;
+        static_vsyncs = 0;
     }
-
-    nvfb_blank(&fb_dev, blank);
+    vsync_enabled = enabled;
+    vsync_cond.notify_one();
 
     return HWC2_ERROR_NONE;
 }
 
-int hwc2_display::retrieve_display_configs()
+/* Pixels scanned out per frame, blanking included */
+static uint64_t get_frame_pixels(const fb_var_screeninfo &vi)
+{
+    uint64_t htotal = vi.xres + vi.left_margin + vi.right_margin
+            + vi.hsync_len;
+    uint64_t vtotal = vi.yres + vi.upper_margin + vi.lower_margin
+            + vi.vsync_len;
+
+    if ((vi.vmode & FB_VMODE_MASK) == FB_VMODE_INTERLACED)
+        vtotal /= 2;
+    else if ((vi.vmode & FB_VMODE_MASK) == FB_VMODE_DOUBLE)
+        vtotal *= 2;
+
+    return htotal * vtotal;
+}
+
+/* pixclock is the length of a pixel in picoseconds, 0 when unknown */
+static int64_t get_frame_period(const fb_var_screeninfo &vi)
+{
+    return vi.pixclock * get_frame_pixels(vi) / 1000;
+}
+
+/* In dots per thousand inches, sizes are in millimeters and all ones when
+ * unknown */
+static int32_t get_dpi(uint32_t pixels, uint32_t size)
+{
+    if (!size || size >= INT32_MAX)
+        return HWC2_DEFAULT_DPI * 1000;
+
+    return pixels * 25400ULL / size;
+}
+
+static hwc2_config get_mode_config(const fb_var_screeninfo &vi)
 {
+    int64_t period = get_frame_period(vi);
+
     hwc2_config config;
-    config.set_attribute(HWC2_ATTRIBUTE_WIDTH, fb_dev.vi.xres);
-    config.set_attribute(HWC2_ATTRIBUTE_HEIGHT, fb_dev.vi.yres);
-    config.set_attribute(HWC2_ATTRIBUTE_VSYNC_PERIOD, fb_dev.vi.vsync_len);
-    config.set_attribute(HWC2_ATTRIBUTE_DPI_X, 324);
-    config.set_attribute(HWC2_ATTRIBUTE_DPI_Y, 324);
+    config.set_attribute(HWC2_ATTRIBUTE_WIDTH, vi.xres);
+    config.set_attribute(HWC2_ATTRIBUTE_HEIGHT, vi.yres);
+    config.set_attribute(HWC2_ATTRIBUTE_VSYNC_PERIOD,
+            period > 0? period: HWC2_DEFAULT_VSYNC_PERIOD);
+    config.set_attribute(HWC2_ATTRIBUTE_DPI_X, get_dpi(vi.xres, vi.width));
+    config.set_attribute(HWC2_ATTRIBUTE_DPI_Y, get_dpi(vi.yres, vi.height));
+    config.set_mode(vi);
+
+    return config;
+}
+
+/*
+ * The mode the panel is in becomes config 0. The driver lists its modes in
+ * sysfs as "U:1920x1080p-60", but without timings, so other refresh rates
+ * at the same resolution are reached by scaling the pixel clock of the
+ * current timings. That keeps the blanking the panel was brought up with.
+ */
+int hwc2_display::retrieve_display_configs()
+{
+    configs.clear();
+    configs.emplace(0, get_mode_config(fb_dev.vi));
+    active_config = 0;
+
+    int64_t period = get_frame_period(fb_dev.vi);
+    if (period <= 0)
+        return 0;
+
+    char path[64];
+    snprintf(path, sizeof(path), HWC2_FB_SYSFS_DIR "/fb%d/modes", fb_dev.id);
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return 0;
+
+    uint64_t frame_pixels = get_frame_pixels(fb_dev.vi);
+    std::vector<uint32_t> rates = {
+            static_cast<uint32_t>((1000000000LL + period / 2) / period)};
+    char line[64];
+
+    while (fgets(line, sizeof(line), file)) {
+        uint32_t xres, yres, rate;
+        char type, scan;
+
+        if (sscanf(line, "%c:%ux%u%c-%u", &type, &xres, &yres, &scan,
+                &rate) != 5 || scan != 'p' || !rate
+                || xres != fb_dev.vi.xres || yres != fb_dev.vi.yres
+                || std::find(rates.begin(), rates.end(), rate) != rates.end())
+            continue;
+
+        fb_var_screeninfo vi = fb_dev.vi;
+        vi.pixclock = 1000000000000ULL / (rate * frame_pixels);
+        configs.emplace(configs.size(), get_mode_config(vi));
+        rates.push_back(rate);
+    }
 
-    configs.emplace(0, hwc2_config());
+    fclose(file);
 
     return 0;
 }
@@ -198,21 +660,158 @@ hwc2_error_t hwc2_display::get_active_config(hwc2_config_t *out_config) const
     return HWC2_ERROR_NONE;
 }
 
-/*
- * It's just a stub. Will be implemented later
- */
 hwc2_error_t hwc2_display::set_active_config(hwc2_config_t config)
 {
-    if (config >= configs.size()) {
+    if (configs.find(config) == configs.end()) {
         ALOGE("dpy %" PRIu64 ": bad config", id);
         return HWC2_ERROR_BAD_CONFIG;
     }
 
+    if (apply_config(config) < 0)
+        return HWC2_ERROR_BAD_CONFIG;
+
     active_config = config;
+    content_config = config;
+    content_frames = 0;
 
     return HWC2_ERROR_NONE;
 }
 
+/* Panel configs differ in timings only, switching programs the cached
+ * timings without touching the framebuffer layout. The driver may adjust
+ * what it was given, so the mode is read back. */
+int hwc2_display::apply_config(hwc2_config_t config)
+{
+    if (config == applied_config)
+        return 0;
+
+    const hwc2_config &cfg = configs[config];
+    const fb_var_screeninfo *mode = cfg.get_mode();
+    int64_t period = cfg.get_attribute(HWC2_ATTRIBUTE_VSYNC_PERIOD);
+    if (mode) {
+        fb_var_screeninfo vi = *mode;
+        vi.activate = FB_ACTIVATE_NOW;
+        if (ioctl(fb_dev.fd, FBIOPUT_VSCREENINFO, &vi) < 0) {
+            int ret = -errno;
+            ALOGE("dpy %" PRIu64 ": failed to apply config %u: %s", id, config,
+                    strerror(-ret));
+            return ret;
+        }
+
+        if (ioctl(fb_dev.fd, FBIOGET_VSCREENINFO, &vi) < 0)
+            ALOGW("dpy %" PRIu64 ": failed to read back config %u: %s", id,
+                    config, strerror(errno));
+        fb_dev.vi = vi;
+        full_redraw = true;
+        if (get_frame_period(vi) > 0)
+            period = get_frame_period(vi);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(vsync_mutex);
+        vsync_period = period;
+    }
+    vsync_model.reset(period);
+    applied_config = config;
+
+    return 0;
+}
+
+/*
+ * Video is taken to be the largest layer getting new buffers at a steady
+ * rate, as long as nothing else updates faster. The best config for it has
+ * the resolution of the active one and the lowest refresh rate that is a
+ * multiple of the frame rate, so 24 fps plays at 48 Hz without judder.
+ * Anything else keeps the active config.
+ */
+hwc2_config_t hwc2_display::get_content_config(nsecs_t now) const
+{
+    nsecs_t interval = 0, fastest = 0;
+    uint64_t max_area = 0;
+
+    for (auto &lyr: layers) {
+        nsecs_t lyr_interval = lyr.second.get_update_interval(now);
+        if (!lyr_interval)
+            continue;
+
+        const hwc_rect_t &frame = lyr.second.get_buffer().get_display_frame();
+        uint64_t area = static_cast<uint64_t>(frame.right - frame.left)
+                * (frame.bottom - frame.top);
+        if (area > max_area) {
+            max_area = area;
+            interval = lyr_interval;
+        }
+        if (!fastest || lyr_interval < fastest)
+            fastest = lyr_interval;
+    }
+
+    /* Content keeping up with the panel may be held back by it */
+    int64_t applied_period = configs.at(applied_config).get_attribute(
+            HWC2_ATTRIBUTE_VSYNC_PERIOD);
+    if (!interval || fastest < interval || interval < applied_period * 3 / 2)
+        return active_config;
+
+    const hwc2_config &active = configs.at(active_config);
+    hwc2_config_t best = active_config;
+    int64_t best_period = 0;
+
+    for (auto &cfg: configs) {
+        const hwc2_config &c = cfg.second;
+        if (c.get_attribute(HWC2_ATTRIBUTE_WIDTH)
+                != active.get_attribute(HWC2_ATTRIBUTE_WIDTH)
+                || c.get_attribute(HWC2_ATTRIBUTE_HEIGHT)
+                != active.get_attribute(HWC2_ATTRIBUTE_HEIGHT))
+            continue;
+
+        /* Frames per content frame, rounded */
+        int64_t period = c.get_attribute(HWC2_ATTRIBUTE_VSYNC_PERIOD);
+        int64_t multiple = (interval + period / 2) / period;
+        if (!multiple || std::abs(multiple * period - interval) * 1000
+                > interval * HWC2_CONTENT_RATE_TOLERANCE)
+            continue;
+
+        if (period > best_period) {
+            best = cfg.first;
+            best_period = period;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Follows the frame rate of video content with the panel refresh rate.
+ * active_config and its HWC2_ATTRIBUTE_VSYNC_PERIOD stay what SurfaceFlinger
+ * set, it learns the new cadence only from the vsync events. So the timings
+ * change only while it has those enabled, and it is asked for a new frame
+ * afterwards so that its model resyncs right away.
+ */
+void hwc2_display::update_content_rate()
+{
+    if (configs.size() < 2)
+        return;
+
+    hwc2_config_t config = get_content_config(
+            systemTime(SYSTEM_TIME_MONOTONIC));
+    if (config != content_config) {
+        content_config = config;
+        content_frames = 0;
+        return;
+    }
+
+    if (config == applied_config || ++content_frames < HWC2_CONTENT_RATE_FRAMES)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(vsync_mutex);
+        if (vsync_enabled != HWC2_VSYNC_ENABLE)
+            return;
+    }
+
+    if (apply_config(config) == 0 && callback)
+        callback->call_refresh(id);
+}
+
 hwc2_error_t hwc2_display::create_layer(hwc2_layer_t *out_layer)
 {
     hwc2_layer_t lyr_id = hwc2_layer::get_next_id();
@@ -220,6 +819,7 @@ hwc2_error_t hwc2_display::create_layer(hwc2_layer_t *out_layer)
             std::forward_as_tuple(lyr_id));
 
     *out_layer = lyr_id;
+    full_redraw = true;
     return HWC2_ERROR_NONE;
 }
 
@@ -231,7 +831,17 @@ hwc2_error_t hwc2_display::create_layer(hwc2_layer_t *out_layer)
         return HWC2_ERROR_BAD_LAYER;
     }
 
+    if (cursor_layer == &it->second)
+        cursor_layer = nullptr;
+    plane_layers.erase(std::remove_if(plane_layers.begin(),
+            plane_layers.end(),
+            [&it](const std::pair<const hwc2_plane *, hwc2_layer *> &shown) {
+                return shown.second == &it->second;
+            }), plane_layers.end());
+
     layers.erase(lyr_id);
+    validated = false;
+    full_redraw = true;
     return HWC2_ERROR_NONE;
 }
 
@@ -259,6 +869,1442 @@ hwc2_error_t hwc2_display::set_layer_blend_mode(hwc2_layer_t lyr_id,
     return it->second.set_blend_mode(blend_mode);
 }
 
+hwc2_error_t hwc2_display::set_layer_visible_region(hwc2_layer_t lyr_id,
+        const hwc_region_t &visible_region)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_visible_region(visible_region);
+}
+
+hwc2_error_t hwc2_display::set_layer_surface_damage(hwc2_layer_t lyr_id,
+        const hwc_region_t &surface_damage)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_surface_damage(surface_damage);
+}
+
+hwc2_error_t hwc2_display::set_layer_buffer(hwc2_layer_t lyr_id,
+        buffer_handle_t handle, int32_t acquire_fence)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_buffer(handle, acquire_fence);
+}
+
+hwc2_error_t hwc2_display::set_layer_display_frame(hwc2_layer_t lyr_id,
+        const hwc_rect_t &display_frame)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_display_frame(display_frame);
+}
+
+hwc2_error_t hwc2_display::set_layer_source_crop(hwc2_layer_t lyr_id,
+        const hwc_frect_t &source_crop)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_source_crop(source_crop);
+}
+
+hwc2_error_t hwc2_display::set_layer_plane_alpha(hwc2_layer_t lyr_id,
+        float plane_alpha)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_plane_alpha(plane_alpha);
+}
+
+hwc2_error_t hwc2_display::set_layer_z_order(hwc2_layer_t lyr_id,
+        uint32_t z_order)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_z_order(z_order);
+}
+
+hwc2_error_t hwc2_display::set_layer_transform(hwc2_layer_t lyr_id,
+        hwc_transform_t transform)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_transform(transform);
+}
+
+hwc2_error_t hwc2_display::set_layer_dataspace(hwc2_layer_t lyr_id,
+        android_dataspace_t dataspace)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_dataspace(dataspace);
+}
+
+hwc2_error_t hwc2_display::set_layer_color(hwc2_layer_t lyr_id,
+        const hwc_color_t &color)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    return it->second.set_color(color);
+}
+
+/*
+ * Moves the cursor right away when it is already on screen, so that pointer
+ * motion does not have to wait for the next frame. The new position is kept
+ * in the display frame of the layer for later presents.
+ */
+hwc2_error_t hwc2_display::set_cursor_position(hwc2_layer_t lyr_id, int32_t x,
+        int32_t y)
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end()) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": bad layer handle", id, lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    hwc2_layer &lyr = it->second;
+    if (lyr.get_comp_type() != HWC2_COMPOSITION_CURSOR) {
+        ALOGE("dpy %" PRIu64 ": lyr %" PRIu64 ": not a cursor layer", id,
+                lyr_id);
+        return HWC2_ERROR_BAD_LAYER;
+    }
+
+    const hwc_rect_t &frame = lyr.get_buffer().get_display_frame();
+    lyr.set_display_frame(hwc_rect_t{x, y, x + frame.right - frame.left,
+            y + frame.bottom - frame.top});
+
+    /* A cursor plane is moved by the display controller */
+    std::lock_guard<std::mutex> lock(cursor_mutex);
+    bool drawn = get_plane(lyr) != nullptr;
+    if (&lyr == cursor_layer && !full_redraw && !color_lut
+            && power_mode != HWC2_POWER_MODE_OFF && fb_dev.data) {
+        hwc2_surface target = get_fb_surface();
+        hwc2_region damage;
+        if (cursor_saved)
+            damage.unite(hwc2_region(cursor_rect));
+
+        restore_cursor_under(target);
+        draw_cursor(target);
+        drawn = true;
+
+        if (cursor_saved)
+            damage.unite(hwc2_region(cursor_rect));
+        if (!shadow.empty())
+            upload_shadow(damage);
+        cursor_damage.unite(damage);
+    }
+
+    if (!is_virtual())
+        wake_up(!drawn);
+
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_display::set_client_target(buffer_handle_t target,
+        int32_t acquire_fence, android_dataspace_t dataspace,
+        const hwc_region_t &damage)
+{
+    client_target.set_buffer(target, acquire_fence);
+    client_target.set_dataspace(dataspace);
+    return client_target.set_surface_damage(damage);
+}
+
+hwc2_error_t hwc2_display::set_output_buffer(buffer_handle_t buffer,
+        int32_t release_fence)
+{
+    if (!is_virtual()) {
+        ALOGE("dpy %" PRIu64 ": output buffer on a physical display", id);
+        if (release_fence >= 0)
+            close(release_fence);
+        return HWC2_ERROR_UNSUPPORTED;
+    }
+
+    return output_buffer.set_buffer(buffer, release_fence);
+}
+
+hwc2_error_t hwc2_display::set_color_transform(const float *matrix,
+        android_color_transform_t hint)
+{
+    if (hint < HAL_COLOR_TRANSFORM_IDENTITY
+            || hint > HAL_COLOR_TRANSFORM_CORRECT_TRITANOPIA) {
+        ALOGE("dpy %" PRIu64 ": invalid color transform hint %d", id, hint);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    /* Matrices the kernels cannot represent are left to the client */
+    color_transform_supported = !compositor.set_color_transform(matrix, hint);
+    if (!color_transform_supported)
+        ALOGW("dpy %" PRIu64 ": color transform out of range, using client"
+                " composition", id);
+
+    full_redraw = true;
+    return HWC2_ERROR_NONE;
+}
+
+/*
+ * Every mode with a LUT_DIR/<name>.cube file becomes available. Native is
+ * always there and only gets a LUT when the panel needs calibration.
+ */
+void hwc2_display::load_color_modes()
+{
+    color_modes.clear();
+    color_mode = HAL_COLOR_MODE_NATIVE;
+    color_lut = nullptr;
+
+    for (auto &mode: color_mode_names) {
+        std::string path = std::string(HWC2_LUT_DIR "/dpy") + std::to_string(id)
+                + "/" + mode.name + ".cube";
+        hwc2_lut lut;
+
+        int ret = lut.load(path.c_str());
+        if (ret == -ENOENT) {
+            path = std::string(HWC2_LUT_DIR "/") + mode.name + ".cube";
+            ret = lut.load(path.c_str());
+        }
+
+        if (ret < 0 && ret != -ENOENT)
+            ALOGW("dpy %" PRIu64 ": failed to load %s: %s", id, path.c_str(),
+                    strerror(-ret));
+
+        if (!ret || mode.mode == HAL_COLOR_MODE_NATIVE)
+            color_modes.emplace_back(mode.mode, ret? hwc2_lut(): lut);
+    }
+
+    if (!color_modes.front().second.empty())
+        color_lut = &color_modes.front().second;
+}
+
+hwc2_error_t hwc2_display::get_color_modes(uint32_t *out_num_modes,
+        android_color_mode_t *out_modes) const
+{
+    if (!out_modes) {
+        *out_num_modes = color_modes.size();
+        return HWC2_ERROR_NONE;
+    }
+
+    size_t idx = 0;
+    for (; idx < color_modes.size() && idx < *out_num_modes; idx++)
+        out_modes[idx] = color_modes[idx].first;
+
+    *out_num_modes = idx;
+    return HWC2_ERROR_NONE;
+}
+
+/* Switching only swaps the LUT, the next frame is redrawn through it */
+hwc2_error_t hwc2_display::set_color_mode(android_color_mode_t mode)
+{
+    if (mode < HAL_COLOR_MODE_NATIVE || mode > HAL_COLOR_MODE_DISPLAY_P3) {
+        ALOGE("dpy %" PRIu64 ": invalid color mode %d", id, mode);
+        return HWC2_ERROR_BAD_PARAMETER;
+    }
+
+    auto it = std::find_if(color_modes.begin(), color_modes.end(),
+            [mode](const std::pair<android_color_mode_t, hwc2_lut> &entry) {
+                return entry.first == mode;
+            });
+    if (it == color_modes.end()) {
+        ALOGE("dpy %" PRIu64 ": unsupported color mode %d", id, mode);
+        return HWC2_ERROR_UNSUPPORTED;
+    }
+
+    std::lock_guard<std::mutex> lock(cursor_mutex);
+    color_mode = mode;
+    color_lut = it->second.empty()? nullptr: &it->second;
+    full_redraw = true;
+
+    return HWC2_ERROR_NONE;
+}
+
+/* Surface the panel frame is composed in, the shadow copy when there is one */
+hwc2_surface hwc2_display::get_fb_surface() const
+{
+    if (shadow.empty())
+        return get_scanout_surface();
+
+    hwc2_surface surface = {};
+    surface.data = const_cast<uint8_t *>(shadow.data());
+    surface.width = fb_dev.vi.xres;
+    surface.height = fb_dev.vi.yres;
+    surface.stride = fb_dev.fi.line_length;
+    surface.format = get_fb_format(fb_dev.vi);
+
+    return surface;
+}
+
+/* The shadow copy starts out as cleared as the framebuffer was at open.
+ * Without room for it in the pool the framebuffer is composed directly. */
+void hwc2_display::acquire_shadow()
+{
+    size_t size = static_cast<size_t>(fb_dev.fi.line_length) * fb_dev.vi.yres;
+
+    shadow = pool->acquire(size);
+    if (shadow.empty()) {
+        ALOGW("dpy %" PRIu64 ": no room for a shadow framebuffer", id);
+        return;
+    }
+
+    memset(shadow.data(), 0, size);
+    shadow_dirty.assign(fb_dev.vi.yres, 0);
+}
+
+hwc2_surface hwc2_display::get_scanout_surface() const
+{
+    hwc2_surface surface = {};
+    int32_t format = get_fb_format(fb_dev.vi);
+    uint32_t bpp = hwc2_compositor::get_bpp(format);
+
+    surface.data = static_cast<uint8_t *>(fb_dev.data)
+            + fb_dev.vi.yoffset * fb_dev.fi.line_length
+            + fb_dev.vi.xoffset * bpp;
+    surface.width = fb_dev.vi.xres;
+    surface.height = fb_dev.vi.yres;
+    surface.stride = fb_dev.fi.line_length;
+    surface.format = format;
+
+    return surface;
+}
+
+/* Gets the surface this frame is composed into: the framebuffer of a powered
+ * panel or the locked output buffer of a virtual display */
+bool hwc2_display::lock_target(hwc2_surface *out_target)
+{
+    if (!is_virtual()) {
+        if (power_mode == HWC2_POWER_MODE_OFF || !fb_dev.data)
+            return false;
+        *out_target = get_fb_surface();
+        return true;
+    }
+
+    const hwc2_gralloc &gralloc = hwc2_gralloc::get_instance();
+    buffer_handle_t handle = output_buffer.get_buffer_handle();
+    if (!handle)
+        return false;
+
+    output_buffer.wait_acquire_fence();
+    if (gralloc.lock(handle, out_target, true) < 0)
+        return false;
+
+    /* Layers are clipped to the display, not to the buffer */
+    if (out_target->width < fb_dev.vi.xres
+            || out_target->height < fb_dev.vi.yres) {
+        ALOGE("dpy %" PRIu64 ": output buffer smaller than the display", id);
+        gralloc.unlock(handle);
+        return false;
+    }
+
+    out_target->width = fb_dev.vi.xres;
+    out_target->height = fb_dev.vi.yres;
+    return true;
+}
+
+/* Marks the rows damage touches and copies every marked row of the shadow
+ * copy to the framebuffer. Whole rows make for long runs of sequential
+ * stores, which is what the write combined mapping handles best. */
+void hwc2_display::upload_shadow(const hwc2_region &damage)
+{
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_surface src = get_fb_surface();
+    hwc2_surface dst = get_scanout_surface();
+    size_t row_size = src.width * hwc2_compositor::get_bpp(src.format);
+
+    for (const hwc_rect_t &rect: damage)
+        for (int32_t y = std::max(rect.top, 0); y < rect.bottom
+                && y < static_cast<int32_t>(src.height); y++)
+            shadow_dirty[y] = 1;
+
+    for (uint32_t y = 0; y < src.height; y++) {
+        if (!shadow_dirty[y])
+            continue;
+
+        hwc2_compositor::stream_copy(dst.data + y * dst.stride,
+                src.data + y * src.stride, row_size);
+        shadow_dirty[y] = 0;
+    }
+}
+
+void hwc2_display::unlock_target()
+{
+    if (is_virtual())
+        hwc2_gralloc::get_instance().unlock(output_buffer.get_buffer_handle());
+}
+
+/*
+ * Walks the layers front to back and trims each one down to the part that
+ * is not hidden by opaque layers (blend mode none, plane alpha 1.0) above
+ * it. Layers left with an empty region are neither read nor blended by
+ * present_display. Whatever no opaque layer covers has to be cleared before
+ * the translucent layers are blended on top of it.
+ */
+void hwc2_display::cull_occluded_layers()
+{
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_region screen(hwc_rect_t{0, 0, static_cast<int>(fb_dev.vi.xres),
+            static_cast<int>(fb_dev.vi.yres)});
+    hwc2_region covered;
+
+    for (auto it = comp_layers.rbegin(); it != comp_layers.rend(); it++) {
+        hwc2_layer *lyr = *it;
+        const hwc2_buffer &buffer = lyr->get_buffer();
+
+        hwc2_region region(buffer.get_display_frame());
+        region.intersect(screen);
+        region.intersect(buffer.get_visible_region());
+        region.subtract(covered);
+
+        if (lyr->is_opaque())
+            covered.unite(region);
+
+        lyr->set_comp_region(region);
+    }
+
+    clear_region = screen.subtract(covered);
+}
+
+/* Whether anything besides the cursor changed since the last present. New
+ * buffers on planes leave the framebuffer alone, and so does moving a
+ * cursor plane since the cursor never occludes anything. */
+bool hwc2_display::is_frame_changed() const
+{
+    for (auto &it: layers) {
+        const hwc2_layer &lyr = it.second;
+        const hwc2_plane *plane = get_plane(lyr);
+        if (&lyr == cursor_layer || (plane && plane->is_cursor())) {
+            if (lyr.is_type_changed())
+                return true;
+        } else if (plane) {
+            if (lyr.is_type_changed() || lyr.get_buffer().is_geometry_changed())
+                return true;
+        } else if (lyr.is_changed()) {
+            return true;
+        }
+    }
+
+    /* The save-under only works as long as nothing is drawn over the cursor */
+    if (cursor_layer && !comp_layers.empty() && comp_layers.back()->get_z_order()
+            > cursor_layer->get_z_order())
+        return true;
+
+    return false;
+}
+
+hwc2_composition_t hwc2_display::get_effective_comp_type(
+        const hwc2_layer &lyr) const
+{
+    auto it = changed_types.find(lyr.get_id());
+    if (it != changed_types.end())
+        return it->second;
+
+    return lyr.get_comp_type();
+}
+
+hwc2_error_t hwc2_display::validate_display(uint32_t *out_num_types,
+        uint32_t *out_num_requests)
+{
+    hwc2_stats::timer timer(stats, HWC2_TIMING_VALIDATE);
+
+    if (!is_virtual())
+        update_content_rate();
+
+    if (!full_redraw && changed_types.empty() && !is_frame_changed()) {
+        cursor_only = true;
+        validated = true;
+        *out_num_types = 0;
+        *out_num_requests = 0;
+        return HWC2_ERROR_NONE;
+    }
+
+    comp_layers.clear();
+    changed_types.clear();
+    cursor_only = false;
+    if (!is_virtual())
+        wake_up(false);
+
+    /* Mirrors keep the types the client asked for, their layers are only
+     * composed when the panel frame turns out to be unusable. That takes
+     * layers the compositor can draw, see below. */
+    mirroring = is_virtual() && can_mirror();
+    if (mirroring)
+        mirror_serial = mirror_source->frame_serial;
+
+    for (auto &lyr: layers)
+        comp_layers.push_back(&lyr.second);
+
+    std::stable_sort(comp_layers.begin(), comp_layers.end(),
+            [](const hwc2_layer *a, const hwc2_layer *b) {
+                return a->get_z_order() < b->get_z_order();
+            });
+
+    /* A cursor only gets the save-under treatment when it is the top layer,
+     * it neither occludes nor gets drawn with the rest of the frame. The
+     * saved pixels would already have gone through a color mode LUT, and
+     * virtual displays get a different output buffer every frame. */
+    cursor_layer = nullptr;
+    if (!comp_layers.empty() && !color_lut && !is_virtual()) {
+        hwc2_layer *lyr = comp_layers.back();
+        if (lyr->get_comp_type() == HWC2_COMPOSITION_CURSOR
+                && color_transform_supported
+                && lyr->get_buffer().get_buffer_handle()
+                && lyr->is_device_supported()) {
+            cursor_layer = lyr;
+            comp_layers.pop_back();
+        }
+    }
+
+    cull_occluded_layers();
+    if (!is_virtual())
+        assign_planes();
+
+    /* Culled layers keep whatever type they asked for since they are never
+     * drawn. Everything else the compositor cannot draw goes to the client. */
+    size_t client_first = comp_layers.size(), client_last = 0;
+    for (size_t idx = 0; idx < comp_layers.size(); idx++) {
+        hwc2_layer *lyr = comp_layers[idx];
+        if (lyr->get_comp_region().empty())
+            continue;
+
+        hwc2_composition_t type = lyr->get_comp_type();
+        if (type != HWC2_COMPOSITION_DEVICE && type != HWC2_COMPOSITION_CURSOR
+                && type != HWC2_COMPOSITION_SOLID_COLOR)
+            type = HWC2_COMPOSITION_CLIENT;
+        else if (!lyr->is_device_supported() || !color_transform_supported
+                || is_demoted(*lyr))
+            type = HWC2_COMPOSITION_CLIENT;
+
+        if (type != lyr->get_comp_type())
+            changed_types[lyr->get_id()] = type;
+
+        if (type == HWC2_COMPOSITION_CLIENT) {
+            client_first = std::min(client_first, idx);
+            client_last = idx;
+        }
+    }
+
+    /* The client target is drawn as a single layer, so no device layer may
+     * sit between two client layers */
+    client_region.clear();
+    client_opaque_region.clear();
+    for (size_t idx = client_first; idx <= client_last
+            && idx < comp_layers.size(); idx++) {
+        hwc2_layer *lyr = comp_layers[idx];
+        if (lyr->get_comp_region().empty())
+            continue;
+
+        if (get_effective_comp_type(*lyr) != HWC2_COMPOSITION_CLIENT)
+            changed_types[lyr->get_id()] = HWC2_COMPOSITION_CLIENT;
+
+        client_region.unite(lyr->get_comp_region());
+        if (lyr->is_opaque())
+            client_opaque_region.unite(lyr->get_comp_region());
+    }
+
+    /* present_display composes the layers when the panel has not presented
+     * the frame yet, which only works without any type changes */
+    if (!changed_types.empty())
+        mirroring = false;
+
+    fill_only = true;
+    for (hwc2_layer *lyr: comp_layers)
+        if (!lyr->get_comp_region().empty()
+                && get_effective_comp_type(*lyr) != HWC2_COMPOSITION_SOLID_COLOR)
+            fill_only = false;
+
+    /* Without HWC2_CAPABILITY_SKIP_CLIENT_COLOR_TRANSFORM the client applies
+     * the color transform itself only when it composes every layer */
+    transform_client_target = cursor_layer != nullptr;
+    for (auto &it: layers)
+        if (get_effective_comp_type(it.second) != HWC2_COMPOSITION_CLIENT)
+            transform_client_target = true;
+
+    validated = true;
+
+    *out_num_types = changed_types.size();
+    *out_num_requests = 0;
+
+    return changed_types.empty()? HWC2_ERROR_NONE: HWC2_ERROR_HAS_CHANGES;
+}
+
+/*
+ * Moves the layers planes can show out of comp_layers: the cursor to a
+ * cursor plane, the topmost layers to the planes above the framebuffer and
+ * the bottom ones to the planes below it. Planes below only work with a
+ * framebuffer format that has alpha, and only take opaque layers, so the
+ * hole left for them in the framebuffer has nothing else to show. Planes
+ * would bypass color modes and color transforms, so those turn them off.
+ */
+void hwc2_display::assign_planes()
+{
+    HWC2_TRACE_SCOPE(__func__);
+    std::vector<std::pair<const hwc2_plane *, hwc2_layer *>> last;
+    last.swap(plane_layers);
+    underlay_region.clear();
+
+    if (planes.empty() || color_lut
+            || !compositor.is_color_transform_identity()) {
+        if (!last.empty())
+            full_redraw = true;
+        return;
+    }
+
+    hwc2_region screen(hwc_rect_t{0, 0, static_cast<int>(fb_dev.vi.xres),
+            static_cast<int>(fb_dev.vi.yres)});
+    bool underlays = hwc2_compositor::has_alpha(get_fb_format(fb_dev.vi));
+    size_t bottom = 0, top = comp_layers.size();
+
+    for (auto it = planes.rbegin(); it != planes.rend() && cursor_layer;
+            it++) {
+        const hwc_rect_t &frame = cursor_layer->get_buffer()
+                .get_display_frame();
+        if (it->is_cursor() && it->is_above() && screen.contains(frame)
+                && it->can_show(*cursor_layer)) {
+            plane_layers.emplace_back(&*it, cursor_layer);
+            cursor_layer = nullptr;
+        }
+    }
+
+    /* Culled layers are never shown, so they do not keep the layers next
+     * to them from being the top or bottom one */
+    for (auto it = planes.begin(); it != planes.end() && underlays; it++) {
+        while (bottom < top && comp_layers[bottom]->get_comp_region().empty())
+            bottom++;
+        if (bottom == top)
+            break;
+
+        hwc2_layer *lyr = comp_layers[bottom];
+        if (it->is_above() || it->is_cursor() || !lyr->is_opaque()
+                || !screen.contains(lyr->get_buffer().get_display_frame())
+                || !it->can_show(*lyr))
+            continue;
+
+        plane_layers.emplace_back(&*it, lyr);
+        underlay_region.unite(lyr->get_comp_region());
+        bottom++;
+    }
+
+    /* What is hidden of a layer on a plane above would show anyway */
+    for (auto it = planes.rbegin(); it != planes.rend(); it++) {
+        while (top > bottom && comp_layers[top - 1]->get_comp_region().empty())
+            top--;
+        if (top == bottom)
+            break;
+
+        hwc2_layer *lyr = comp_layers[top - 1];
+        const hwc2_buffer &buffer = lyr->get_buffer();
+        if (!it->is_above() || it->is_cursor()
+                || !screen.contains(buffer.get_display_frame())
+                || !buffer.get_visible_region().contains(
+                buffer.get_display_frame())
+                || !it->can_show(*lyr))
+            continue;
+
+        plane_layers.emplace_back(&*it, lyr);
+        top--;
+    }
+
+    if (!plane_layers.empty())
+        comp_layers.erase(std::remove_if(comp_layers.begin(),
+                comp_layers.end(), [this](const hwc2_layer *lyr) {
+                    return get_plane(*lyr) != nullptr;
+                }), comp_layers.end());
+
+    /* Layers that moved between a plane and the framebuffer leave damage
+     * that content changes do not describe */
+    if (plane_layers != last)
+        full_redraw = true;
+}
+
+/* Takes the windows a backend found next to the framebuffer, before the
+ * display is announced or between frames */
+void hwc2_display::set_planes(std::vector<hwc2_plane> planes)
+{
+    this->planes = std::move(planes);
+    plane_layers.clear();
+    full_redraw = true;
+}
+
+/* The plane a layer is shown on after validate_display, 0 for the
+ * framebuffer */
+uint32_t hwc2_display::get_layer_plane(hwc2_layer_t lyr_id) const
+{
+    auto it = layers.find(lyr_id);
+    if (it == layers.end())
+        return 0;
+
+    const hwc2_plane *plane = get_plane(it->second);
+    return plane? plane->get_id(): 0;
+}
+
+const hwc2_plane *hwc2_display::get_plane(const hwc2_layer &lyr) const
+{
+    for (auto &it: plane_layers)
+        if (it.second == &lyr)
+            return it.first;
+
+    return nullptr;
+}
+
+/* Layers the quality governor leaves to the client, solid colors are cheap
+ * enough to always be filled */
+bool hwc2_display::is_demoted(const hwc2_layer &lyr) const
+{
+    if (lyr.get_comp_type() == HWC2_COMPOSITION_SOLID_COLOR)
+        return false;
+
+    switch (governor.get_tier()) {
+    case HWC2_QUALITY_CLIENT_ALL:
+        return true;
+    case HWC2_QUALITY_CLIENT_SCALED: {
+        const hwc2_buffer &buffer = lyr.get_buffer();
+        const hwc_frect_t &crop = buffer.get_source_crop();
+        const hwc_rect_t &frame = buffer.get_display_frame();
+        return hwc2_compositor::is_yuv_format(hwc2_gralloc::get_instance()
+                .get_format(buffer.get_buffer_handle()))
+                || crop.right - crop.left != frame.right - frame.left
+                || crop.bottom - crop.top != frame.bottom - frame.top;
+    }
+    default:
+        return false;
+    }
+}
+
+hwc2_error_t hwc2_display::get_changed_composition_types(
+        uint32_t *out_num_elements, hwc2_layer_t *out_layers,
+        hwc2_composition_t *out_types) const
+{
+    if (!validated) {
+        ALOGE("dpy %" PRIu64 ": display not validated", id);
+        return HWC2_ERROR_NOT_VALIDATED;
+    }
+
+    if (!out_layers || !out_types) {
+        *out_num_elements = changed_types.size();
+        return HWC2_ERROR_NONE;
+    }
+
+    size_t idx = 0;
+    for (auto it = changed_types.begin(); it != changed_types.end()
+            && idx < *out_num_elements; it++, idx++) {
+        out_layers[idx] = it->first;
+        out_types[idx] = it->second;
+    }
+
+    *out_num_elements = idx;
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_display::get_display_requests(int32_t *out_display_requests,
+        uint32_t *out_num_elements, hwc2_layer_t* /*out_layers*/,
+        int32_t* /*out_layer_requests*/) const
+{
+    if (!validated) {
+        ALOGE("dpy %" PRIu64 ": display not validated", id);
+        return HWC2_ERROR_NOT_VALIDATED;
+    }
+
+    *out_display_requests = 0;
+    *out_num_elements = 0;
+    return HWC2_ERROR_NONE;
+}
+
+hwc2_error_t hwc2_display::accept_display_changes()
+{
+    if (!validated) {
+        ALOGE("dpy %" PRIu64 ": display not validated", id);
+        return HWC2_ERROR_NOT_VALIDATED;
+    }
+
+    for (auto &changed: changed_types) {
+        auto it = layers.find(changed.first);
+        if (it != layers.end())
+            it->second.set_comp_type(changed.second);
+    }
+
+    changed_types.clear();
+    return HWC2_ERROR_NONE;
+}
+
+void hwc2_display::draw_layer(const hwc2_surface &target, hwc2_layer &lyr)
+{
+    hwc2_buffer &buffer = lyr.get_buffer();
+    const hwc2_gralloc &gralloc = hwc2_gralloc::get_instance();
+    hwc2_surface src;
+
+    buffer.wait_acquire_fence();
+    if (gralloc.lock(buffer.get_buffer_handle(), &src) < 0)
+        return;
+
+    compositor.draw(target, src, buffer.get_source_crop(),
+            buffer.get_display_frame(), buffer.get_blend_mode(),
+            buffer.get_plane_alpha(), lyr.get_comp_region(), true,
+            buffer.get_dataspace());
+
+    gralloc.unlock(buffer.get_buffer_handle());
+}
+
+void hwc2_display::draw_fill(const hwc2_surface &target, const hwc2_layer &lyr)
+{
+    const hwc2_buffer &buffer = lyr.get_buffer();
+    uint32_t color = hwc2_compositor::get_fill_color(buffer.get_color(),
+            buffer.get_blend_mode(), buffer.get_plane_alpha());
+
+    if ((color >> 24) == 255)
+        compositor.fill(target, color, lyr.get_comp_region());
+    else
+        compositor.blend_fill(target, color, lyr.get_comp_region());
+}
+
+/* The client target covers the whole display but only the parts that belong
+ * to client layers are taken from it. Where one of those layers is opaque
+ * the client target is copied instead of blended. */
+void hwc2_display::draw_client_target(const hwc2_surface &target)
+{
+    const hwc2_gralloc &gralloc = hwc2_gralloc::get_instance();
+    hwc2_surface src;
+
+    client_target.wait_acquire_fence();
+    if (gralloc.lock(client_target.get_buffer_handle(), &src) < 0)
+        return;
+
+    hwc_frect_t crop = {0.0f, 0.0f, static_cast<float>(target.width),
+            static_cast<float>(target.height)};
+    hwc_rect_t frame = {0, 0, static_cast<int>(target.width),
+            static_cast<int>(target.height)};
+    hwc2_region translucent(client_region);
+    translucent.subtract(client_opaque_region);
+    android_dataspace_t dataspace = client_target.get_dataspace();
+
+    compositor.draw(target, src, crop, frame, HWC2_BLEND_MODE_NONE, 1.0f,
+            client_opaque_region, transform_client_target, dataspace);
+    compositor.draw(target, src, crop, frame, HWC2_BLEND_MODE_PREMULTIPLIED,
+            1.0f, translucent, transform_client_target, dataspace);
+
+    gralloc.unlock(client_target.get_buffer_handle());
+}
+
+void hwc2_display::draw_layers(const hwc2_surface &target)
+{
+    HWC2_TRACE_SCOPE(__func__);
+    bool client_drawn = false;
+
+    compositor.clear(target, clear_region);
+    if (!underlay_region.empty())
+        compositor.fill(target, 0, underlay_region);
+
+    for (hwc2_layer *lyr: comp_layers) {
+        if (lyr->get_comp_region().empty())
+            continue;
+
+        switch (get_effective_comp_type(*lyr)) {
+        case HWC2_COMPOSITION_CLIENT:
+            if (!client_drawn)
+                draw_client_target(target);
+            client_drawn = true;
+            break;
+        case HWC2_COMPOSITION_SOLID_COLOR:
+            draw_fill(target, *lyr);
+            break;
+        default:
+            draw_layer(target, *lyr);
+            break;
+        }
+    }
+}
+
+/*
+ * Frames made of nothing but solid colors (dim backgrounds, letterboxing) are
+ * resolved into regions of constant color first, so that the framebuffer is
+ * only ever written and neither layer buffers nor the framebuffer are read.
+ */
+void hwc2_display::draw_fill_only(const hwc2_surface &target)
+{
+    HWC2_TRACE_SCOPE(__func__);
+    std::vector<std::pair<hwc2_region, uint32_t>> fills;
+    fills.emplace_back(clear_region, 0xff000000);
+    if (!underlay_region.empty())
+        fills.emplace_back(underlay_region, 0);
+
+    for (hwc2_layer *lyr: comp_layers) {
+        const hwc2_region &region = lyr->get_comp_region();
+        if (region.empty())
+            continue;
+
+        const hwc2_buffer &buffer = lyr->get_buffer();
+        uint32_t color = hwc2_compositor::get_fill_color(buffer.get_color(),
+                buffer.get_blend_mode(), buffer.get_plane_alpha());
+
+        size_t cnt = fills.size();
+        for (size_t idx = 0; idx < cnt; idx++) {
+            hwc2_region under(fills[idx].first);
+            under.intersect(region);
+            if (under.empty())
+                continue;
+
+            fills[idx].first.subtract(region);
+            if ((color >> 24) != 255)
+                fills.emplace_back(under, hwc2_compositor::blend_pixel(color,
+                        fills[idx].second));
+        }
+
+        if ((color >> 24) == 255)
+            fills.emplace_back(region, color);
+    }
+
+    for (auto &fill: fills)
+        compositor.fill(target, fill.second, fill.first);
+}
+
+bool hwc2_display::cache_cursor_image(hwc2_buffer &buffer)
+{
+    const hwc2_gralloc &gralloc = hwc2_gralloc::get_instance();
+    hwc2_surface src;
+
+    cursor_handle = nullptr;
+
+    buffer.wait_acquire_fence();
+    if (gralloc.lock(buffer.get_buffer_handle(), &src) < 0)
+        return false;
+
+    uint32_t row_size = src.width * hwc2_compositor::get_bpp(src.format);
+    cursor_image.resize(row_size * src.height);
+    for (uint32_t y = 0; y < src.height; y++)
+        memcpy(&cursor_image[y * row_size], src.data + y * src.stride,
+                row_size);
+
+    gralloc.unlock(buffer.get_buffer_handle());
+
+    cursor_src.data = cursor_image.data();
+    cursor_src.width = src.width;
+    cursor_src.height = src.height;
+    cursor_src.stride = row_size;
+    cursor_src.format = src.format;
+    cursor_handle = buffer.get_buffer_handle();
+
+    return true;
+}
+
+void hwc2_display::save_cursor_under(const hwc2_surface &target,
+        const hwc_rect_t &rect)
+{
+    uint32_t bpp = hwc2_compositor::get_bpp(target.format);
+    size_t row_size = (rect.right - rect.left) * bpp;
+    const uint8_t *src = target.data + rect.top * target.stride
+            + rect.left * bpp;
+
+    cursor_save.resize(row_size * (rect.bottom - rect.top));
+    for (int32_t y = rect.top; y < rect.bottom; y++, src += target.stride)
+        memcpy(&cursor_save[(y - rect.top) * row_size], src, row_size);
+
+    cursor_rect = rect;
+    cursor_saved = true;
+}
+
+void hwc2_display::restore_cursor_under(const hwc2_surface &target)
+{
+    if (!cursor_saved)
+        return;
+
+    uint32_t bpp = hwc2_compositor::get_bpp(target.format);
+    size_t row_size = (cursor_rect.right - cursor_rect.left) * bpp;
+    uint8_t *dst = target.data + cursor_rect.top * target.stride
+            + cursor_rect.left * bpp;
+
+    for (int32_t y = cursor_rect.top; y < cursor_rect.bottom;
+            y++, dst += target.stride)
+        memcpy(dst, &cursor_save[(y - cursor_rect.top) * row_size], row_size);
+
+    cursor_saved = false;
+}
+
+/* Expects the pixels beneath the cursor to be free of any previous cursor */
+void hwc2_display::draw_cursor(const hwc2_surface &target)
+{
+    HWC2_TRACE_SCOPE(__func__);
+    hwc2_buffer &buffer = cursor_layer->get_buffer();
+
+    if (buffer.get_buffer_handle() != cursor_handle
+            || buffer.is_content_changed()) {
+        stats.add(HWC2_STAT_CACHE_MISSES);
+        if (!cache_cursor_image(buffer))
+            return;
+    } else {
+        stats.add(HWC2_STAT_CACHE_HITS);
+    }
+
+    const hwc_rect_t &frame = buffer.get_display_frame();
+    hwc_rect_t rect = {
+        std::max(frame.left, 0),
+        std::max(frame.top, 0),
+        std::min(frame.right, static_cast<int32_t>(target.width)),
+        std::min(frame.bottom, static_cast<int32_t>(target.height)),
+    };
+    if (rect.left >= rect.right || rect.top >= rect.bottom)
+        return;
+
+    save_cursor_under(target, rect);
+    compositor.draw(target, cursor_src, buffer.get_source_crop(), frame,
+            buffer.get_blend_mode(), buffer.get_plane_alpha(),
+            hwc2_region(rect), true, buffer.get_dataspace());
+}
+
+/* Pixels of the framebuffer that may differ from the last presented frame,
+ * geometry changes are not tracked in detail and damage everything */
+hwc2_region hwc2_display::get_frame_damage() const
+{
+    hwc2_region screen(hwc_rect_t{0, 0, static_cast<int>(fb_dev.vi.xres),
+            static_cast<int>(fb_dev.vi.yres)});
+    hwc2_region damage;
+
+    if (full_redraw)
+        return screen;
+
+    if (cursor_layer && (!cursor_only || cursor_layer->is_changed())) {
+        hwc2_region frame(cursor_layer->get_buffer().get_display_frame());
+        if (cursor_saved)
+            damage.unite(hwc2_region(cursor_rect));
+        damage.unite(frame.intersect(screen));
+    } else if (!cursor_layer && cursor_saved) {
+        damage.unite(hwc2_region(cursor_rect));
+    }
+
+    if (cursor_only)
+        return damage;
+
+    for (auto &it: layers) {
+        const hwc2_layer &lyr = it.second;
+        const hwc2_plane *plane = get_plane(lyr);
+        if (&lyr == cursor_layer || (plane && plane->is_cursor()))
+            continue;
+        if (lyr.is_type_changed() || lyr.get_buffer().is_geometry_changed())
+            return screen;
+        if (lyr.get_buffer().is_content_changed() && !plane)
+            damage.unite(lyr.get_comp_region());
+    }
+
+    if (client_target.is_content_changed())
+        damage.unite(client_region);
+
+    return damage;
+}
+
+/* Everything the panel changed after frame serial, fails once that frame has
+ * dropped out of the history */
+bool hwc2_display::get_damage_since(uint64_t serial,
+        hwc2_region *out_damage) const
+{
+    if (serial == frame_serial)
+        return true;
+
+    if (damage_history.empty() || damage_history.front().first > serial + 1)
+        return false;
+
+    for (auto &it: damage_history)
+        if (it.first > serial)
+            out_damage->unite(it.second);
+
+    return true;
+}
+
+/*
+ * The client mirrors a display by giving another display the same layers
+ * with every display frame scaled and moved the same way. Layers are matched
+ * up by z order and the mapping is taken from the largest one.
+ */
+bool hwc2_display::can_mirror()
+{
+    const hwc2_display *src = mirror_source;
+
+    if (!src || src->power_mode == HWC2_POWER_MODE_OFF || !src->fb_dev.data
+            || src->color_lut || !src->compositor.is_color_transform_identity()
+            || !src->plane_layers.empty()
+            || !compositor.is_color_transform_identity() || layers.empty()
+            || layers.size() != src->layers.size())
+        return false;
+
+    auto by_z = [](const hwc2_layer *a, const hwc2_layer *b) {
+        return a->get_z_order() < b->get_z_order();
+    };
+    std::vector<const hwc2_layer *> own, other;
+    for (auto &it: layers)
+        own.push_back(&it.second);
+    for (auto &it: src->layers)
+        other.push_back(&it.second);
+    std::stable_sort(own.begin(), own.end(), by_z);
+    std::stable_sort(other.begin(), other.end(), by_z);
+
+    size_t largest = 0;
+    int64_t largest_area = 0;
+    for (size_t idx = 0; idx < other.size(); idx++) {
+        const hwc_rect_t &frame = other[idx]->get_buffer().get_display_frame();
+        int64_t area = static_cast<int64_t>(frame.right - frame.left)
+                * (frame.bottom - frame.top);
+        if (area > largest_area) {
+            largest = idx;
+            largest_area = area;
+        }
+    }
+    if (!largest_area)
+        return false;
+
+    const hwc_rect_t &from = other[largest]->get_buffer().get_display_frame();
+    const hwc_rect_t &to = own[largest]->get_buffer().get_display_frame();
+    float scale_x = static_cast<float>(to.right - to.left)
+            / (from.right - from.left);
+    float scale_y = static_cast<float>(to.bottom - to.top)
+            / (from.bottom - from.top);
+    float off_x = to.left - from.left * scale_x;
+    float off_y = to.top - from.top * scale_y;
+    if (!(scale_x > 0.0f && scale_x <= 1.0f && scale_y > 0.0f
+            && scale_y <= 1.0f))
+        return false;
+
+    for (size_t idx = 0; idx < own.size(); idx++) {
+        const hwc2_buffer &a = own[idx]->get_buffer();
+        const hwc2_buffer &b = other[idx]->get_buffer();
+        const hwc_rect_t &fa = a.get_display_frame();
+        const hwc_rect_t &fb = b.get_display_frame();
+        const hwc_frect_t &ca = a.get_source_crop();
+        const hwc_frect_t &cb = b.get_source_crop();
+        const hwc_color_t &col_a = a.get_color();
+        const hwc_color_t &col_b = b.get_color();
+
+        if (own[idx]->get_comp_type() == HWC2_COMPOSITION_SIDEBAND
+                || a.get_buffer_handle() != b.get_buffer_handle()
+                || a.get_blend_mode() != b.get_blend_mode()
+                || a.get_plane_alpha() != b.get_plane_alpha()
+                || a.get_transform() != b.get_transform()
+                || ca.left != cb.left || ca.top != cb.top
+                || ca.right != cb.right || ca.bottom != cb.bottom
+                || col_a.r != col_b.r || col_a.g != col_b.g
+                || col_a.b != col_b.b || col_a.a != col_b.a)
+            return false;
+
+        if (fabsf(fa.left - (fb.left * scale_x + off_x)) > 1.0f
+                || fabsf(fa.top - (fb.top * scale_y + off_y)) > 1.0f
+                || fabsf(fa.right - (fb.right * scale_x + off_x)) > 1.0f
+                || fabsf(fa.bottom - (fb.bottom * scale_y + off_y)) > 1.0f)
+            return false;
+    }
+
+    hwc_rect_t frame = {
+        static_cast<int>(lroundf(off_x)),
+        static_cast<int>(lroundf(off_y)),
+        static_cast<int>(lroundf(src->fb_dev.vi.xres * scale_x + off_x)),
+        static_cast<int>(lroundf(src->fb_dev.vi.yres * scale_y + off_y)),
+    };
+
+    /* Scaling needs the whole panel in view */
+    if (frame.left < 0 || frame.top < 0 || frame.left >= frame.right
+            || frame.top >= frame.bottom
+            || frame.right > static_cast<int>(fb_dev.vi.xres)
+            || frame.bottom > static_cast<int>(fb_dev.vi.yres))
+        return false;
+
+    mirror_frame = frame;
+    return true;
+}
+
+/* Brings the output buffer up to date with the panel, output buffers that
+ * are new or too far behind are redrawn in full */
+void hwc2_display::draw_mirror(const hwc2_surface &target)
+{
+    HWC2_TRACE_SCOPE(__func__);
+    const hwc2_display &src = *mirror_source;
+    hwc2_surface fb = src.get_fb_surface();
+    buffer_handle_t handle = output_buffer.get_buffer_handle();
+    hwc2_region frame(mirror_frame);
+    hwc2_region damage, clip;
+
+    auto it = std::find_if(mirror_buffers.begin(), mirror_buffers.end(),
+            [handle](const std::pair<buffer_handle_t, uint64_t> &buf) {
+                return buf.first == handle;
+            });
+
+    if (it != mirror_buffers.end() && src.get_damage_since(it->second,
+            &damage)) {
+        stats.add(HWC2_STAT_CACHE_HITS);
+        float scale_x = static_cast<float>(mirror_frame.right
+                - mirror_frame.left) / fb.width;
+        float scale_y = static_cast<float>(mirror_frame.bottom
+                - mirror_frame.top) / fb.height;
+
+        /* Filters reach a pixel past the source pixels they sample */
+        for (const hwc_rect_t &rect: damage)
+            clip.unite(hwc2_region(hwc_rect_t{
+                mirror_frame.left + static_cast<int>(rect.left * scale_x) - 1,
+                mirror_frame.top + static_cast<int>(rect.top * scale_y) - 1,
+                mirror_frame.left
+                        + static_cast<int>(ceilf(rect.right * scale_x)) + 1,
+                mirror_frame.top
+                        + static_cast<int>(ceilf(rect.bottom * scale_y)) + 1,
+            }));
+        clip.intersect(frame);
+    } else {
+        hwc2_region border(hwc_rect_t{0, 0, static_cast<int>(target.width),
+                static_cast<int>(target.height)});
+        compositor.clear(target, border.subtract(frame));
+        clip = frame;
+        stats.add(HWC2_STAT_CACHE_MISSES);
+
+        if (it == mirror_buffers.end()) {
+            if (mirror_buffers.size() >= HWC2_MIRROR_BUFFERS)
+                mirror_buffers.erase(mirror_buffers.begin());
+            mirror_buffers.emplace_back(handle, 0);
+            it = mirror_buffers.end() - 1;
+        }
+    }
+
+    compositor.scale(target, fb, mirror_frame, clip);
+    it->second = src.frame_serial;
+}
+
+hwc2_error_t hwc2_display::present_display(int32_t *out_present_fence)
+{
+    hwc2_stats::timer timer(stats, HWC2_TIMING_PRESENT);
+    *out_present_fence = -1;
+
+    if (!validated) {
+        ALOGE("dpy %" PRIu64 ": display not validated", id);
+        return HWC2_ERROR_NOT_VALIDATED;
+    }
+
+    validated = false;
+
+    /* The client target is set after validate_display, so a new one may
+     * still turn a cursor only frame into a full one */
+    if (!client_region.empty() && client_target.is_content_changed())
+        cursor_only = false;
+
+    /* When the client composes all layers of a virtual display it renders
+     * straight into the output buffer, which then only has to be ready */
+    hwc2_surface target;
+    bool mirrored = false;
+    if (is_virtual() && client_target.get_buffer_handle()
+            == output_buffer.get_buffer_handle()) {
+        client_target.wait_acquire_fence();
+    } else if (lock_target(&target)) {
+        std::lock_guard<std::mutex> lock(cursor_mutex);
+        nsecs_t compose_start = systemTime(SYSTEM_TIME_MONOTONIC);
+        /* The panel scans out of the only framebuffer there is, a frame
+         * still being written at the next vsync is shown torn. Frames that
+         * leave the framebuffer alone cannot be. */
+        nsecs_t deadline = 0;
+        if (!is_virtual() && (!cursor_only
+                || (cursor_layer && cursor_layer->is_changed())))
+            deadline = vsync_model.get_next_vsync(compose_start);
+        /* Full frames whose damage could not be told apart are taken to
+         * change everything, for the shadow upload and for mirrors alike */
+        hwc2_region damage;
+        if (!is_virtual()) {
+            damage = get_frame_damage();
+            if (damage.empty() && !cursor_only)
+                damage.set(hwc_rect_t{0, 0, static_cast<int>(target.width),
+                        static_cast<int>(target.height)});
+        }
+
+        /* The panel has to be presented after this display was validated
+         * for its framebuffer to hold the same frame */
+        if (mirroring && mirror_source->frame_serial != mirror_serial) {
+            draw_mirror(target);
+            mirrored = true;
+        } else if (cursor_only) {
+            if (cursor_layer && cursor_layer->is_changed()) {
+                restore_cursor_under(target);
+                draw_cursor(target);
+            }
+            stats.add(HWC2_STAT_FRAMES_SKIPPED);
+        } else {
+            cursor_saved = false;
+            count_layers();
+
+            if (fill_only)
+                draw_fill_only(target);
+            else
+                draw_layers(target);
+
+            if (cursor_layer)
+                draw_cursor(target);
+
+            if (color_lut) {
+                HWC2_TRACE_SCOPE("map_color_lut");
+                compositor.map(target, *color_lut, hwc2_region(hwc_rect_t{0, 0,
+                        static_cast<int>(target.width),
+                        static_cast<int>(target.height)}));
+            }
+        }
+
+        if (!is_virtual() && !shadow.empty())
+            upload_shadow(damage);
+
+        unlock_target();
+        nsecs_t compose_end = systemTime(SYSTEM_TIME_MONOTONIC);
+        stats.record(HWC2_TIMING_COMPOSE, compose_end - compose_start);
+        if (!is_virtual() && vsync_model.add_compose_time(
+                compose_end - compose_start, compose_end, deadline))
+            stats.add(HWC2_STAT_DEADLINE_MISSES);
+        if (!cursor_only || mirrored) {
+            uint64_t area = damage.empty() || mirrored? static_cast<uint64_t>(
+                    target.width) * target.height: damage.get_area();
+            stats.add(HWC2_STAT_BYTES_WRITTEN,
+                    area * hwc2_compositor::get_bpp(target.format));
+        }
+
+        /* Output buffers of virtual displays rotate, none of them holds the
+         * previous frame */
+        full_redraw = is_virtual();
+
+        /* Cursor only frames say nothing about what a frame costs */
+        if ((!cursor_only || mirrored) && governor.add_compose_time(
+                compose_end - compose_start, vsync_period)) {
+            ALOGI("dpy %" PRIu64 ": composition quality %s", id,
+                    governor.get_tier_name());
+            compositor.set_nearest_scaling(governor.get_tier()
+                    >= HWC2_QUALITY_NEAREST_SCALING);
+            full_redraw = true;
+        }
+
+        if (!is_virtual()) {
+            damage.unite(cursor_damage);
+            cursor_damage.clear();
+            damage_history.emplace_back(++frame_serial, damage);
+            if (damage_history.size() > HWC2_DAMAGE_HISTORY)
+                damage_history.pop_front();
+        }
+    } else {
+        full_redraw = true;
+    }
+
+    /* Output buffers written any other way no longer match a panel frame */
+    if (is_virtual() && !mirrored)
+        mirror_buffers.erase(std::remove_if(mirror_buffers.begin(),
+                mirror_buffers.end(),
+                [this](const std::pair<buffer_handle_t, uint64_t> &buf) {
+                    return buf.first == output_buffer.get_buffer_handle();
+                }), mirror_buffers.end());
+
+    /* Culled and client layers still hold the fences they were given, and
+     * so do layers on planes since no backend programs the windows yet */
+    for (hwc2_layer *lyr: comp_layers)
+        lyr->get_buffer().close_acquire_fence();
+    for (auto &it: plane_layers)
+        it.second->get_buffer().close_acquire_fence();
+    if (cursor_layer)
+        cursor_layer->get_buffer().close_acquire_fence();
+    client_target.close_acquire_fence();
+    output_buffer.close_acquire_fence();
+
+    for (auto &lyr: layers)
+        lyr.second.clear_changed();
+    client_target.clear_changed();
+    stats.add(HWC2_STAT_FRAMES_PRESENTED);
+
+    return HWC2_ERROR_NONE;
+}
+
+/* Composition is finished by the time present_display returns, so buffers
+ * can be reused right away and no release fences are handed out */
+hwc2_error_t hwc2_display::get_release_fences(uint32_t *out_num_elements,
+        hwc2_layer_t* /*out_layers*/, int32_t* /*out_fences*/) const
+{
+    *out_num_elements = 0;
+    return HWC2_ERROR_NONE;
+}
+
+void hwc2_display::count_layers()
+{
+    for (hwc2_layer *lyr: comp_layers) {
+        if (lyr->get_comp_region().empty())
+            continue;
+
+        switch (get_effective_comp_type(*lyr)) {
+        case HWC2_COMPOSITION_CLIENT:
+            stats.add(HWC2_STAT_LAYERS_CLIENT);
+            break;
+        case HWC2_COMPOSITION_SOLID_COLOR:
+            stats.add(HWC2_STAT_LAYERS_SOLID_COLOR);
+            break;
+        default:
+            stats.add(HWC2_STAT_LAYERS_DEVICE);
+            break;
+        }
+    }
+
+    if (cursor_layer)
+        stats.add(HWC2_STAT_LAYERS_CURSOR);
+    stats.add(HWC2_STAT_LAYERS_PLANE, plane_layers.size());
+}
+
+void hwc2_display::dump(std::string *out) const
+{
+    char line[160];
+
+    snprintf(line, sizeof(line), "  %s: %s, %ux%u, config %u (running %u,"
+            " content %u), quality %s\n", name.c_str(),
+            connection == HWC2_CONNECTION_CONNECTED? "connected":
+            "disconnected", fb_dev.vi.xres, fb_dev.vi.yres, active_config,
+            applied_config, content_config, governor.get_tier_name());
+    out->append(line);
+
+    if (!is_virtual())
+        vsync_model.dump(out);
+
+    for (const hwc2_plane &plane: planes) {
+        plane.dump(out);
+        auto it = std::find_if(plane_layers.begin(), plane_layers.end(),
+                [&plane](const std::pair<const hwc2_plane *, hwc2_layer *>
+                        &shown) {
+                    return shown.first == &plane;
+                });
+        if (it != plane_layers.end())
+            snprintf(line, sizeof(line), ", lyr %" PRIu64 "\n",
+                    it->second->get_id());
+        else
+            snprintf(line, sizeof(line), ", unused\n");
+        out->append(line);
+    }
+
+    stats.dump(out);
+}
+
 hwc2_display_t hwc2_display::get_next_id()
 {
     return display_cnt++;
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hwc2.h"
+
+/* Composition running over this many tenths of the budget counts as over,
+ * under this many as well under */
+#define HWC2_GOVERNOR_HIGH 9
+#define HWC2_GOVERNOR_LOW 5
+
+/* Fraction of a new composition time the average moves by */
+#define HWC2_GOVERNOR_GAIN 4
+
+/* Frames over budget before stepping down, frames well under budget before
+ * stepping up and the most that can grow to. A step up holds once it lasted
+ * HWC2_GOVERNOR_SETTLE_FRAMES. */
+#define HWC2_GOVERNOR_DOWN_FRAMES 4
+#define HWC2_GOVERNOR_UP_FRAMES 120
+#define HWC2_GOVERNOR_MAX_UP_FRAMES 1920
+#define HWC2_GOVERNOR_SETTLE_FRAMES 60
+
+static const char *tier_names[HWC2_QUALITY_CNT] = {
+    "full",
+    "nearest scaling",
+    "client scaled",
+    "client all",
+};
+
+/* Displays that never scale a frame have no use for nearest scaling and
+ * skip that tier */
+hwc2_governor::hwc2_governor(bool scaling)
+    : scaling(scaling),
+      tier(HWC2_QUALITY_FULL),
+      average(0),
+      over_frames(0),
+      under_frames(0),
+      tier_frames(0),
+      stepped_up(false),
+      up_frames(HWC2_GOVERNOR_UP_FRAMES) { }
+
+const char *hwc2_governor::get_tier_name() const
+{
+    return tier_names[tier];
+}
+
+/* Takes the time a full composition took, returns whether the tier changed.
+ * The average starts over at every change since the cost of the new tier
+ * has nothing to do with the old one. */
+bool hwc2_governor::add_compose_time(nsecs_t duration, int64_t budget)
+{
+    if (budget <= 0)
+        return false;
+
+    average = average? average + (duration - average) / HWC2_GOVERNOR_GAIN:
+            duration;
+
+    if (stepped_up && ++tier_frames >= HWC2_GOVERNOR_SETTLE_FRAMES) {
+        stepped_up = false;
+        up_frames = HWC2_GOVERNOR_UP_FRAMES;
+    }
+
+    if (average * 10 > budget * HWC2_GOVERNOR_HIGH) {
+        under_frames = 0;
+        if (++over_frames < HWC2_GOVERNOR_DOWN_FRAMES
+                || tier == HWC2_QUALITY_CNT - 1)
+            return false;
+
+        if (stepped_up)
+            up_frames = std::min(up_frames * 2,
+                    static_cast<uint32_t>(HWC2_GOVERNOR_MAX_UP_FRAMES));
+        tier = static_cast<hwc2_quality_tier>(tier + 1);
+        if (tier == HWC2_QUALITY_NEAREST_SCALING && !scaling)
+            tier = HWC2_QUALITY_CLIENT_SCALED;
+        stepped_up = false;
+    } else if (average * 10 < budget * HWC2_GOVERNOR_LOW) {
+        over_frames = 0;
+        if (++under_frames < up_frames || tier == HWC2_QUALITY_FULL)
+            return false;
+
+        tier = static_cast<hwc2_quality_tier>(tier - 1);
+        if (tier == HWC2_QUALITY_NEAREST_SCALING && !scaling)
+            tier = HWC2_QUALITY_FULL;
+        stepped_up = true;
+    } else {
+        over_frames = 0;
+        under_frames = 0;
+        return false;
+    }
+
+    average = 0;
+    over_frames = 0;
+    under_frames = 0;
+    tier_frames = 0;
+    return true;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/log.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "hwc2.h"
+
+hwc2_gralloc &hwc2_gralloc::get_instance()
+{
+    static hwc2_gralloc instance;
+    return instance;
+}
+
+hwc2_gralloc::hwc2_gralloc()
+    : device(nullptr),
+      pfn_get_dimensions(nullptr),
+      pfn_get_format(nullptr),
+      pfn_get_num_flex_planes(nullptr),
+      pfn_get_stride(nullptr),
+      pfn_lock(nullptr),
+      pfn_lock_flex(nullptr),
+      pfn_unlock(nullptr)
+{
+    const hw_module_t *module;
+
+    int ret = hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module);
+    if (ret) {
+        ALOGE("failed to get gralloc module: %s", strerror(-ret));
+        return;
+    }
+
+    ret = gralloc1_open(module, &device);
+    if (ret) {
+        ALOGE("failed to open gralloc1 device: %s", strerror(-ret));
+        device = nullptr;
+        return;
+    }
+
+    pfn_get_dimensions = reinterpret_cast<GRALLOC1_PFN_GET_DIMENSIONS>(
+            device->getFunction(device, GRALLOC1_FUNCTION_GET_DIMENSIONS));
+    pfn_get_format = reinterpret_cast<GRALLOC1_PFN_GET_FORMAT>(
+            device->getFunction(device, GRALLOC1_FUNCTION_GET_FORMAT));
+    pfn_get_num_flex_planes = reinterpret_cast<
+            GRALLOC1_PFN_GET_NUM_FLEX_PLANES>(device->getFunction(device,
+            GRALLOC1_FUNCTION_GET_NUM_FLEX_PLANES));
+    pfn_get_stride = reinterpret_cast<GRALLOC1_PFN_GET_STRIDE>(
+            device->getFunction(device, GRALLOC1_FUNCTION_GET_STRIDE));
+    pfn_lock = reinterpret_cast<GRALLOC1_PFN_LOCK>(
+            device->getFunction(device, GRALLOC1_FUNCTION_LOCK));
+    pfn_lock_flex = reinterpret_cast<GRALLOC1_PFN_LOCK_FLEX>(
+            device->getFunction(device, GRALLOC1_FUNCTION_LOCK_FLEX));
+    pfn_unlock = reinterpret_cast<GRALLOC1_PFN_UNLOCK>(
+            device->getFunction(device, GRALLOC1_FUNCTION_UNLOCK));
+
+    if (!pfn_get_dimensions || !pfn_get_format || !pfn_get_stride
+            || !pfn_lock || !pfn_unlock) {
+        ALOGE("gralloc1 device is missing required functions");
+        gralloc1_close(device);
+        device = nullptr;
+    }
+}
+
+hwc2_gralloc::~hwc2_gralloc()
+{
+    if (device)
+        gralloc1_close(device);
+}
+
+int32_t hwc2_gralloc::get_format(buffer_handle_t handle) const
+{
+    int32_t format;
+
+    if (!device || !handle)
+        return -1;
+
+    if (pfn_get_format(device, handle, &format) != GRALLOC1_ERROR_NONE)
+        return -1;
+
+    return format;
+}
+
+int hwc2_gralloc::get_dimensions(buffer_handle_t handle, uint32_t *out_width,
+        uint32_t *out_height) const
+{
+    if (!device || !handle)
+        return -EINVAL;
+
+    if (pfn_get_dimensions(device, handle, out_width, out_height)
+            != GRALLOC1_ERROR_NONE)
+        return -EINVAL;
+
+    return 0;
+}
+
+/* Buffers locked for writing are composition targets, which are read back
+ * for blending as well */
+int hwc2_gralloc::lock(buffer_handle_t handle, hwc2_surface *out_surface,
+        bool write) const
+{
+    uint32_t width, height, stride;
+    int32_t format;
+    void *data;
+
+    if (!device || !handle)
+        return -EINVAL;
+
+    if (pfn_get_dimensions(device, handle, &width, &height) != GRALLOC1_ERROR_NONE
+            || pfn_get_format(device, handle, &format) != GRALLOC1_ERROR_NONE) {
+        ALOGE("failed to query buffer %p", handle);
+        return -EINVAL;
+    }
+
+    if (hwc2_compositor::is_yuv_format(format) && !write)
+        return lock_ycbcr(handle, width, height, out_surface);
+
+    if (pfn_get_stride(device, handle, &stride) != GRALLOC1_ERROR_NONE) {
+        ALOGE("failed to query buffer %p", handle);
+        return -EINVAL;
+    }
+
+    uint32_t bpp = hwc2_compositor::get_bpp(format);
+    if (!bpp) {
+        ALOGE("buffer %p: unsupported format %d", handle, format);
+        return -EINVAL;
+    }
+
+    gralloc1_rect_t rect = {0, 0, static_cast<int32_t>(width),
+            static_cast<int32_t>(height)};
+    uint64_t producer_usage = write? GRALLOC1_PRODUCER_USAGE_CPU_READ_OFTEN
+            | GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN:
+            GRALLOC1_PRODUCER_USAGE_NONE;
+    uint64_t consumer_usage = write? GRALLOC1_CONSUMER_USAGE_NONE:
+            GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN;
+    if (pfn_lock(device, handle, producer_usage, consumer_usage, &rect, &data,
+            -1) != GRALLOC1_ERROR_NONE) {
+        ALOGE("failed to lock buffer %p", handle);
+        return -EIO;
+    }
+
+    out_surface->data = static_cast<uint8_t *>(data);
+    out_surface->width = width;
+    out_surface->height = height;
+    out_surface->stride = stride * bpp;
+    out_surface->format = format;
+    out_surface->cb = nullptr;
+    out_surface->cr = nullptr;
+    out_surface->chroma_stride = 0;
+    out_surface->chroma_step = 0;
+
+    return 0;
+}
+
+/* YUV buffers are mapped through lockFlex so that NV12, NV21 and the planar
+ * layouts all come back described the same way. Only 8 bit 4:2:0 layouts
+ * with tightly packed luma are accepted. The plane descriptions are written
+ * to an array the caller provides, sized for the buffer. */
+int hwc2_gralloc::lock_ycbcr(buffer_handle_t handle, uint32_t width,
+        uint32_t height, hwc2_surface *out_surface) const
+{
+    const android_flex_plane_t *y = nullptr, *cb = nullptr, *cr = nullptr;
+    uint32_t num_planes;
+
+    if (!pfn_get_num_flex_planes || !pfn_lock_flex) {
+        ALOGE("buffer %p: gralloc1 device cannot lock YUV buffers", handle);
+        return -EINVAL;
+    }
+
+    if (pfn_get_num_flex_planes(device, handle, &num_planes)
+            != GRALLOC1_ERROR_NONE) {
+        ALOGE("failed to query buffer %p", handle);
+        return -EINVAL;
+    }
+
+    std::vector<android_flex_plane_t> planes(num_planes);
+    struct android_flex_layout layout = {};
+    layout.num_planes = num_planes;
+    layout.planes = planes.data();
+
+    gralloc1_rect_t rect = {0, 0, static_cast<int32_t>(width),
+            static_cast<int32_t>(height)};
+    if (pfn_lock_flex(device, handle, GRALLOC1_PRODUCER_USAGE_NONE,
+            GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN, &rect, &layout, -1)
+            != GRALLOC1_ERROR_NONE) {
+        ALOGE("failed to lock buffer %p", handle);
+        return -EIO;
+    }
+
+    for (uint32_t idx = 0; idx < layout.num_planes && idx < num_planes;
+            idx++) {
+        const android_flex_plane_t &plane = layout.planes[idx];
+        if (plane.component == FLEX_COMPONENT_Y)
+            y = &plane;
+        else if (plane.component == FLEX_COMPONENT_Cb)
+            cb = &plane;
+        else if (plane.component == FLEX_COMPONENT_Cr)
+            cr = &plane;
+    }
+
+    if (layout.format != FLEX_FORMAT_YCbCr || !y || !cb || !cr
+            || y->bits_per_component != 8 || y->h_increment != 1
+            || cb->h_subsampling != 2 || cb->v_subsampling != 2
+            || cb->h_increment != cr->h_increment
+            || cb->v_increment != cr->v_increment) {
+        ALOGE("buffer %p: unsupported YUV layout", handle);
+        unlock(handle);
+        return -EINVAL;
+    }
+
+    out_surface->data = y->top_left;
+    out_surface->width = width;
+    out_surface->height = height;
+    out_surface->stride = y->v_increment;
+    out_surface->format = HAL_PIXEL_FORMAT_YCbCr_420_888;
+    out_surface->cb = cb->top_left;
+    out_surface->cr = cr->top_left;
+    out_surface->chroma_stride = cb->v_increment;
+    out_surface->chroma_step = cb->h_increment;
+
+    return 0;
+}
+
+void hwc2_gralloc::unlock(buffer_handle_t handle) const
+{
+    int32_t release_fence = -1;
+
+    if (!device || !handle)
+        return;
+
+    if (pfn_unlock(device, handle, &release_fence) != GRALLOC1_ERROR_NONE)
+        ALOGW("failed to unlock buffer %p", handle);
+
+    if (release_fence >= 0)
+        close(release_fence);
+}
@@ -21,10 +21,54 @@
 
 uint64_t hwc2_layer::layer_cnt = 0;
 
+/* Longest pause between buffers that still counts as the same playback */
+#define HWC2_CADENCE_MAX_GAP 100000000
+
 hwc2_layer::hwc2_layer(hwc2_layer_t id)
     : id(id),
       buffer(),
-      comp_type(HWC2_COMPOSITION_INVALID) { }
+      comp_type(HWC2_COMPOSITION_INVALID),
+      update_times(),
+      update_cnt(0),
+      comp_region(),
+      type_changed(true) { }
+
+/* Whether the CPU compositor is able to draw this layer itself */
+bool hwc2_layer::is_device_supported() const
+{
+    if (comp_type == HWC2_COMPOSITION_SOLID_COLOR)
+        return true;
+
+    if (buffer.get_transform())
+        return false;
+
+    int32_t format = hwc2_gralloc::get_instance().get_format(
+            buffer.get_buffer_handle());
+
+    return hwc2_compositor::is_supported_format(format);
+}
+
+bool hwc2_layer::is_opaque() const
+{
+    if (comp_type == HWC2_COMPOSITION_SOLID_COLOR
+            && buffer.get_color().a == 255
+            && buffer.get_plane_alpha() >= 1.0f)
+        return true;
+
+    if (buffer.is_opaque())
+        return true;
+
+    /* Formats without alpha cover whatever is below them in any blend mode */
+    if (comp_type == HWC2_COMPOSITION_SOLID_COLOR
+            || buffer.get_plane_alpha() < 1.0f)
+        return false;
+
+    int32_t format = hwc2_gralloc::get_instance().get_format(
+            buffer.get_buffer_handle());
+
+    return hwc2_compositor::is_supported_format(format)
+            && !hwc2_compositor::has_alpha(format);
+}
 
 hwc2_error_t hwc2_layer::set_comp_type(hwc2_composition_t comp_type)
 {
@@ -47,15 +91,109 @@ hwc2_error_t hwc2_layer::set_comp_type(hwc2_composition_t comp_type)
         ret = HWC2_ERROR_BAD_PARAMETER;
     }
 
+    if (comp_type != this->comp_type)
+        type_changed = true;
+
     this->comp_type = comp_type;
     return ret;
 }
 
+bool hwc2_layer::is_changed() const
+{
+    return type_changed || buffer.is_geometry_changed()
+            || buffer.is_content_changed();
+}
+
+void hwc2_layer::clear_changed()
+{
+    type_changed = false;
+    buffer.clear_changed();
+}
+
+/* A new handle is a new frame, a pause longer than HWC2_CADENCE_MAX_GAP
+ * starts the measurement over */
+hwc2_error_t hwc2_layer::set_buffer(buffer_handle_t handle,
+        int32_t acquire_fence)
+{
+    if (handle && handle != buffer.get_buffer_handle()) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t last = update_times[(update_cnt + HWC2_CADENCE_WINDOW - 1)
+                % HWC2_CADENCE_WINDOW];
+        if (update_cnt && now - last > HWC2_CADENCE_MAX_GAP)
+            update_cnt = 0;
+
+        update_times[update_cnt % HWC2_CADENCE_WINDOW] = now;
+        update_cnt++;
+    }
+
+    return buffer.set_buffer(handle, acquire_fence);
+}
+
+/* Mean time between the recent buffer updates, 0 while the layer has not
+ * been updating steadily for a whole window */
+nsecs_t hwc2_layer::get_update_interval(nsecs_t now) const
+{
+    if (update_cnt < HWC2_CADENCE_WINDOW)
+        return 0;
+
+    nsecs_t newest = update_times[(update_cnt - 1) % HWC2_CADENCE_WINDOW];
+    nsecs_t oldest = update_times[update_cnt % HWC2_CADENCE_WINDOW];
+    if (now - newest > HWC2_CADENCE_MAX_GAP)
+        return 0;
+
+    return (newest - oldest) / (HWC2_CADENCE_WINDOW - 1);
+}
+
 hwc2_error_t hwc2_layer::set_blend_mode(hwc2_blend_mode_t blend_mode)
 {
     return buffer.set_blend_mode(blend_mode);
 }
 
+hwc2_error_t hwc2_layer::set_display_frame(const hwc_rect_t &display_frame)
+{
+    return buffer.set_display_frame(display_frame);
+}
+
+hwc2_error_t hwc2_layer::set_source_crop(const hwc_frect_t &source_crop)
+{
+    return buffer.set_source_crop(source_crop);
+}
+
+hwc2_error_t hwc2_layer::set_plane_alpha(float plane_alpha)
+{
+    return buffer.set_plane_alpha(plane_alpha);
+}
+
+hwc2_error_t hwc2_layer::set_z_order(uint32_t z_order)
+{
+    return buffer.set_z_order(z_order);
+}
+
+hwc2_error_t hwc2_layer::set_transform(hwc_transform_t transform)
+{
+    return buffer.set_transform(transform);
+}
+
+hwc2_error_t hwc2_layer::set_dataspace(android_dataspace_t dataspace)
+{
+    return buffer.set_dataspace(dataspace);
+}
+
+hwc2_error_t hwc2_layer::set_color(const hwc_color_t &color)
+{
+    return buffer.set_color(color);
+}
+
+hwc2_error_t hwc2_layer::set_visible_region(const hwc_region_t &visible_region)
+{
+    return buffer.set_visible_region(visible_region);
+}
+
+hwc2_error_t hwc2_layer::set_surface_damage(const hwc_region_t &surface_damage)
+{
+    return buffer.set_surface_damage(surface_damage);
+}
+
 hwc2_layer_t hwc2_layer::get_next_id()
 {
     return layer_cnt++;
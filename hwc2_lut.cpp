@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cutils/log.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hwc2.h"
+
+#define HWC2_LUT_MIN_SIZE 2
+#define HWC2_LUT_MAX_SIZE 65
+
+/* Table entries hold 8 bit outputs with 4 extra bits of precision, vertex
+ * weights sum up to 256 */
+#define HWC2_LUT_ENTRY_SHIFT 4
+#define HWC2_LUT_WEIGHT_SHIFT 8
+
+hwc2_lut::hwc2_lut()
+    : size(0),
+      table(),
+      index(),
+      weight() { }
+
+/*
+ * Reads a LUT in the .cube text format: a LUT_3D_SIZE line followed by
+ * size^3 "r g b" lines with red changing fastest. Only the default 0.0 - 1.0
+ * domain is accepted.
+ */
+int hwc2_lut::load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return -errno;
+
+    char line[256];
+    uint32_t lut_size = 0, cnt = 0;
+    std::vector<uint16_t> entries;
+    int ret = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        float r, g, b;
+
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r'
+                || !strncmp(line, "TITLE", 5))
+            continue;
+
+        if (!strncmp(line, "LUT_3D_SIZE", 11)) {
+            if (sscanf(line + 11, "%u", &lut_size) != 1
+                    || lut_size < HWC2_LUT_MIN_SIZE
+                    || lut_size > HWC2_LUT_MAX_SIZE) {
+                ret = -EINVAL;
+                break;
+            }
+            entries.resize(lut_size * lut_size * lut_size * 4);
+            continue;
+        }
+
+        if (!strncmp(line, "DOMAIN_MIN", 10)) {
+            if (sscanf(line + 10, "%f %f %f", &r, &g, &b) != 3
+                    || r != 0.0f || g != 0.0f || b != 0.0f) {
+                ret = -EINVAL;
+                break;
+            }
+            continue;
+        }
+
+        if (!strncmp(line, "DOMAIN_MAX", 10)) {
+            if (sscanf(line + 10, "%f %f %f", &r, &g, &b) != 3
+                    || r != 1.0f || g != 1.0f || b != 1.0f) {
+                ret = -EINVAL;
+                break;
+            }
+            continue;
+        }
+
+        if (sscanf(line, "%f %f %f", &r, &g, &b) != 3
+                || !lut_size || cnt >= entries.size() / 4) {
+            ret = -EINVAL;
+            break;
+        }
+
+        float max = 255 << HWC2_LUT_ENTRY_SHIFT;
+        entries[cnt * 4] = std::min(std::max(r, 0.0f), 1.0f) * max + 0.5f;
+        entries[cnt * 4 + 1] = std::min(std::max(g, 0.0f), 1.0f) * max + 0.5f;
+        entries[cnt * 4 + 2] = std::min(std::max(b, 0.0f), 1.0f) * max + 0.5f;
+        entries[cnt * 4 + 3] = 0;
+        cnt++;
+    }
+
+    fclose(file);
+
+    if (!ret && (!lut_size || cnt != entries.size() / 4))
+        ret = -EINVAL;
+    if (ret)
+        return ret;
+
+    size = lut_size;
+    table.swap(entries);
+
+    /* Grid cell and position inside of it for every 8 bit input */
+    for (uint32_t val = 0; val < 256; val++) {
+        uint32_t pos = (val * (size - 1) << HWC2_LUT_WEIGHT_SHIFT) / 255;
+        uint32_t cell = std::min(pos >> HWC2_LUT_WEIGHT_SHIFT, size - 2);
+        index[val] = cell;
+        weight[val] = pos - (cell << HWC2_LUT_WEIGHT_SHIFT);
+    }
+
+    return 0;
+}
+
+/* Weighted sum of the four vertices of a tetrahedron, done for all three
+ * channels at once */
+static inline uint32_t blend_vertices(const uint16_t *v0, const uint16_t *v1,
+        const uint16_t *v2, const uint16_t *v3, uint32_t w0, uint32_t w1,
+        uint32_t w2, uint32_t w3)
+{
+    const uint32_t shift = HWC2_LUT_ENTRY_SHIFT + HWC2_LUT_WEIGHT_SHIFT;
+    const uint32_t round = 1 << (shift - 1);
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint32x4_t acc = vmull_n_u16(vld1_u16(v0), w0);
+    acc = vmlal_n_u16(acc, vld1_u16(v1), w1);
+    acc = vmlal_n_u16(acc, vld1_u16(v2), w2);
+    acc = vmlal_n_u16(acc, vld1_u16(v3), w3);
+    uint16x4_t res = vrshrn_n_u32(acc, shift);
+    return vget_lane_u16(res, 0) | (vget_lane_u16(res, 1) << 8)
+            | (vget_lane_u16(res, 2) << 16);
+#elif defined(__SSE2__)
+    /* Interleave two vertices per register so that madd sums their products */
+    __m128i v01 = _mm_unpacklo_epi16(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(v0)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(v1)));
+    __m128i v23 = _mm_unpacklo_epi16(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(v2)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(v3)));
+    __m128i acc = _mm_add_epi32(
+            _mm_madd_epi16(v01, _mm_set1_epi32(w0 | (w1 << 16))),
+            _mm_madd_epi16(v23, _mm_set1_epi32(w2 | (w3 << 16))));
+    acc = _mm_srli_epi32(_mm_add_epi32(acc, _mm_set1_epi32(round)), shift);
+    acc = _mm_packs_epi32(acc, acc);
+    acc = _mm_packus_epi16(acc, acc);
+    return _mm_cvtsi128_si32(acc) & 0x00ffffff;
+#else
+    uint32_t res = 0;
+    for (int c = 0; c < 3; c++)
+        res |= ((v0[c] * w0 + v1[c] * w1 + v2[c] * w2 + v3[c] * w3 + round)
+                >> shift) << (c * 8);
+    return res;
+#endif
+}
+
+/*
+ * Maps canonical pixels through the LUT using tetrahedral interpolation,
+ * alpha is left alone. The cube around the input is split into six
+ * tetrahedra along its main diagonal and the one holding the input is picked
+ * by the order of the fractional positions. Flat UI content repeats the same
+ * color a lot, so the last result is reused for runs of equal pixels.
+ */
+void hwc2_lut::map_row(uint32_t *row, size_t cnt) const
+{
+    const uint32_t full = 1 << HWC2_LUT_WEIGHT_SHIFT;
+    const size_t stride_g = size * 4, stride_b = size * size * 4;
+    /* Never matches since the alpha byte is masked off the inputs */
+    uint32_t last_in = 0xffffffff, last_out = 0;
+
+    if (table.empty())
+        return;
+
+    for (size_t x = 0; x < cnt; x++) {
+        uint32_t in = row[x];
+        if ((in & 0x00ffffff) == last_in) {
+            row[x] = last_out | (in & 0xff000000);
+            continue;
+        }
+
+        uint32_t r = in & 0xff, g = (in >> 8) & 0xff, b = (in >> 16) & 0xff;
+        uint32_t fr = weight[r], fg = weight[g], fb = weight[b];
+        const uint16_t *c000 = &table[index[b] * stride_b + index[g] * stride_g
+                + index[r] * 4];
+        const uint16_t *c111 = c000 + stride_b + stride_g + 4;
+        uint32_t out;
+
+        if (fr >= fg) {
+            if (fg >= fb)
+                out = blend_vertices(c000, c000 + 4, c000 + 4 + stride_g, c111,
+                        full - fr, fr - fg, fg - fb, fb);
+            else if (fr >= fb)
+                out = blend_vertices(c000, c000 + 4, c000 + 4 + stride_b, c111,
+                        full - fr, fr - fb, fb - fg, fg);
+            else
+                out = blend_vertices(c000, c000 + stride_b, c000 + 4 + stride_b,
+                        c111, full - fb, fb - fr, fr - fg, fg);
+        } else {
+            if (fb >= fg)
+                out = blend_vertices(c000, c000 + stride_b,
+                        c000 + stride_g + stride_b, c111,
+                        full - fb, fb - fg, fg - fr, fr);
+            else if (fb >= fr)
+                out = blend_vertices(c000, c000 + stride_g,
+                        c000 + stride_g + stride_b, c111,
+                        full - fg, fg - fb, fb - fr, fr);
+            else
+                out = blend_vertices(c000, c000 + stride_g, c000 + 4 + stride_g,
+                        c111, full - fg, fg - fr, fr - fb, fb);
+        }
+
+        last_in = in & 0x00ffffff;
+        last_out = out;
+        row[x] = out | (in & 0xff000000);
+    }
+}
+
+uint32_t hwc2_lut::map_pixel(uint32_t pixel) const
+{
+    map_row(&pixel, 1);
+    return pixel;
+}
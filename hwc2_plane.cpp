@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include "hwc2.h"
+
+hwc2_plane::hwc2_plane(uint32_t id, bool above, uint32_t caps)
+    : id(id),
+      above(above),
+      rgb(caps & HWC2_PLANE_CAP_RGB),
+      yuv(caps & HWC2_PLANE_CAP_YUV),
+      scaling(caps & HWC2_PLANE_CAP_SCALING),
+      blending(caps & HWC2_PLANE_CAP_BLENDING),
+      cursor(caps & HWC2_PLANE_CAP_CURSOR) { }
+
+/* Planes scan buffers out as they are, so layers that need a transform or a
+ * format conversion the plane cannot do stay with the compositor */
+bool hwc2_plane::can_show(const hwc2_layer &lyr) const
+{
+    const hwc2_buffer &buffer = lyr.get_buffer();
+    hwc2_composition_t type = lyr.get_comp_type();
+
+    if (type != HWC2_COMPOSITION_DEVICE && type != HWC2_COMPOSITION_CURSOR)
+        return false;
+    if ((cursor && type != HWC2_COMPOSITION_CURSOR)
+            || !buffer.get_buffer_handle() || buffer.get_transform())
+        return false;
+
+    int32_t format = hwc2_gralloc::get_instance().get_format(
+            buffer.get_buffer_handle());
+    if (hwc2_compositor::is_yuv_format(format)? !yuv:
+            !rgb || !hwc2_compositor::is_supported_format(format))
+        return false;
+
+    const hwc_frect_t &crop = buffer.get_source_crop();
+    const hwc_rect_t &frame = buffer.get_display_frame();
+    if (!scaling && (crop.right - crop.left != frame.right - frame.left
+            || crop.bottom - crop.top != frame.bottom - frame.top))
+        return false;
+
+    return blending || lyr.is_opaque();
+}
+
+void hwc2_plane::dump(std::string *out) const
+{
+    char line[96];
+
+    snprintf(line, sizeof(line), "    plane %u: %s%s%s%s%s%s", id,
+            above? "above": "below", rgb? ", rgb": "", yuv? ", yuv": "",
+            scaling? ", scaling": "", blending? ", blending": "",
+            cursor? ", cursor": "");
+    out->append(line);
+}
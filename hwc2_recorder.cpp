@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/log.h>
+#include <errno.h>
+#include <string.h>
+#include <sync/sync.h>
+
+#include "hwc2.h"
+
+/* Longest a sampled buffer is waited for */
+#define HWC2_RECORD_FENCE_TIMEOUT_MS 100
+
+hwc2_recorder::hwc2_recorder()
+    : mutex(),
+      file(nullptr),
+      sample_rate(0),
+      sample_cnt(0),
+      buffers(),
+      pixels() { }
+
+hwc2_recorder::~hwc2_recorder()
+{
+    if (file)
+        fclose(file);
+}
+
+int hwc2_recorder::open(const char *path, uint32_t sample_rate)
+{
+    file = fopen(path, "w");
+    if (!file)
+        return -errno;
+
+    hwc2_record_header header = {HWC2_RECORD_MAGIC, HWC2_RECORD_VERSION};
+    fwrite(&header, sizeof(header), 1, file);
+    this->sample_rate = sample_rate;
+
+    ALOGI("recording HAL calls to %s", path);
+    return 0;
+}
+
+void hwc2_recorder::write_record(int32_t type,
+        std::initializer_list<uint64_t> words, const void *blob,
+        size_t blob_size)
+{
+    hwc2_record rec;
+    rec.size = sizeof(rec) + words.size() * sizeof(uint64_t) + blob_size;
+    rec.type = type;
+    rec.word_cnt = words.size();
+    rec.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    fwrite(&rec, sizeof(rec), 1, file);
+    fwrite(words.begin(), sizeof(uint64_t), words.size(), file);
+    if (blob_size)
+        fwrite(blob, blob_size, 1, file);
+}
+
+/* Buffers are described the first time they show up or when they change
+ * size. Sampled RGB buffers come with their pixels, YUV ones never do. */
+void hwc2_recorder::write_buffer(buffer_handle_t handle,
+        int32_t acquire_fence, bool sample)
+{
+    const hwc2_gralloc &gralloc = hwc2_gralloc::get_instance();
+    uint32_t width, height;
+
+    int32_t format = gralloc.get_format(handle);
+    if (format < 0 || gralloc.get_dimensions(handle, &width, &height) < 0)
+        return;
+
+    std::array<uint32_t, 3> desc = {{width, height,
+            static_cast<uint32_t>(format)}};
+    bool described;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = buffers.find(handle);
+        described = it != buffers.end() && it->second == desc;
+        buffers[handle] = desc;
+
+        sample = sample && sample_rate && sample_cnt++ % sample_rate == 0
+                && hwc2_compositor::get_bpp(format);
+    }
+
+    if (!sample) {
+        if (!described)
+            record(HWC2_RECORD_BUFFER, {reinterpret_cast<uintptr_t>(handle),
+                    width, height, static_cast<uint32_t>(format), 0});
+        return;
+    }
+
+    hwc2_surface src;
+    if (acquire_fence >= 0)
+        sync_wait(acquire_fence, HWC2_RECORD_FENCE_TIMEOUT_MS);
+    if (gralloc.lock(handle, &src) < 0)
+        return;
+
+    uint32_t row_size = src.width * hwc2_compositor::get_bpp(src.format);
+    pixels.resize(row_size * src.height);
+    for (uint32_t y = 0; y < src.height; y++)
+        memcpy(&pixels[y * row_size], src.data + y * src.stride, row_size);
+
+    gralloc.unlock(handle);
+
+    record(HWC2_RECORD_BUFFER, {reinterpret_cast<uintptr_t>(handle), width,
+            height, static_cast<uint32_t>(format), row_size}, pixels.data(),
+            pixels.size());
+}
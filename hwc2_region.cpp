@@ -0,0 +1,465 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include "hwc2.h"
+
+static bool rect_empty(const hwc_rect_t &rect)
+{
+    return rect.left >= rect.right || rect.top >= rect.bottom;
+}
+
+hwc2_region::hwc2_region()
+    : rects(local),
+      cnt(0),
+      cap(inline_rects),
+      heap(),
+      bounds({0, 0, 0, 0}) { }
+
+hwc2_region::hwc2_region(const hwc_rect_t &rect)
+    : hwc2_region()
+{
+    set(rect);
+}
+
+hwc2_region::hwc2_region(const hwc_region_t &region)
+    : hwc2_region()
+{
+    set(region);
+}
+
+hwc2_region::hwc2_region(const hwc2_region &other)
+    : hwc2_region()
+{
+    *this = other;
+}
+
+hwc2_region &hwc2_region::operator=(const hwc2_region &other)
+{
+    if (this == &other)
+        return *this;
+
+    reserve(other.cnt, false);
+    memcpy(rects, other.rects, other.cnt * sizeof(*rects));
+    cnt = other.cnt;
+    bounds = other.bounds;
+    return *this;
+}
+
+bool hwc2_region::operator==(const hwc2_region &other) const
+{
+    if (cnt != other.cnt)
+        return false;
+
+    for (size_t idx = 0; idx < cnt; idx++)
+        if (rects[idx].left != other.rects[idx].left
+                || rects[idx].top != other.rects[idx].top
+                || rects[idx].right != other.rects[idx].right
+                || rects[idx].bottom != other.rects[idx].bottom)
+            return false;
+
+    return true;
+}
+
+void hwc2_region::clear()
+{
+    cnt = 0;
+    bounds = {0, 0, 0, 0};
+}
+
+void hwc2_region::set(const hwc_rect_t &rect)
+{
+    clear();
+    if (rect_empty(rect))
+        return;
+
+    rects[0] = rect;
+    cnt = 1;
+    bounds = rect;
+}
+
+void hwc2_region::set(const hwc_region_t &region)
+{
+    clear();
+
+    /* SurfaceFlinger hands over its own banded regions, so in the common case
+     * the rects can be taken as they are */
+    if (is_banded(region)) {
+        reserve(region.numRects, false);
+        for (size_t idx = 0; idx < region.numRects; idx++)
+            if (!rect_empty(region.rects[idx]))
+                rects[cnt++] = region.rects[idx];
+        update_bounds();
+        return;
+    }
+
+    /* Anything else is merged pairwise so that the cost stays at
+     * O(n log n) sweeps instead of one growing sweep per rect */
+    std::vector<hwc2_region> parts;
+    parts.reserve(region.numRects);
+    for (size_t idx = 0; idx < region.numRects; idx++)
+        if (!rect_empty(region.rects[idx]))
+            parts.emplace_back(region.rects[idx]);
+
+    for (size_t step = 1; step < parts.size(); step *= 2)
+        for (size_t idx = 0; idx + step < parts.size(); idx += step * 2)
+            parts[idx].unite(parts[idx + step]);
+
+    if (!parts.empty())
+        *this = parts[0];
+}
+
+hwc_region_t hwc2_region::get_hwc_region() const
+{
+    return {cnt, rects};
+}
+
+uint64_t hwc2_region::get_area() const
+{
+    uint64_t area = 0;
+
+    for (size_t idx = 0; idx < cnt; idx++)
+        area += static_cast<uint64_t>(rects[idx].right - rects[idx].left)
+                * (rects[idx].bottom - rects[idx].top);
+
+    return area;
+}
+
+bool hwc2_region::contains(const hwc_rect_t &rect) const
+{
+    if (rect_empty(rect))
+        return true;
+    if (rect.left < bounds.left || rect.top < bounds.top
+            || rect.right > bounds.right || rect.bottom > bounds.bottom)
+        return false;
+
+    /* Walk the bands overlapping rect and make sure each one has a single
+     * span covering it horizontally and that there are no vertical gaps */
+    int32_t y = rect.top;
+    for (size_t idx = 0; idx < cnt && y < rect.bottom; idx++) {
+        const hwc_rect_t &cur = rects[idx];
+        if (cur.bottom <= y)
+            continue;
+        if (cur.top > y)
+            return false;
+        if (cur.left <= rect.left && cur.right >= rect.right)
+            y = cur.bottom;
+    }
+
+    return y >= rect.bottom;
+}
+
+bool hwc2_region::intersects(const hwc_rect_t &rect) const
+{
+    if (rect_empty(rect) || rect.left >= bounds.right
+            || rect.right <= bounds.left || rect.top >= bounds.bottom
+            || rect.bottom <= bounds.top)
+        return false;
+
+    for (size_t idx = 0; idx < cnt; idx++) {
+        const hwc_rect_t &cur = rects[idx];
+        if (cur.top >= rect.bottom)
+            break;
+        if (cur.bottom > rect.top && cur.left < rect.right
+                && cur.right > rect.left)
+            return true;
+    }
+
+    return false;
+}
+
+hwc2_region &hwc2_region::translate(int32_t dx, int32_t dy)
+{
+    for (size_t idx = 0; idx < cnt; idx++) {
+        rects[idx].left += dx;
+        rects[idx].right += dx;
+        rects[idx].top += dy;
+        rects[idx].bottom += dy;
+    }
+
+    if (cnt) {
+        bounds.left += dx;
+        bounds.right += dx;
+        bounds.top += dy;
+        bounds.bottom += dy;
+    }
+
+    return *this;
+}
+
+hwc2_region &hwc2_region::unite(const hwc2_region &other)
+{
+    if (other.empty())
+        return *this;
+    if (empty())
+        return *this = other;
+
+    /* Appending a region that lies entirely below this one does not need the
+     * band sweep, which keeps building regions top to bottom linear */
+    if (other.bounds.top >= bounds.bottom) {
+        size_t old_cnt = cnt;
+        reserve(cnt + other.cnt, true);
+        memcpy(rects + cnt, other.rects, other.cnt * sizeof(*rects));
+        cnt += other.cnt;
+        coalesce_band(old_cnt);
+        update_bounds();
+        return *this;
+    }
+
+    return apply(other, op_union);
+}
+
+hwc2_region &hwc2_region::intersect(const hwc2_region &other)
+{
+    if (empty() || other.empty() || other.bounds.left >= bounds.right
+            || other.bounds.right <= bounds.left
+            || other.bounds.top >= bounds.bottom
+            || other.bounds.bottom <= bounds.top) {
+        clear();
+        return *this;
+    }
+
+    /* Intersecting with a single rect that covers everything is a no-op */
+    if (other.cnt == 1 && other.contains(bounds))
+        return *this;
+
+    return apply(other, op_intersect);
+}
+
+hwc2_region &hwc2_region::subtract(const hwc2_region &other)
+{
+    if (empty() || other.empty() || other.bounds.left >= bounds.right
+            || other.bounds.right <= bounds.left
+            || other.bounds.top >= bounds.bottom
+            || other.bounds.bottom <= bounds.top)
+        return *this;
+
+    if (other.cnt == 1 && other.contains(bounds)) {
+        clear();
+        return *this;
+    }
+
+    return apply(other, op_subtract);
+}
+
+void hwc2_region::reserve(size_t size, bool keep)
+{
+    if (size <= cap)
+        return;
+
+    size_t new_cap = std::max(size, cap * 2);
+    std::vector<hwc_rect_t> new_heap(new_cap);
+    if (keep)
+        memcpy(new_heap.data(), rects, cnt * sizeof(*rects));
+
+    heap.swap(new_heap);
+    rects = heap.data();
+    cap = new_cap;
+}
+
+void hwc2_region::update_bounds()
+{
+    if (!cnt) {
+        bounds = {0, 0, 0, 0};
+        return;
+    }
+
+    bounds.top = rects[0].top;
+    bounds.bottom = rects[cnt - 1].bottom;
+    bounds.left = INT_MAX;
+    bounds.right = INT_MIN;
+    for (size_t idx = 0; idx < cnt; idx++) {
+        bounds.left = std::min(bounds.left, rects[idx].left);
+        bounds.right = std::max(bounds.right, rects[idx].right);
+    }
+}
+
+/* Merges the band starting at band_start into the band right above it when
+ * both touch vertically and have identical spans */
+void hwc2_region::coalesce_band(size_t band_start)
+{
+    if (!band_start || band_start >= cnt)
+        return;
+
+    size_t prev_start = band_start - 1;
+    while (prev_start > 0 && rects[prev_start - 1].top == rects[band_start - 1].top)
+        prev_start--;
+
+    size_t prev_cnt = band_start - prev_start;
+    size_t band_end = band_start;
+    while (band_end < cnt && rects[band_end].top == rects[band_start].top)
+        band_end++;
+
+    if (band_end - band_start != prev_cnt
+            || rects[prev_start].bottom != rects[band_start].top)
+        return;
+
+    for (size_t idx = 0; idx < prev_cnt; idx++)
+        if (rects[prev_start + idx].left != rects[band_start + idx].left
+                || rects[prev_start + idx].right != rects[band_start + idx].right)
+            return;
+
+    int32_t bottom = rects[band_start].bottom;
+    for (size_t idx = prev_start; idx < band_start; idx++)
+        rects[idx].bottom = bottom;
+
+    memmove(rects + band_start, rects + band_end,
+            (cnt - band_end) * sizeof(*rects));
+    cnt -= prev_cnt;
+}
+
+/* Applies a one dimensional boolean operation to two sorted span lists and
+ * appends the resulting spans as [top, bottom) rects */
+void hwc2_region::append_spans(const hwc_rect_t *a, size_t a_cnt,
+        const hwc_rect_t *b, size_t b_cnt, int32_t top, int32_t bottom,
+        region_op op)
+{
+    reserve(cnt + a_cnt + b_cnt, true);
+
+    auto push = [&](int32_t left, int32_t right) {
+        if (left >= right)
+            return;
+        if (cnt && rects[cnt - 1].top == top && rects[cnt - 1].right >= left) {
+            rects[cnt - 1].right = std::max(rects[cnt - 1].right, right);
+            return;
+        }
+        rects[cnt++] = {left, top, right, bottom};
+    };
+
+    size_t ia = 0, ib = 0;
+
+    switch (op) {
+    case op_union:
+        while (ia < a_cnt || ib < b_cnt) {
+            if (ib == b_cnt || (ia < a_cnt && a[ia].left <= b[ib].left)) {
+                push(a[ia].left, a[ia].right);
+                ia++;
+            } else {
+                push(b[ib].left, b[ib].right);
+                ib++;
+            }
+        }
+        break;
+
+    case op_intersect:
+        while (ia < a_cnt && ib < b_cnt) {
+            push(std::max(a[ia].left, b[ib].left),
+                    std::min(a[ia].right, b[ib].right));
+            if (a[ia].right < b[ib].right)
+                ia++;
+            else
+                ib++;
+        }
+        break;
+
+    case op_subtract:
+        for (; ia < a_cnt; ia++) {
+            int32_t left = a[ia].left;
+            while (ib < b_cnt && b[ib].right <= left)
+                ib++;
+            for (size_t jb = ib; jb < b_cnt && b[jb].left < a[ia].right; jb++) {
+                push(left, b[jb].left);
+                left = std::max(left, b[jb].right);
+            }
+            push(left, a[ia].right);
+        }
+        break;
+    }
+}
+
+/* Sweeps both regions top to bottom. The y axis is cut into slabs in which
+ * the set of spans of each operand does not change, the spans of every slab
+ * are combined with op and the result is coalesced with the slab above. */
+hwc2_region &hwc2_region::apply(const hwc2_region &other, region_op op)
+{
+    hwc2_region result;
+    result.reserve(cnt + other.cnt, false);
+
+    const hwc_rect_t *a = rects, *b = other.rects;
+    size_t ia = 0, ib = 0;
+    int32_t y = std::min(a[0].top, b[0].top);
+
+    while (ia < cnt || ib < other.cnt) {
+        if (op != op_union && (ia == cnt || (op == op_intersect && ib == other.cnt)))
+            break;
+
+        int32_t a_top = ia < cnt? a[ia].top: INT_MAX;
+        int32_t b_top = ib < other.cnt? b[ib].top: INT_MAX;
+        int32_t top = std::max(y, std::min(a_top, b_top));
+
+        bool a_active = a_top <= top;
+        bool b_active = b_top <= top;
+
+        int32_t bottom = INT_MAX;
+        if (a_active)
+            bottom = std::min(bottom, a[ia].bottom);
+        else if (a_top != INT_MAX)
+            bottom = std::min(bottom, a_top);
+        if (b_active)
+            bottom = std::min(bottom, b[ib].bottom);
+        else if (b_top != INT_MAX)
+            bottom = std::min(bottom, b_top);
+
+        size_t a_end = ia, b_end = ib;
+        while (a_active && a_end < cnt && a[a_end].top == a_top)
+            a_end++;
+        while (b_active && b_end < other.cnt && b[b_end].top == b_top)
+            b_end++;
+
+        size_t band_start = result.cnt;
+        result.append_spans(a + ia, a_active? a_end - ia: 0,
+                b + ib, b_active? b_end - ib: 0, top, bottom, op);
+        result.coalesce_band(band_start);
+
+        y = bottom;
+        if (a_active && a[ia].bottom == bottom)
+            ia = a_end;
+        if (b_active && b[ib].bottom == bottom)
+            ib = b_end;
+    }
+
+    result.update_bounds();
+    return *this = result;
+}
+
+/* Checks whether rects already follow the banded representation: sorted by
+ * band, every band a list of disjoint spans sharing one top and bottom and
+ * bands not overlapping vertically */
+bool hwc2_region::is_banded(const hwc_region_t &region)
+{
+    const hwc_rect_t *prev = nullptr;
+
+    for (size_t idx = 0; idx < region.numRects; idx++) {
+        const hwc_rect_t &cur = region.rects[idx];
+        if (rect_empty(cur))
+            continue;
+
+        if (prev) {
+            if (cur.top == prev->top) {
+                if (cur.bottom != prev->bottom || cur.left <= prev->right)
+                    return false;
+            } else if (cur.top < prev->bottom) {
+                return false;
+            }
+        }
+        prev = &cur;
+    }
+
+    return true;
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/log.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hwc2.h"
+
+/* Longest name the kernel keeps for a thread, without the terminator */
+#define HWC2_THREAD_NAME_MAX 15
+
+hwc2_scheduler::hwc2_scheduler()
+    : policies(),
+      mutex(),
+      threads() { }
+
+/*
+ * Reads one "<role> <priority> <cpus>" line per thread role, such as
+ * "vsync 2 4-7". Priority 0 keeps the role at SCHED_OTHER and cpus is a
+ * list of CPUs and ranges like "0-3,6", or "-" for any CPU. Roles without
+ * a line are left alone.
+ */
+int hwc2_scheduler::load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return -errno;
+
+    char line[256];
+    int ret = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        char role[64], cpus[128];
+        policy pol = {};
+
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+
+        if (sscanf(line, "%63s %d %127s", role, &pol.priority, cpus) != 3
+                || pol.priority < 0
+                || pol.priority > sched_get_priority_max(SCHED_FIFO)
+                || (strcmp(cpus, "-") && !parse_cpus(cpus, &pol.mask))) {
+            ret = -EINVAL;
+            break;
+        }
+
+        if (strcmp(cpus, "-"))
+            pol.cpus = cpus;
+        policies[role] = pol;
+    }
+
+    fclose(file);
+
+    if (ret)
+        policies.clear();
+    return ret;
+}
+
+bool hwc2_scheduler::parse_cpus(const char *cpus, cpu_set_t *out_mask)
+{
+    CPU_ZERO(out_mask);
+
+    while (*cpus) {
+        char *end;
+        long first = strtol(cpus, &end, 10), last = first;
+        if (end == cpus)
+            return false;
+
+        if (*end == '-') {
+            cpus = end + 1;
+            last = strtol(cpus, &end, 10);
+            if (end == cpus)
+                return false;
+        }
+
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, out_mask);
+
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return false;
+        cpus = end;
+    }
+
+    return CPU_COUNT(out_mask) > 0;
+}
+
+std::thread hwc2_scheduler::create(const char *role, const std::string &name,
+        std::function<void()> fn)
+{
+    return std::thread(&hwc2_scheduler::run, this, std::string(role), name,
+            std::move(fn));
+}
+
+/* Scheduling is set up by the thread itself so that it is in place before
+ * fn runs */
+void hwc2_scheduler::run(const std::string &role, const std::string &name,
+        const std::function<void()> &fn)
+{
+    pthread_setname_np(pthread_self(),
+            name.substr(0, HWC2_THREAD_NAME_MAX).c_str());
+
+    thread_info self = {name, gettid(), 0, std::string()};
+
+    auto it = policies.find(role);
+    if (it != policies.end()) {
+        const policy &pol = it->second;
+
+        if (pol.priority) {
+            struct sched_param param = {};
+            param.sched_priority = pol.priority;
+            int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (ret)
+                ALOGW("%s: failed to set SCHED_FIFO priority %d: %s",
+                        name.c_str(), pol.priority, strerror(ret));
+            else
+                self.priority = pol.priority;
+        }
+
+        if (!pol.cpus.empty()) {
+            if (sched_setaffinity(0, sizeof(pol.mask), &pol.mask))
+                ALOGW("%s: failed to set affinity to CPUs %s: %s",
+                        name.c_str(), pol.cpus.c_str(), strerror(errno));
+            else
+                self.cpus = pol.cpus;
+        }
+    }
+
+    std::list<thread_info>::iterator info;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        info = threads.insert(threads.end(), self);
+    }
+
+    fn();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.erase(info);
+}
+
+/* Shows the scheduling each thread got rather than what was configured. Run
+ * time comes from schedstat, switches from the task status, both are left
+ * out on kernels that do not have them */
+void hwc2_scheduler::dump(std::string *out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    char line[160];
+
+    if (threads.empty())
+        return;
+
+    out->append("  threads:\n");
+    for (const thread_info &info: threads) {
+        uint64_t run_ns = 0, switches = 0;
+        bool has_run = false, has_switches = false;
+        char path[64], buf[128];
+
+        snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", info.tid);
+        FILE *file = fopen(path, "r");
+        if (file) {
+            has_run = fscanf(file, "%" SCNu64, &run_ns) == 1;
+            fclose(file);
+        }
+
+        snprintf(path, sizeof(path), "/proc/self/task/%d/status", info.tid);
+        file = fopen(path, "r");
+        if (file) {
+            while (fgets(buf, sizeof(buf), file))
+                if (sscanf(buf, "nonvoluntary_ctxt_switches: %" SCNu64,
+                        &switches) == 1) {
+                    has_switches = true;
+                    break;
+                }
+            fclose(file);
+        }
+
+        char sched[16] = "other";
+        if (info.priority)
+            snprintf(sched, sizeof(sched), "fifo %d", info.priority);
+
+        snprintf(line, sizeof(line), "    %s: tid %d, %s, cpus %s",
+                info.name.c_str(), info.tid, sched,
+                info.cpus.empty()? "any": info.cpus.c_str());
+        out->append(line);
+        if (has_run) {
+            snprintf(line, sizeof(line), ", run %" PRIu64 " ms",
+                    run_ns / 1000000);
+            out->append(line);
+        }
+        if (has_switches) {
+            snprintf(line, sizeof(line), ", %" PRIu64 " involuntary switches",
+                    switches);
+            out->append(line);
+        }
+        out->append("\n");
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "hwc2.h"
+
+static const char *counter_names[HWC2_STAT_CNT] = {
+    "frames presented",
+    "frames skipped",
+    "device layers",
+    "client layers",
+    "solid color layers",
+    "cursor layers",
+    "plane layers",
+    "bytes written",
+    "cache hits",
+    "cache misses",
+    "vsync misses",
+    "deadline misses",
+    "idle entries",
+};
+
+static const char *timing_names[HWC2_TIMING_CNT] = {
+    "validate",
+    "present",
+    "compose",
+};
+
+hwc2_stats::hwc2_stats()
+    : counters(),
+      buckets(),
+      totals() { }
+
+/* Histograms are printed as "<upper bound in us>:<count>", empty buckets
+ * are left out */
+void hwc2_stats::dump(std::string *out) const
+{
+    char line[128];
+
+    for (int idx = 0; idx < HWC2_STAT_CNT; idx++) {
+        snprintf(line, sizeof(line), "    %-20s %" PRIu64 "\n",
+                counter_names[idx],
+                counters[idx].load(std::memory_order_relaxed));
+        out->append(line);
+    }
+
+    for (int timing = 0; timing < HWC2_TIMING_CNT; timing++) {
+        uint64_t cnt = 0;
+        for (auto &bucket: buckets[timing])
+            cnt += bucket.load(std::memory_order_relaxed);
+
+        uint64_t total = totals[timing].load(std::memory_order_relaxed);
+        snprintf(line, sizeof(line), "    %-8s %" PRIu64 " calls, mean %"
+                PRIu64 " us:", timing_names[timing], cnt, cnt? total / cnt: 0);
+        out->append(line);
+
+        for (int idx = 0; idx < HWC2_TIMING_BUCKETS; idx++) {
+            uint32_t val = buckets[timing][idx].load(std::memory_order_relaxed);
+            if (!val)
+                continue;
+
+            if (idx == HWC2_TIMING_BUCKETS - 1)
+                snprintf(line, sizeof(line), " inf:%u", val);
+            else
+                snprintf(line, sizeof(line), " %u:%u", 1u << idx, val);
+            out->append(line);
+        }
+        out->append("\n");
+    }
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/log.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "hwc2.h"
+
+/* Smallest size class, and the huge page size classes above it are
+ * multiples of */
+#define HWC2_POOL_PAGE 4096
+#define HWC2_POOL_HUGE_PAGE (2 * 1024 * 1024)
+
+hwc2_surface_pool::buffer::buffer(buffer &&other)
+    : pool(other.pool),
+      ptr(other.ptr),
+      len(other.len)
+{
+    other.pool = nullptr;
+    other.ptr = nullptr;
+    other.len = 0;
+}
+
+hwc2_surface_pool::buffer &hwc2_surface_pool::buffer::operator=(
+        buffer &&other)
+{
+    if (this != &other) {
+        reset();
+        std::swap(pool, other.pool);
+        std::swap(ptr, other.ptr);
+        std::swap(len, other.len);
+    }
+
+    return *this;
+}
+
+void hwc2_surface_pool::buffer::reset()
+{
+    if (ptr)
+        pool->release(ptr, len);
+
+    pool = nullptr;
+    ptr = nullptr;
+    len = 0;
+}
+
+hwc2_surface_pool::hwc2_surface_pool()
+    : mutex(),
+      budget(SIZE_MAX),
+      hugepages(false),
+      free_blocks(),
+      mapped_size(0),
+      used_size(0),
+      use_cnt(0),
+      hits(0),
+      misses(0),
+      reclaims(0),
+      failures(0) { }
+
+/* Blocks still handed out are unmapped by their buffers, which have to go
+ * first */
+hwc2_surface_pool::~hwc2_surface_pool()
+{
+    for (auto &bucket: free_blocks)
+        for (block &blk: bucket.second)
+            munmap(blk.data, bucket.first);
+}
+
+/* A budget of 0 leaves the pool unbounded */
+void hwc2_surface_pool::configure(size_t budget, bool hugepages)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->budget = budget? budget: SIZE_MAX;
+    this->hugepages = hugepages;
+}
+
+/* Powers of two up to a huge page, whole huge pages above */
+size_t hwc2_surface_pool::get_size_class(size_t size)
+{
+    if (size > HWC2_POOL_HUGE_PAGE)
+        return (size + HWC2_POOL_HUGE_PAGE - 1) & ~static_cast<size_t>(
+                HWC2_POOL_HUGE_PAGE - 1);
+
+    size_t size_class = HWC2_POOL_PAGE;
+    while (size_class < size)
+        size_class *= 2;
+
+    return size_class;
+}
+
+/* The most recently used free block of the class is the one most likely to
+ * still be in the caches. Contents are left as the last user had them. */
+hwc2_surface_pool::buffer hwc2_surface_pool::acquire(size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t size_class = get_size_class(size);
+
+    auto it = free_blocks.find(size_class);
+    if (it != free_blocks.end() && !it->second.empty()) {
+        uint8_t *data = it->second.back().data;
+        it->second.pop_back();
+        used_size += size_class;
+        hits++;
+        return buffer(this, data, size_class);
+    }
+
+    misses++;
+    while (mapped_size + size_class > budget && reclaim());
+
+    uint8_t *data = nullptr;
+    if (mapped_size + size_class <= budget)
+        data = map_block(size_class);
+    if (!data) {
+        failures++;
+        return buffer();
+    }
+
+    mapped_size += size_class;
+    used_size += size_class;
+    return buffer(this, data, size_class);
+}
+
+void hwc2_surface_pool::release(uint8_t *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    free_blocks[size].push_back(block{data, ++use_cnt});
+    used_size -= size;
+}
+
+/* Unmaps the free block that went unused the longest, fails when there is
+ * none left */
+bool hwc2_surface_pool::reclaim()
+{
+    std::vector<block> *oldest = nullptr;
+    size_t oldest_size = 0;
+
+    for (auto &bucket: free_blocks)
+        if (!bucket.second.empty() && (!oldest
+                || bucket.second.front().last_use
+                < oldest->front().last_use)) {
+            oldest = &bucket.second;
+            oldest_size = bucket.first;
+        }
+
+    if (!oldest)
+        return false;
+
+    munmap(oldest->front().data, oldest_size);
+    oldest->erase(oldest->begin());
+    mapped_size -= oldest_size;
+    reclaims++;
+    return true;
+}
+
+/*
+ * Huge pages need a range aligned to their size, so the mapping is made
+ * that much larger and trimmed. Kernels without transparent huge pages
+ * reject the advice and the block stays on small pages. Every page is
+ * touched so that composition never waits for one to be faulted in.
+ */
+uint8_t *hwc2_surface_pool::map_block(size_t size)
+{
+    bool huge = hugepages && size >= HWC2_POOL_HUGE_PAGE;
+    size_t map_size = huge? size + HWC2_POOL_HUGE_PAGE: size;
+
+    void *addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        ALOGE("failed to map %zu byte surface: %s", size, strerror(errno));
+        return nullptr;
+    }
+
+    uint8_t *data = static_cast<uint8_t *>(addr);
+    if (huge) {
+        uintptr_t start = (reinterpret_cast<uintptr_t>(addr)
+                + HWC2_POOL_HUGE_PAGE - 1) & ~static_cast<uintptr_t>(
+                HWC2_POOL_HUGE_PAGE - 1);
+        size_t head = start - reinterpret_cast<uintptr_t>(addr);
+
+        if (head)
+            munmap(addr, head);
+        munmap(reinterpret_cast<uint8_t *>(start) + size,
+                HWC2_POOL_HUGE_PAGE - head);
+
+        data = reinterpret_cast<uint8_t *>(start);
+        madvise(data, size, MADV_HUGEPAGE);
+    }
+
+    for (size_t offset = 0; offset < size; offset += HWC2_POOL_PAGE)
+        data[offset] = 0;
+
+    return data;
+}
+
+void hwc2_surface_pool::dump(std::string *out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    char line[192];
+    size_t free_cnt = 0;
+
+    for (auto &bucket: free_blocks)
+        free_cnt += bucket.second.size();
+
+    snprintf(line, sizeof(line), "  surface pool: %zu KB mapped, %zu KB in"
+            " use, %zu free blocks, budget ", mapped_size / 1024,
+            used_size / 1024, free_cnt);
+    out->append(line);
+    if (budget == SIZE_MAX)
+        out->append("none");
+    else
+        out->append(std::to_string(budget / 1024) + " KB");
+
+    snprintf(line, sizeof(line), "%s\n    hits %" PRIu64 ", misses %" PRIu64
+            ", reclaims %" PRIu64 ", failures %" PRIu64 "\n",
+            hugepages? ", huge pages": "", hits, misses, reclaims, failures);
+    out->append(line);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HWC2_TRACE
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hwc2.h"
+
+#define HWC2_TRACE_PATH "/data/system/hwc2_trace.json"
+
+std::atomic<bool> hwc2_trace::enabled(false);
+std::mutex hwc2_trace::rings_mutex;
+std::vector<hwc2_trace::ring *> hwc2_trace::rings;
+thread_local hwc2_trace::ring *hwc2_trace::local_ring = nullptr;
+
+/* A thread gets its ring with its first span, rings are never freed since
+ * the trace may still need them after the thread is gone */
+void hwc2_trace::record(const char *name, nsecs_t start, nsecs_t end)
+{
+    ring *r = local_ring;
+    if (!r) {
+        r = new ring();
+        r->head.store(0, std::memory_order_relaxed);
+        r->tid = gettid();
+
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(r);
+        local_ring = r;
+    }
+
+    uint32_t head = r->head.load(std::memory_order_relaxed);
+    event &ev = r->events[head % HWC2_TRACE_EVENTS];
+    ev.name = name;
+    ev.start = start;
+    ev.end = end;
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+void hwc2_trace::update(std::string *out)
+{
+    bool enable = property_get_bool("debug.hwc2.trace", false);
+
+    if (enabled.load(std::memory_order_relaxed)) {
+        int ret = write_json(HWC2_TRACE_PATH);
+        if (ret < 0) {
+            out->append("trace: failed to write " HWC2_TRACE_PATH ": ");
+            out->append(strerror(-ret));
+            out->append("\n");
+        } else {
+            out->append("trace: " + std::to_string(ret) + " spans written to "
+                    HWC2_TRACE_PATH "\n");
+        }
+    }
+
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+/*
+ * Writers keep going while the rings are copied, so a ring is copied first
+ * and whatever its writer may have overwritten in the meantime is dropped.
+ * Returns the number of spans written.
+ */
+int hwc2_trace::write_json(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return -errno;
+
+    std::vector<ring *> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        snapshot = rings;
+    }
+
+    std::vector<event> events(HWC2_TRACE_EVENTS);
+    int pid = getpid(), cnt = 0;
+    const char *sep = "";
+
+    fprintf(file, "{\"traceEvents\":[");
+    for (ring *r: snapshot) {
+        uint32_t head = r->head.load(std::memory_order_acquire);
+        uint32_t base = head > HWC2_TRACE_EVENTS? head - HWC2_TRACE_EVENTS: 0;
+        for (uint32_t idx = base; idx < head; idx++)
+            events[idx - base] = r->events[idx % HWC2_TRACE_EVENTS];
+
+        /* The writer may be in the middle of the event after the new head */
+        uint32_t first = r->head.load(std::memory_order_acquire) + 1;
+        first = first > base + HWC2_TRACE_EVENTS? first - HWC2_TRACE_EVENTS:
+                base;
+
+        for (uint32_t idx = first; idx < head; idx++) {
+            const event &ev = events[idx - base];
+            nsecs_t dur = ev.end - ev.start;
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" PRId64
+                    ".%03d,\"dur\":%" PRId64 ".%03d,\"pid\":%d,\"tid\":%d}",
+                    sep, ev.name, ev.start / 1000,
+                    static_cast<int>(ev.start % 1000), dur / 1000,
+                    static_cast<int>(dur % 1000), pid, r->tid);
+            sep = ",";
+            cnt++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file))
+        return -errno;
+
+    return cnt;
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hwc2.h"
+
+/* Samples needed before the estimate is trusted, and how many periods
+ * apart two of them may be before the model resyncs */
+#define HWC2_VSYNC_MIN_SAMPLES 4
+#define HWC2_VSYNC_MAX_FRAMES 120
+
+/* Periods past the last sample vsyncs are predicted for. Samples only come
+ * in while vsync is enabled, after that the phase soon goes stale. */
+#define HWC2_VSYNC_MAX_PREDICT 4
+
+/* Fractions of the prediction error the phase and the period follow, and of
+ * a new composition time the average moves by */
+#define HWC2_VSYNC_PHASE_GAIN 4
+#define HWC2_VSYNC_PERIOD_GAIN 16
+#define HWC2_COMPOSE_COST_GAIN 8
+
+hwc2_vsync_model::hwc2_vsync_model()
+    : mutex(),
+      nominal_period(0),
+      period(0),
+      phase(0),
+      sample_cnt(0),
+      compose_cost(0) { }
+
+/* Starts over at a new refresh rate, the phase changes along with it */
+void hwc2_vsync_model::reset(int64_t period)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    nominal_period = period;
+    this->period = period;
+    sample_cnt = 0;
+}
+
+/* Moves the phase and the period towards where the timestamp says they
+ * are. Timestamps far off the prediction, because of a driver hiccup or
+ * because vsync was off for long, make the model resync to them. */
+void hwc2_vsync_model::add_sample(nsecs_t timestamp)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!nominal_period)
+        return;
+
+    if (!sample_cnt) {
+        phase = timestamp;
+        sample_cnt = 1;
+        return;
+    }
+
+    int64_t frames = (timestamp - phase + period / 2) / period;
+    if (frames < 1)
+        return;
+
+    nsecs_t predicted = phase + frames * period;
+    nsecs_t error = timestamp - predicted;
+    if (frames > HWC2_VSYNC_MAX_FRAMES || llabs(error) > period / 4) {
+        phase = timestamp;
+        sample_cnt = 1;
+        return;
+    }
+
+    period += error / (frames * HWC2_VSYNC_PERIOD_GAIN);
+    period = std::min(std::max(period, nominal_period - nominal_period / 20),
+            nominal_period + nominal_period / 20);
+    phase = predicted + error / HWC2_VSYNC_PHASE_GAIN;
+    sample_cnt++;
+}
+
+/* The first vsync after now, 0 while there is no usable estimate */
+nsecs_t hwc2_vsync_model::get_next_vsync(nsecs_t now) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (sample_cnt < HWC2_VSYNC_MIN_SAMPLES || now < phase)
+        return 0;
+
+    int64_t frames = (now - phase) / period + 1;
+    if (frames > HWC2_VSYNC_MAX_PREDICT)
+        return 0;
+
+    return phase + frames * period;
+}
+
+/* Returns whether a frame missed the vsync that followed its start, so that
+ * the panel scanned out part of it while it was being written */
+bool hwc2_vsync_model::add_compose_time(nsecs_t duration, nsecs_t end,
+        nsecs_t deadline)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!compose_cost)
+        compose_cost = duration;
+    else
+        compose_cost += (duration - compose_cost) / HWC2_COMPOSE_COST_GAIN;
+
+    return deadline && end > deadline;
+}
+
+void hwc2_vsync_model::dump(std::string *out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    char line[128];
+
+    snprintf(line, sizeof(line), "    vsync period %" PRId64 " ns (%s),"
+            " compose %" PRId64 " us\n", period,
+            sample_cnt >= HWC2_VSYNC_MIN_SAMPLES? "locked": "unlocked",
+            compose_cost / 1000);
+    out->append(line);
+}
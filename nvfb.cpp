@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cutils/log.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
@@ -23,6 +25,7 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <vector>
 
 #include "nvfb.h"
 
@@ -37,44 +40,86 @@ int nvfb_device_open(int id, int flags, struct nvfb_device *dev)
     snprintf(filename, sizeof(filename), FB_BASE_PATH "fb%u", id);
     dev->fd = open(filename, flags);
     if (dev->fd < 0)
-        return -1;
+        return -errno;
 
     if (ioctl(dev->fd, FBIOGET_VSCREENINFO, &dev->vi) < 0) {
-        ALOGE("failed to get fb0 info (FBIOGET_VSCREENINFO)");
+        int err = errno;
+        ALOGE("failed to get fb%d info (FBIOGET_VSCREENINFO)", id);
         close(dev->fd);
-        return -1;
+        return -err;
     }
 
     if (ioctl(dev->fd, FBIOGET_FSCREENINFO, &dev->fi) < 0) {
-        ALOGE("failed to get fb0 info (FBIOGET_FSCREENINFO)");
+        int err = errno;
+        ALOGE("failed to get fb%d info (FBIOGET_FSCREENINFO)", id);
         close(dev->fd);
-        return -1;
+        return -err;
 	}
 
-    ALOGD("fb%d reports (possibly inaccurate):\n"
-            "  vi.bits_per_pixel = %d\n"
-            "  vi.red.offset   = %3d   .length = %3d\n"
-            "  vi.green.offset = %3d   .length = %3d\n"
-            "  vi.blue.offset  = %3d   .length = %3d\n",
-            id,
-            dev->vi.bits_per_pixel,
-            dev->vi.red.offset, dev->vi.red.length,
-            dev->vi.green.offset, dev->vi.green.length,
-            dev->vi.blue.offset, dev->vi.blue.length);
+    ALOGD("fb%d: %ux%u, %u bpp, rgba offsets %u/%u/%u/%u", id,
+            dev->vi.xres, dev->vi.yres, dev->vi.bits_per_pixel,
+            dev->vi.red.offset, dev->vi.green.offset, dev->vi.blue.offset,
+            dev->vi.transp.offset);
 
+    int ret = nvfb_map(dev);
+    if (ret < 0) {
+        close(dev->fd);
+        return ret;
+    }
+
+    return 0;
+}
+
+/* Maps all of smem_len, which holds every buffer the panel can pan to */
+int nvfb_map(struct nvfb_device *dev)
+{
     dev->data = mmap(0, dev->fi.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
     if (dev->data == MAP_FAILED) {
+        int err = errno;
         ALOGE("failed to mmap framebuffer");
-        close(dev->fd);
-        return NULL;
+        return -err;
     }
 
-    memset(dev->data, 0, dev->fi.smem_len);
+    return 0;
+}
 
-    nvfb_blank(dev, true);
-    nvfb_blank(dev, false);
+/* Clears the buffer being scanned out, the rest of the mapping is never
+ * shown and is left as it is */
+void nvfb_clear(struct nvfb_device *dev)
+{
+    uint8_t *data = static_cast<uint8_t *>(dev->data)
+            + dev->vi.yoffset * dev->fi.line_length;
+    size_t size = dev->vi.yres * dev->fi.line_length;
 
-    return 0;
+    memset(data, 0, size);
+}
+
+/* Fills ids with the numbers of the framebuffer nodes, lowest first */
+int nvfb_device_enumerate(int *ids, int max_ids)
+{
+    DIR *dir = opendir(FB_BASE_PATH);
+    if (!dir)
+        return -1;
+
+    /* readdir returns the nodes in no particular order, so the lowest ids
+     * are only known once all of them were read */
+    std::vector<int> found;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        unsigned int id;
+        char tail;
+
+        if (sscanf(entry->d_name, "fb%u%c", &id, &tail) == 1)
+            found.push_back(id);
+    }
+
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+
+    int cnt = std::min(static_cast<int>(found.size()), max_ids);
+    std::copy(found.begin(), found.begin() + cnt, ids);
+
+    return cnt;
 }
 
 void nvfb_blank(struct nvfb_device *dev, bool blank)
@@ -25,5 +25,8 @@ struct nvfb_device {
 };
 
 int nvfb_device_open(int id, int flags, struct nvfb_device *dev);
+int nvfb_device_enumerate(int *ids, int max_ids);
+int nvfb_map(struct nvfb_device *dev);
+void nvfb_clear(struct nvfb_device *dev);
 void nvfb_blank(struct nvfb_device *dev, bool blank);
 void nvfb_write(struct nvfb_device *dev, void* new_data);
@@ -0,0 +1,129 @@
+# Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+# Replays call streams written by the composer, see hwc2_recorder in hwc2.h
+LOCAL_MODULE := hwc2_replay
+
+LOCAL_SHARED_LIBRARIES := \
+	libhardware \
+	liblog \
+	libutils
+
+LOCAL_SRC_FILES := \
+	hwc2_replay.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS += -DLOG_TAG=\"hwc2_replay\"
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+# Benchmarks of composer internals run on the build host, see hwc2_bench.cpp
+LOCAL_MODULE := hwc2_bench
+
+LOCAL_STATIC_LIBRARIES := \
+	libcutils \
+	liblog \
+	libsync \
+	libutils
+
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers
+
+LOCAL_SRC_FILES := \
+	hwc2_bench.cpp \
+	hwc2_bench_planes.cpp \
+	hwc2_bench_region.cpp \
+	hwc2_bench_shadow.cpp \
+	hwc2_bench_startup.cpp \
+	hwc2_bench_yuv.cpp \
+	hwc2_fake_gralloc.cpp \
+	hwc2_fake_planes.cpp \
+	../hwc2_buffer.cpp \
+	../hwc2_callback.cpp \
+	../hwc2_compositor.cpp \
+	../hwc2_config.cpp \
+	../hwc2_display.cpp \
+	../hwc2_governor.cpp \
+	../hwc2_gralloc.cpp \
+	../hwc2_layer.cpp \
+	../hwc2_lut.cpp \
+	../hwc2_plane.cpp \
+	../hwc2_region.cpp \
+	../hwc2_scheduler.cpp \
+	../hwc2_stats.cpp \
+	../hwc2_surface_pool.cpp \
+	../hwc2_vsync_model.cpp \
+	../nvfb.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS += -DLOG_TAG=\"hwc2_bench\"
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+# Tests of composer internals run on the build host, see hwc2_test.cpp
+LOCAL_MODULE := hwc2_test
+
+LOCAL_STATIC_LIBRARIES := \
+	libcutils \
+	liblog \
+	libsync \
+	libutils
+
+LOCAL_HEADER_LIBRARIES := \
+	libhardware_headers
+
+LOCAL_SRC_FILES := \
+	hwc2_fake_gralloc.cpp \
+	hwc2_fake_planes.cpp \
+	hwc2_test.cpp \
+	hwc2_test_kernels.cpp \
+	hwc2_test_planes.cpp \
+	../hwc2_buffer.cpp \
+	../hwc2_callback.cpp \
+	../hwc2_compositor.cpp \
+	../hwc2_config.cpp \
+	../hwc2_display.cpp \
+	../hwc2_governor.cpp \
+	../hwc2_gralloc.cpp \
+	../hwc2_layer.cpp \
+	../hwc2_lut.cpp \
+	../hwc2_plane.cpp \
+	../hwc2_region.cpp \
+	../hwc2_scheduler.cpp \
+	../hwc2_stats.cpp \
+	../hwc2_surface_pool.cpp \
+	../hwc2_vsync_model.cpp \
+	../nvfb.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS += -DLOG_TAG=\"hwc2_test\"
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmarks parts of the composer on the build host:
+ *
+ *     hwc2_bench [group...]
+ *
+ * Every group is run unless some are named. Times are averages over as
+ * many runs as fit in HWC2_BENCH_TIME after a warm up run.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "hwc2_bench.h"
+#include "nvfb.h"
+
+/* How long each benchmark is repeated for */
+#define HWC2_BENCH_TIME 500000000LL
+
+/* The fake panel of bench_open_fb */
+#define HWC2_BENCH_FB_WIDTH 1920
+#define HWC2_BENCH_FB_HEIGHT 1200
+#define HWC2_BENCH_FB_BUFFERS 3
+
+static const struct {
+    const char *name;
+    void (*run)();
+} groups[] = {
+    {"planes", bench_planes},
+    {"region", bench_region},
+    {"shadow", bench_shadow},
+    {"startup", bench_startup},
+    {"yuv", bench_yuv},
+};
+
+static int64_t get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void bench_run(const char *name, const std::function<void()> &fn,
+        double units, const char *unit)
+{
+    fn();
+
+    uint64_t runs = 0;
+    int64_t start = get_time(), elapsed;
+    do {
+        fn();
+        runs++;
+        elapsed = get_time() - start;
+    } while (elapsed < HWC2_BENCH_TIME);
+
+    double run_ns = static_cast<double>(elapsed) / runs;
+    printf("  %-44s %12.2f us", name, run_ns / 1000.0);
+    if (units > 0)
+        printf(" %10.1f M%s/s", units * 1000.0 / run_ns, unit);
+    printf("\n");
+}
+
+/* Fills in what FBIOGET_VSCREENINFO and FBIOGET_FSCREENINFO would report.
+ * The file is unlinked right away and goes with the descriptor. */
+int bench_open_fb(struct nvfb_device *dev)
+{
+    const char *tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp? tmp: "/tmp") + "/hwc2_bench_fb.XXXXXX";
+
+    memset(dev, 0, sizeof(*dev));
+    dev->vi.xres = dev->vi.xres_virtual = HWC2_BENCH_FB_WIDTH;
+    dev->vi.yres = HWC2_BENCH_FB_HEIGHT;
+    dev->vi.yres_virtual = HWC2_BENCH_FB_HEIGHT * HWC2_BENCH_FB_BUFFERS;
+    dev->vi.bits_per_pixel = 32;
+    dev->fi.line_length = HWC2_BENCH_FB_WIDTH * 4;
+    dev->fi.smem_len = dev->fi.line_length * dev->vi.yres_virtual;
+
+    dev->fd = mkstemp(&path[0]);
+    if (dev->fd < 0)
+        return -1;
+    unlink(path.c_str());
+
+    if (ftruncate(dev->fd, dev->fi.smem_len) < 0) {
+        close(dev->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+void bench_close_fb(struct nvfb_device *dev)
+{
+    if (dev->data)
+        munmap(dev->data, dev->fi.smem_len);
+    close(dev->fd);
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 0;
+
+    for (int arg = 1; arg < argc; arg++) {
+        bool found = false;
+        for (auto &group: groups)
+            found |= !strcmp(argv[arg], group.name);
+        if (!found) {
+            fprintf(stderr, "unknown benchmark group %s\n", argv[arg]);
+            ret = 1;
+        }
+    }
+    if (ret)
+        return ret;
+
+    for (auto &group: groups) {
+        bool selected = argc == 1;
+        for (int arg = 1; arg < argc; arg++)
+            selected |= !strcmp(argv[arg], group.name);
+        if (!selected)
+            continue;
+
+        printf("%s:\n", group.name);
+        group.run();
+    }
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HWC2_BENCH_H
+#define _HWC2_BENCH_H
+
+#include <functional>
+
+struct nvfb_device;
+
+/* Runs fn over and over for a while and prints the average time a run took.
+ * With units given, the rate they were processed at is printed as well, in
+ * millions per second. */
+void bench_run(const char *name, const std::function<void()> &fn,
+        double units = 0, const char *unit = nullptr);
+
+/* A three buffer 1920x1200 panel framebuffer, backed by a temporary file
+ * instead of the device. It is not mapped yet, see nvfb_map. */
+int bench_open_fb(struct nvfb_device *dev);
+void bench_close_fb(struct nvfb_device *dev);
+
+/* Groups of benchmarks, one per part of the composer */
+void bench_planes();
+void bench_region();
+void bench_shadow();
+void bench_startup();
+void bench_yuv();
+
+#endif /* ifndef _HWC2_BENCH_H */
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hwc2.h"
+#include "hwc2_bench.h"
+#include "hwc2_fake_gralloc.h"
+#include "hwc2_fake_planes.h"
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+
+/* A window below the framebuffer, one above it that takes video and one
+ * for the cursor */
+#define BENCH_PLANES "below,rgb;above,rgb,yuv,scaling,blending;" \
+        "above,rgb,blending,cursor"
+
+static void add_layer(hwc2_display &dpy, std::vector<buffer_handle_t> &handles,
+        int32_t format, uint32_t width, uint32_t height,
+        const hwc_rect_t &frame, hwc2_composition_t type,
+        hwc2_blend_mode_t blend, uint32_t z_order)
+{
+    hwc2_layer_t lyr_id;
+    buffer_handle_t handle = fake_gralloc_alloc(width, height, format);
+    hwc_region_t visible = {1, &frame};
+
+    dpy.create_layer(&lyr_id);
+    dpy.set_layer_composition_type(lyr_id, type);
+    dpy.set_layer_buffer(lyr_id, handle, -1);
+    dpy.set_layer_blend_mode(lyr_id, blend);
+    dpy.set_layer_display_frame(lyr_id, frame);
+    dpy.set_layer_source_crop(lyr_id, hwc_frect_t{0.0f, 0.0f,
+            static_cast<float>(width), static_cast<float>(height)});
+    dpy.set_layer_visible_region(lyr_id, visible);
+    dpy.set_layer_plane_alpha(lyr_id, 1.0f);
+    dpy.set_layer_z_order(lyr_id, z_order);
+
+    handles.push_back(handle);
+}
+
+/*
+ * validate_display on a panel showing a wallpaper, a number of app windows,
+ * video and the cursor, with and without planes to put some of them on.
+ * Layers stay marked as changed without a present, so every run goes
+ * through the whole of it.
+ */
+void bench_planes()
+{
+    for (uint32_t windows: {1, 12}) {
+        for (bool with_planes: {false, true}) {
+            struct nvfb_device dev;
+            memset(&dev, 0, sizeof(dev));
+            dev.fd = -1;
+            dev.vi.xres = dev.vi.xres_virtual = BENCH_WIDTH;
+            dev.vi.yres = dev.vi.yres_virtual = BENCH_HEIGHT;
+            dev.vi.bits_per_pixel = 32;
+            dev.vi.green.offset = 8;
+            dev.vi.blue.offset = 16;
+            dev.vi.transp.offset = 24;
+            dev.vi.transp.length = 8;
+            dev.fi.line_length = BENCH_WIDTH * 4;
+
+            hwc2_display dpy(0, dev, HWC2_CONNECTION_CONNECTED,
+                    HWC2_POWER_MODE_ON, HWC2_DISPLAY_TYPE_PHYSICAL);
+            if (with_planes)
+                dpy.set_planes(fake_planes_parse(BENCH_PLANES));
+
+            std::vector<buffer_handle_t> handles;
+            uint32_t z_order = 0;
+            add_layer(dpy, handles, HAL_PIXEL_FORMAT_RGBX_8888, BENCH_WIDTH,
+                    BENCH_HEIGHT, hwc_rect_t{0, 0, BENCH_WIDTH, BENCH_HEIGHT},
+                    HWC2_COMPOSITION_DEVICE, HWC2_BLEND_MODE_NONE, z_order++);
+            for (uint32_t idx = 0; idx < windows; idx++) {
+                int32_t offset = idx * 40;
+                add_layer(dpy, handles, HAL_PIXEL_FORMAT_RGBA_8888, 800, 600,
+                        hwc_rect_t{100 + offset, 100 + offset, 900 + offset,
+                        700 + offset}, HWC2_COMPOSITION_DEVICE,
+                        HWC2_BLEND_MODE_PREMULTIPLIED, z_order++);
+            }
+            add_layer(dpy, handles, HAL_PIXEL_FORMAT_YCbCr_420_888, 1280,
+                    720, hwc_rect_t{320, 180, 1600, 900},
+                    HWC2_COMPOSITION_DEVICE, HWC2_BLEND_MODE_NONE, z_order++);
+            add_layer(dpy, handles, HAL_PIXEL_FORMAT_RGBA_8888, 64, 64,
+                    hwc_rect_t{900, 500, 964, 564}, HWC2_COMPOSITION_CURSOR,
+                    HWC2_BLEND_MODE_PREMULTIPLIED, z_order++);
+
+            char name[64];
+            snprintf(name, sizeof(name), "validate %u layers, %s",
+                    z_order, with_planes? "3 planes": "no planes");
+            bench_run(name, [&] {
+                uint32_t num_types, num_requests;
+                dpy.validate_display(&num_types, &num_requests);
+            });
+
+            for (buffer_handle_t handle: handles)
+                fake_gralloc_free(handle);
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <random>
+
+#include "hwc2.h"
+#include "hwc2_bench.h"
+
+/* Size of the screen the random rects are scattered over */
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1200
+
+/* Rects the size of a window or a bit of damage, at random places */
+static std::vector<hwc_rect_t> get_rects(std::mt19937 &rng, size_t cnt,
+        int32_t max_size)
+{
+    std::uniform_int_distribution<int32_t> size(1, max_size);
+    std::vector<hwc_rect_t> rects;
+
+    for (size_t idx = 0; idx < cnt; idx++) {
+        int32_t width = size(rng), height = size(rng);
+        int32_t left = std::uniform_int_distribution<int32_t>(0,
+                BENCH_WIDTH - width)(rng);
+        int32_t top = std::uniform_int_distribution<int32_t>(0,
+                BENCH_HEIGHT - height)(rng);
+        rects.push_back(hwc_rect_t{left, top, left + width, top + height});
+    }
+
+    return rects;
+}
+
+/* A banded region made of about cnt rects */
+static hwc2_region get_region(std::mt19937 &rng, size_t cnt)
+{
+    hwc2_region region;
+
+    while (region.size() < cnt) {
+        std::vector<hwc_rect_t> rects = get_rects(rng, 8, 64);
+        region.unite(hwc2_region(hwc_region_t{rects.size(), rects.data()}));
+    }
+
+    return region;
+}
+
+static void bench_ops(std::mt19937 &rng, size_t cnt)
+{
+    hwc2_region a = get_region(rng, cnt), b = get_region(rng, cnt);
+    hwc_rect_t probe = get_rects(rng, 1, 256).front();
+    char name[64];
+    volatile size_t sink;
+
+    snprintf(name, sizeof(name), "unite %zu + %zu rects", a.size(), b.size());
+    bench_run(name, [&] { sink = hwc2_region(a).unite(b).size(); });
+    snprintf(name, sizeof(name), "intersect %zu & %zu rects", a.size(),
+            b.size());
+    bench_run(name, [&] { sink = hwc2_region(a).intersect(b).size(); });
+    snprintf(name, sizeof(name), "subtract %zu - %zu rects", a.size(),
+            b.size());
+    bench_run(name, [&] { sink = hwc2_region(a).subtract(b).size(); });
+    snprintf(name, sizeof(name), "copy %zu rects", a.size());
+    bench_run(name, [&] { sink = hwc2_region(a).size(); });
+    snprintf(name, sizeof(name), "contains in %zu rects", a.size());
+    bench_run(name, [&] { sink = a.contains(probe); });
+    snprintf(name, sizeof(name), "intersects in %zu rects", a.size());
+    bench_run(name, [&] { sink = a.intersects(probe); });
+
+    (void)sink;
+}
+
+void bench_region()
+{
+    std::mt19937 rng(26);
+    volatile size_t sink;
+
+    /* SurfaceFlinger hands over overlapping rects in no particular order,
+     * which have to be banded first */
+    for (size_t cnt: {100, 400}) {
+        std::vector<hwc_rect_t> rects = get_rects(rng, cnt, 128);
+        hwc_region_t region = {rects.size(), rects.data()};
+        char name[64];
+
+        snprintf(name, sizeof(name), "set from %zu unsorted rects", cnt);
+        bench_run(name, [&] { sink = hwc2_region(region).size(); });
+    }
+
+    /* Damage of a few rects stays in the inline storage */
+    std::vector<hwc_rect_t> few = get_rects(rng, 4, 256);
+    hwc2_region small_a(hwc_region_t{2, few.data()});
+    hwc2_region small_b(hwc_region_t{2, few.data() + 2});
+    bench_run("unite 2 + 2 rects", [&] {
+        sink = hwc2_region(small_a).unite(small_b).size();
+    });
+    bench_run("subtract 2 - 2 rects", [&] {
+        sink = hwc2_region(small_a).subtract(small_b).size();
+    });
+
+    bench_ops(rng, 100);
+    bench_ops(rng, 400);
+
+    (void)sink;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <random>
+
+#include "hwc2.h"
+#include "hwc2_bench.h"
+
+struct bench_layer {
+    std::vector<uint8_t> data;
+    hwc2_surface surface;
+    hwc_rect_t frame;
+    hwc2_blend_mode_t blend;
+    float plane_alpha;
+};
+
+/* A layer of random pixels whose alpha is either alpha or 0, which keeps
+ * them premultiplied */
+static bench_layer get_layer(std::mt19937 &rng, const hwc_rect_t &frame,
+        hwc2_blend_mode_t blend, float plane_alpha, uint32_t alpha)
+{
+    uint32_t width = frame.right - frame.left;
+    uint32_t height = frame.bottom - frame.top;
+    bench_layer layer = {std::vector<uint8_t>(width * height * 4), {}, frame,
+            blend, plane_alpha};
+
+    uint32_t *pixels = reinterpret_cast<uint32_t *>(layer.data.data());
+    for (size_t idx = 0; idx < width * height; idx++)
+        pixels[idx] = rng() % 8? (rng() & 0x007f7f7f) | alpha << 24: 0;
+
+    layer.surface = {layer.data.data(), width, height, width * 4,
+            HAL_PIXEL_FORMAT_RGBA_8888, nullptr, nullptr, 0, 0};
+    return layer;
+}
+
+static void draw_layers(hwc2_compositor &compositor, const hwc2_surface &dst,
+        const std::vector<bench_layer> &layers, const hwc2_region &damage)
+{
+    for (const bench_layer &layer: layers) {
+        hwc2_region clip(layer.frame);
+        clip.intersect(damage);
+        hwc_frect_t crop = {0.0f, 0.0f,
+                static_cast<float>(layer.surface.width),
+                static_cast<float>(layer.surface.height)};
+        compositor.draw(dst, layer.surface, crop, layer.frame, layer.blend,
+                layer.plane_alpha, clip, false, HAL_DATASPACE_UNKNOWN);
+    }
+}
+
+/*
+ * A wallpaper, an app, a translucent status bar and a dialog, composed
+ * straight into the mapped framebuffer and into a shadow copy that has its
+ * damaged rows streamed to the framebuffer afterwards, like debug.hwc2.
+ * shadow_fb does. The fake framebuffer is cached memory, so on the host
+ * this shows what the upload costs. On a panel whose mapping is uncached,
+ * the direct runs also pay for every blended pixel read back from it.
+ */
+void bench_shadow()
+{
+    hwc2_compositor::init_kernels();
+    hwc2_compositor compositor;
+    struct nvfb_device dev;
+    std::mt19937 rng(47);
+
+    if (bench_open_fb(&dev) < 0 || nvfb_map(&dev) < 0) {
+        fprintf(stderr, "failed to create a fake framebuffer\n");
+        return;
+    }
+
+    int32_t width = dev.vi.xres, height = dev.vi.yres;
+    hwc2_surface fb = {static_cast<uint8_t *>(dev.data), dev.vi.xres,
+            dev.vi.yres, dev.fi.line_length, HAL_PIXEL_FORMAT_RGBA_8888,
+            nullptr, nullptr, 0, 0};
+    std::vector<uint8_t> shadow_data(fb.stride * fb.height);
+    hwc2_surface shadow = fb;
+    shadow.data = shadow_data.data();
+
+    std::vector<bench_layer> layers;
+    layers.push_back(get_layer(rng, hwc_rect_t{0, 0, width, height},
+            HWC2_BLEND_MODE_NONE, 1.0f, 0xff));
+    layers.push_back(get_layer(rng, hwc_rect_t{0, 48, width, height},
+            HWC2_BLEND_MODE_PREMULTIPLIED, 1.0f, 0xff));
+    layers.push_back(get_layer(rng, hwc_rect_t{0, 0, width, 48},
+            HWC2_BLEND_MODE_PREMULTIPLIED, 1.0f, 0x80));
+    layers.push_back(get_layer(rng, hwc_rect_t{560, 400, 1360, 800},
+            HWC2_BLEND_MODE_PREMULTIPLIED, 0.9f, 0xff));
+
+    double pixels = static_cast<double>(width) * height;
+    hwc2_region full(hwc_rect_t{0, 0, width, height});
+    hwc2_region dialog(layers.back().frame);
+    double dialog_pixels = static_cast<double>(dialog.get_area());
+
+    bench_run("full frame, direct", [&] {
+        draw_layers(compositor, fb, layers, full);
+    }, pixels, "pixel");
+    bench_run("full frame, shadow", [&] {
+        draw_layers(compositor, shadow, layers, full);
+        for (int32_t y = 0; y < height; y++)
+            hwc2_compositor::stream_copy(fb.data + y * fb.stride,
+                    shadow.data + y * shadow.stride, fb.stride);
+    }, pixels, "pixel");
+
+    bench_run("dialog damage, direct", [&] {
+        draw_layers(compositor, fb, layers, dialog);
+    }, dialog_pixels, "pixel");
+    bench_run("dialog damage, shadow", [&] {
+        draw_layers(compositor, shadow, layers, dialog);
+        for (int32_t y = 400; y < 800; y++)
+            hwc2_compositor::stream_copy(fb.data + y * fb.stride,
+                    shadow.data + y * shadow.stride, fb.stride);
+    }, dialog_pixels, "pixel");
+
+    bench_close_fb(&dev);
+}
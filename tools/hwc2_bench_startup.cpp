@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "hwc2_bench.h"
+#include "nvfb.h"
+
+/*
+ * The framebuffer part of opening a panel, before the first hotplug. Every
+ * run maps the node again, so page faults are counted like they are at
+ * boot. Clearing all of smem_len is what nvfb_device_open used to do.
+ */
+void bench_startup()
+{
+    struct nvfb_device dev;
+
+    if (bench_open_fb(&dev) < 0) {
+        fprintf(stderr, "failed to create a fake framebuffer\n");
+        return;
+    }
+
+    bench_run("map, clear all buffers", [&] {
+        if (nvfb_map(&dev) < 0)
+            return;
+        memset(dev.data, 0, dev.fi.smem_len);
+        munmap(dev.data, dev.fi.smem_len);
+    });
+    bench_run("map, clear the visible buffer", [&] {
+        if (nvfb_map(&dev) < 0)
+            return;
+        nvfb_clear(&dev);
+        munmap(dev.data, dev.fi.smem_len);
+    });
+
+    dev.data = nullptr;
+    bench_close_fb(&dev);
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <random>
+
+#include "hwc2.h"
+#include "hwc2_bench.h"
+#include "hwc2_fake_gralloc.h"
+
+/* The panel video is converted into */
+#define BENCH_FB_WIDTH 1920
+#define BENCH_FB_HEIGHT 1080
+
+static const struct {
+    int32_t format;
+    const char *name;
+} yuv_formats[] = {
+    {HAL_PIXEL_FORMAT_YCbCr_420_888, "nv12"},
+    {HAL_PIXEL_FORMAT_YCrCb_420_SP, "nv21"},
+    {HAL_PIXEL_FORMAT_YV12, "yv12"},
+};
+
+static const struct {
+    uint32_t width;
+    uint32_t height;
+} yuv_sizes[] = {
+    {BENCH_FB_WIDTH, BENCH_FB_HEIGHT},
+    {1280, 720},
+};
+
+/*
+ * Rates are in pixels written to the framebuffer. Full screen opaque video
+ * is converted straight into it, plane alpha takes the blending path, and
+ * the last case locks the buffer through gralloc every frame like
+ * present_display does.
+ */
+void bench_yuv()
+{
+    hwc2_compositor::init_kernels();
+    const hwc2_gralloc &gralloc = hwc2_gralloc::get_instance();
+    hwc2_compositor compositor;
+    std::mt19937 rng(33);
+
+    std::vector<uint8_t> fb(BENCH_FB_WIDTH * BENCH_FB_HEIGHT * 4);
+    hwc2_surface dst = {fb.data(), BENCH_FB_WIDTH, BENCH_FB_HEIGHT,
+            BENCH_FB_WIDTH * 4, HAL_PIXEL_FORMAT_RGBX_8888, nullptr, nullptr,
+            0, 0};
+    hwc_rect_t frame = {0, 0, BENCH_FB_WIDTH, BENCH_FB_HEIGHT};
+    hwc2_region clip(frame);
+    double pixels = static_cast<double>(BENCH_FB_WIDTH) * BENCH_FB_HEIGHT;
+
+    for (auto &format: yuv_formats) {
+        for (auto &size: yuv_sizes) {
+            buffer_handle_t handle = fake_gralloc_alloc(size.width,
+                    size.height, format.format);
+            size_t data_size;
+            uint8_t *data = fake_gralloc_get_data(handle, &data_size);
+            for (size_t idx = 0; idx < data_size; idx++)
+                data[idx] = rng();
+
+            hwc_frect_t crop = {0.0f, 0.0f, static_cast<float>(size.width),
+                    static_cast<float>(size.height)};
+            char name[64];
+            hwc2_surface src;
+
+            if (gralloc.lock(handle, &src) < 0) {
+                fprintf(stderr, "failed to lock %s buffer\n", format.name);
+                fake_gralloc_free(handle);
+                continue;
+            }
+
+            snprintf(name, sizeof(name), "%s %ux%u opaque", format.name,
+                    size.width, size.height);
+            bench_run(name, [&] {
+                compositor.draw(dst, src, crop, frame, HWC2_BLEND_MODE_NONE,
+                        1.0f, clip, true, HAL_DATASPACE_V0_BT709);
+            }, pixels, "pixel");
+
+            snprintf(name, sizeof(name), "%s %ux%u plane alpha", format.name,
+                    size.width, size.height);
+            bench_run(name, [&] {
+                compositor.draw(dst, src, crop, frame, HWC2_BLEND_MODE_NONE,
+                        0.5f, clip, true, HAL_DATASPACE_V0_BT709);
+            }, pixels, "pixel");
+
+            gralloc.unlock(handle);
+
+            snprintf(name, sizeof(name), "%s %ux%u opaque, locked",
+                    format.name, size.width, size.height);
+            bench_run(name, [&] {
+                if (gralloc.lock(handle, &src) < 0)
+                    return;
+                compositor.draw(dst, src, crop, frame, HWC2_BLEND_MODE_NONE,
+                        1.0f, clip, true, HAL_DATASPACE_V0_BT709);
+                gralloc.unlock(handle);
+            }, pixels, "pixel");
+
+            fake_gralloc_free(handle);
+        }
+    }
+}
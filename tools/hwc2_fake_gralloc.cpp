@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "hwc2_fake_gralloc.h"
+
+/* Rows of every plane start this many bytes apart at least */
+#define FAKE_GRALLOC_ALIGN 16
+
+struct fake_buffer {
+    uint32_t width;
+    uint32_t height;
+    int32_t format;
+    /* In pixels for RGB formats, in bytes of luma for YUV ones */
+    uint32_t stride;
+    std::vector<uint8_t> data;
+    bool locked;
+};
+
+static std::mutex buffers_mutex;
+static std::unordered_map<buffer_handle_t, fake_buffer> buffers;
+
+static uint32_t align(uint32_t val)
+{
+    return (val + FAKE_GRALLOC_ALIGN - 1) & ~(FAKE_GRALLOC_ALIGN - 1);
+}
+
+static uint32_t get_bpp(int32_t format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        return 4;
+    case HAL_PIXEL_FORMAT_RGB_565:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+static bool is_yuv(int32_t format)
+{
+    return format == HAL_PIXEL_FORMAT_YV12
+            || format == HAL_PIXEL_FORMAT_YCrCb_420_SP
+            || format == HAL_PIXEL_FORMAT_YCbCr_420_888;
+}
+
+/* Chroma rows follow the luma plane, YV12 puts a plane of V before a plane
+ * of U while the semi planar formats interleave them */
+static uint32_t get_chroma_stride(const fake_buffer &buf)
+{
+    return buf.format == HAL_PIXEL_FORMAT_YV12? align(buf.stride / 2):
+            buf.stride;
+}
+
+buffer_handle_t fake_gralloc_alloc(uint32_t width, uint32_t height,
+        int32_t format)
+{
+    fake_buffer buf = {width, height, format, 0, {}, false};
+    size_t size;
+
+    if (is_yuv(format)) {
+        buf.stride = align(width);
+        size = static_cast<size_t>(buf.stride) * height
+                + static_cast<size_t>(get_chroma_stride(buf))
+                * ((height + 1) / 2)
+                * (format == HAL_PIXEL_FORMAT_YV12? 2: 1);
+    } else if (get_bpp(format)) {
+        buf.stride = align(width * get_bpp(format)) / get_bpp(format);
+        size = static_cast<size_t>(buf.stride) * height * get_bpp(format);
+    } else {
+        return nullptr;
+    }
+
+    buf.data.resize(size);
+    native_handle_t *handle = native_handle_create(0, 0);
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers.emplace(handle, std::move(buf));
+    return handle;
+}
+
+void fake_gralloc_free(buffer_handle_t handle)
+{
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.erase(handle);
+    }
+    native_handle_delete(const_cast<native_handle_t *>(handle));
+}
+
+uint8_t *fake_gralloc_get_data(buffer_handle_t handle, size_t *out_size)
+{
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    auto it = buffers.find(handle);
+    if (it == buffers.end())
+        return nullptr;
+
+    *out_size = it->second.data.size();
+    return it->second.data.data();
+}
+
+static fake_buffer *get_buffer(buffer_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    auto it = buffers.find(handle);
+    return it == buffers.end()? nullptr: &it->second;
+}
+
+static int32_t get_dimensions(gralloc1_device_t * /*device*/,
+        buffer_handle_t handle, uint32_t *out_width, uint32_t *out_height)
+{
+    fake_buffer *buf = get_buffer(handle);
+    if (!buf)
+        return GRALLOC1_ERROR_BAD_HANDLE;
+
+    *out_width = buf->width;
+    *out_height = buf->height;
+    return GRALLOC1_ERROR_NONE;
+}
+
+static int32_t get_format(gralloc1_device_t * /*device*/,
+        buffer_handle_t handle, int32_t *out_format)
+{
+    fake_buffer *buf = get_buffer(handle);
+    if (!buf)
+        return GRALLOC1_ERROR_BAD_HANDLE;
+
+    *out_format = buf->format;
+    return GRALLOC1_ERROR_NONE;
+}
+
+static int32_t get_stride(gralloc1_device_t * /*device*/,
+        buffer_handle_t handle, uint32_t *out_stride)
+{
+    fake_buffer *buf = get_buffer(handle);
+    if (!buf)
+        return GRALLOC1_ERROR_BAD_HANDLE;
+
+    *out_stride = buf->stride;
+    return GRALLOC1_ERROR_NONE;
+}
+
+static int32_t get_num_flex_planes(gralloc1_device_t * /*device*/,
+        buffer_handle_t handle, uint32_t *out_num_planes)
+{
+    fake_buffer *buf = get_buffer(handle);
+    if (!buf)
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    if (!is_yuv(buf->format))
+        return GRALLOC1_ERROR_UNSUPPORTED;
+
+    *out_num_planes = 3;
+    return GRALLOC1_ERROR_NONE;
+}
+
+static int32_t lock(gralloc1_device_t * /*device*/, buffer_handle_t handle,
+        uint64_t /*producer_usage*/, uint64_t /*consumer_usage*/,
+        const gralloc1_rect_t * /*rect*/, void **out_data,
+        int32_t acquire_fence)
+{
+    fake_buffer *buf = get_buffer(handle);
+    if (!buf)
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    if (buf->locked || acquire_fence >= 0)
+        return GRALLOC1_ERROR_BAD_VALUE;
+
+    buf->locked = true;
+    *out_data = buf->data.data();
+    return GRALLOC1_ERROR_NONE;
+}
+
+/* The caller owns the plane array and says how large it is */
+static int32_t lock_flex(gralloc1_device_t * /*device*/,
+        buffer_handle_t handle, uint64_t /*producer_usage*/,
+        uint64_t /*consumer_usage*/, const gralloc1_rect_t * /*rect*/,
+        struct android_flex_layout *out_layout, int32_t acquire_fence)
+{
+    fake_buffer *buf = get_buffer(handle);
+    if (!buf)
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    if (!is_yuv(buf->format))
+        return GRALLOC1_ERROR_UNSUPPORTED;
+    if (buf->locked || acquire_fence >= 0 || !out_layout
+            || !out_layout->planes || out_layout->num_planes < 3)
+        return GRALLOC1_ERROR_BAD_VALUE;
+
+    uint8_t *luma = buf->data.data();
+    uint8_t *chroma = luma + static_cast<size_t>(buf->stride) * buf->height;
+    uint32_t chroma_stride = get_chroma_stride(*buf);
+    uint8_t *cb, *cr;
+    int32_t step;
+
+    switch (buf->format) {
+    case HAL_PIXEL_FORMAT_YV12:
+        cr = chroma;
+        cb = chroma + static_cast<size_t>(chroma_stride)
+                * ((buf->height + 1) / 2);
+        step = 1;
+        break;
+    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        cr = chroma;
+        cb = chroma + 1;
+        step = 2;
+        break;
+    default:
+        cb = chroma;
+        cr = chroma + 1;
+        step = 2;
+        break;
+    }
+
+    const struct {
+        uint8_t *top_left;
+        int component;
+        int32_t h_increment;
+        int32_t v_increment;
+        int32_t subsampling;
+    } planes[] = {
+        {luma, FLEX_COMPONENT_Y, 1, static_cast<int32_t>(buf->stride), 1},
+        {cb, FLEX_COMPONENT_Cb, step, static_cast<int32_t>(chroma_stride), 2},
+        {cr, FLEX_COMPONENT_Cr, step, static_cast<int32_t>(chroma_stride), 2},
+    };
+
+    out_layout->format = FLEX_FORMAT_YCbCr;
+    out_layout->num_planes = 3;
+    for (uint32_t idx = 0; idx < 3; idx++) {
+        android_flex_plane_t &plane = out_layout->planes[idx];
+        plane.top_left = planes[idx].top_left;
+        plane.component = static_cast<decltype(plane.component)>(
+                planes[idx].component);
+        plane.bits_per_component = 8;
+        plane.bits_used = 8;
+        plane.h_increment = planes[idx].h_increment;
+        plane.v_increment = planes[idx].v_increment;
+        plane.h_subsampling = planes[idx].subsampling;
+        plane.v_subsampling = planes[idx].subsampling;
+    }
+
+    buf->locked = true;
+    return GRALLOC1_ERROR_NONE;
+}
+
+static int32_t unlock(gralloc1_device_t * /*device*/, buffer_handle_t handle,
+        int32_t *out_release_fence)
+{
+    fake_buffer *buf = get_buffer(handle);
+    if (!buf)
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    if (!buf->locked)
+        return GRALLOC1_ERROR_BAD_VALUE;
+
+    buf->locked = false;
+    *out_release_fence = -1;
+    return GRALLOC1_ERROR_NONE;
+}
+
+static gralloc1_function_pointer_t get_function(gralloc1_device_t * /*device*/,
+        int32_t descriptor)
+{
+    switch (descriptor) {
+    case GRALLOC1_FUNCTION_GET_DIMENSIONS:
+        return reinterpret_cast<gralloc1_function_pointer_t>(get_dimensions);
+    case GRALLOC1_FUNCTION_GET_FORMAT:
+        return reinterpret_cast<gralloc1_function_pointer_t>(get_format);
+    case GRALLOC1_FUNCTION_GET_STRIDE:
+        return reinterpret_cast<gralloc1_function_pointer_t>(get_stride);
+    case GRALLOC1_FUNCTION_GET_NUM_FLEX_PLANES:
+        return reinterpret_cast<gralloc1_function_pointer_t>(
+                get_num_flex_planes);
+    case GRALLOC1_FUNCTION_LOCK:
+        return reinterpret_cast<gralloc1_function_pointer_t>(lock);
+    case GRALLOC1_FUNCTION_LOCK_FLEX:
+        return reinterpret_cast<gralloc1_function_pointer_t>(lock_flex);
+    case GRALLOC1_FUNCTION_UNLOCK:
+        return reinterpret_cast<gralloc1_function_pointer_t>(unlock);
+    default:
+        return nullptr;
+    }
+}
+
+static void get_capabilities(gralloc1_device_t * /*device*/,
+        uint32_t *out_count, int32_t * /*out_capabilities*/)
+{
+    *out_count = 0;
+}
+
+static int close_device(struct hw_device_t * /*device*/)
+{
+    return 0;
+}
+
+static gralloc1_device_t fake_device;
+
+static int open_device(const struct hw_module_t *module, const char * /*id*/,
+        struct hw_device_t **device)
+{
+    fake_device.common.tag = HARDWARE_DEVICE_TAG;
+    fake_device.common.module = const_cast<hw_module_t *>(module);
+    fake_device.common.close = close_device;
+    fake_device.getCapabilities = get_capabilities;
+    fake_device.getFunction = get_function;
+
+    *device = &fake_device.common;
+    return 0;
+}
+
+static struct hw_module_methods_t fake_methods = {
+    .open = open_device,
+};
+
+static hw_module_t fake_module = {
+    .tag = HARDWARE_MODULE_TAG,
+    .module_api_version = HARDWARE_MAKE_API_VERSION(1, 0),
+    .hal_api_version = HARDWARE_MAKE_API_VERSION(1, 0),
+    .id = GRALLOC_HARDWARE_MODULE_ID,
+    .name = "fake gralloc",
+    .author = "hwc2 tools",
+    .methods = &fake_methods,
+};
+
+/* The only module there is on the host */
+int hw_get_module(const char *id, const struct hw_module_t **module)
+{
+    if (strcmp(id, GRALLOC_HARDWARE_MODULE_ID))
+        return -ENOENT;
+
+    *module = &fake_module;
+    return 0;
+}
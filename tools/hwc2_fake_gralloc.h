@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HWC2_FAKE_GRALLOC_H
+#define _HWC2_FAKE_GRALLOC_H
+
+#include <hardware/gralloc1.h>
+
+/*
+ * Stands in for the gralloc module on the build host, where hw_get_module
+ * hands out a gralloc1 device keeping buffers in ordinary memory. YV12 is
+ * laid out as graphics.h describes it, YCrCb_420_SP as NV21 and
+ * YCbCr_420_888 as NV12. Locking checks what a real device would, such as
+ * the plane array lockFlex fills in.
+ */
+buffer_handle_t fake_gralloc_alloc(uint32_t width, uint32_t height,
+        int32_t format);
+void fake_gralloc_free(buffer_handle_t handle);
+/* The whole allocation, planes one after the other */
+uint8_t *fake_gralloc_get_data(buffer_handle_t handle, size_t *out_size);
+
+#endif /* ifndef _HWC2_FAKE_GRALLOC_H */
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hwc2_fake_planes.h"
+
+static const struct {
+    const char *name;
+    uint32_t cap;
+} fake_caps[] = {
+    {"rgb", HWC2_PLANE_CAP_RGB},
+    {"yuv", HWC2_PLANE_CAP_YUV},
+    {"scaling", HWC2_PLANE_CAP_SCALING},
+    {"blending", HWC2_PLANE_CAP_BLENDING},
+    {"cursor", HWC2_PLANE_CAP_CURSOR},
+};
+
+std::vector<hwc2_plane> fake_planes_parse(const char *spec)
+{
+    std::vector<hwc2_plane> planes;
+    std::vector<char> buf(spec, spec + strlen(spec) + 1);
+    char *plane_save, *cap_save;
+
+    for (char *desc = strtok_r(buf.data(), ";", &plane_save); desc;
+            desc = strtok_r(nullptr, ";", &plane_save)) {
+        uint32_t id = planes.size() + 1, caps = 0;
+        char *cap = strtok_r(desc, ",", &cap_save);
+        if (!cap || (strcmp(cap, "above") && strcmp(cap, "below"))) {
+            fprintf(stderr, "plane %u: position missing\n", id);
+            continue;
+        }
+
+        bool above = !strcmp(cap, "above");
+        while ((cap = strtok_r(nullptr, ",", &cap_save))) {
+            bool found = false;
+            for (auto &fake_cap: fake_caps) {
+                if (!strcmp(cap, fake_cap.name)) {
+                    caps |= fake_cap.cap;
+                    found = true;
+                }
+            }
+            if (!found)
+                fprintf(stderr, "plane %u: unknown capability %s\n", id, cap);
+        }
+
+        planes.emplace_back(id, above, caps);
+    }
+
+    return planes;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HWC2_FAKE_PLANES_H
+#define _HWC2_FAKE_PLANES_H
+
+#include "hwc2.h"
+
+/*
+ * Stands in for a plane backend on the build host. Planes are described as
+ * a list separated by semicolons, bottom one first. Each starts with
+ * "above" or "below" the framebuffer, followed by what it can do out of
+ * "rgb", "yuv", "scaling", "blending" and "cursor", separated by commas.
+ * Plane 0 is the window of the framebuffer itself.
+ */
+std::vector<hwc2_plane> fake_planes_parse(const char *spec);
+
+#endif /* ifndef _HWC2_FAKE_PLANES_H */
@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drives the composer HAL with a call stream written by hwc2_recorder:
+ *
+ *     hwc2_replay [-f] <file>
+ *
+ * Calls are paced like they were recorded unless -f is given, in which case
+ * they are issued back to back. Buffers are allocated as the stream
+ * describes them and filled with the sampled contents where there are any.
+ * Latencies of validate and present are printed at the end.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+
+#include "hwc2.h"
+
+struct replay_buffer {
+    buffer_handle_t handle;
+    std::array<uint32_t, 3> desc;
+};
+
+struct replay_state {
+    hwc2_device_t *hwc2;
+    gralloc1_device_t *gralloc;
+    std::map<uint64_t, replay_buffer> buffers;
+    std::map<uint64_t, hwc2_display_t> displays;
+    std::map<std::pair<hwc2_display_t, uint64_t>, hwc2_layer_t> layers;
+    std::vector<nsecs_t> validate_times;
+    std::vector<nsecs_t> present_times;
+};
+
+template <typename PFN>
+static PFN get_function(hwc2_device_t *hwc2, int32_t desc)
+{
+    return reinterpret_cast<PFN>(hwc2->getFunction(hwc2, desc));
+}
+
+template <typename PFN>
+static PFN get_function(gralloc1_device_t *gralloc,
+        gralloc1_function_descriptor_t desc)
+{
+    return reinterpret_cast<PFN>(gralloc->getFunction(gralloc, desc));
+}
+
+static void on_hotplug(hwc2_callback_data_t /*data*/, hwc2_display_t display,
+        int32_t connection)
+{
+    printf("display %" PRIu64 " %s\n", display,
+            connection == HWC2_CONNECTION_CONNECTED? "connected":
+            "disconnected");
+}
+
+static void on_refresh(hwc2_callback_data_t /*data*/,
+        hwc2_display_t /*display*/) { }
+
+static void on_vsync(hwc2_callback_data_t /*data*/,
+        hwc2_display_t /*display*/, int64_t /*timestamp*/) { }
+
+static int open_devices(replay_state *state)
+{
+    const hw_module_t *module;
+
+    int ret = hw_get_module(HWC_HARDWARE_MODULE_ID, &module);
+    if (!ret)
+        ret = hwc2_open(module, &state->hwc2);
+    if (ret) {
+        fprintf(stderr, "failed to open hwcomposer: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    ret = hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module);
+    if (!ret)
+        ret = gralloc1_open(module, &state->gralloc);
+    if (ret) {
+        fprintf(stderr, "failed to open gralloc1: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    auto register_callback = get_function<HWC2_PFN_REGISTER_CALLBACK>(
+            state->hwc2, HWC2_FUNCTION_REGISTER_CALLBACK);
+    register_callback(state->hwc2, HWC2_CALLBACK_HOTPLUG, state,
+            reinterpret_cast<hwc2_function_pointer_t>(on_hotplug));
+    register_callback(state->hwc2, HWC2_CALLBACK_REFRESH, state,
+            reinterpret_cast<hwc2_function_pointer_t>(on_refresh));
+    register_callback(state->hwc2, HWC2_CALLBACK_VSYNC, state,
+            reinterpret_cast<hwc2_function_pointer_t>(on_vsync));
+
+    return 0;
+}
+
+/* Allocates a buffer matching the recorded one, or reuses the last one
+ * allocated for it when it still matches */
+static buffer_handle_t alloc_buffer(replay_state *state, uint64_t id,
+        const std::array<uint32_t, 3> &desc)
+{
+    gralloc1_device_t *gralloc = state->gralloc;
+    gralloc1_buffer_descriptor_t descriptor;
+    buffer_handle_t handle;
+
+    auto it = state->buffers.find(id);
+    if (it != state->buffers.end()) {
+        if (it->second.desc == desc)
+            return it->second.handle;
+        get_function<GRALLOC1_PFN_RELEASE>(gralloc, GRALLOC1_FUNCTION_RELEASE)(
+                gralloc, it->second.handle);
+        state->buffers.erase(it);
+    }
+
+    get_function<GRALLOC1_PFN_CREATE_DESCRIPTOR>(gralloc,
+            GRALLOC1_FUNCTION_CREATE_DESCRIPTOR)(gralloc, &descriptor);
+    get_function<GRALLOC1_PFN_SET_DIMENSIONS>(gralloc,
+            GRALLOC1_FUNCTION_SET_DIMENSIONS)(gralloc, descriptor, desc[0],
+            desc[1]);
+    get_function<GRALLOC1_PFN_SET_FORMAT>(gralloc,
+            GRALLOC1_FUNCTION_SET_FORMAT)(gralloc, descriptor, desc[2]);
+    get_function<GRALLOC1_PFN_SET_PRODUCER_USAGE>(gralloc,
+            GRALLOC1_FUNCTION_SET_PRODUCER_USAGE)(gralloc, descriptor,
+            GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN);
+    get_function<GRALLOC1_PFN_SET_CONSUMER_USAGE>(gralloc,
+            GRALLOC1_FUNCTION_SET_CONSUMER_USAGE)(gralloc, descriptor,
+            GRALLOC1_CONSUMER_USAGE_CPU_READ_OFTEN);
+    int32_t ret = get_function<GRALLOC1_PFN_ALLOCATE>(gralloc,
+            GRALLOC1_FUNCTION_ALLOCATE)(gralloc, 1, &descriptor, &handle);
+    get_function<GRALLOC1_PFN_DESTROY_DESCRIPTOR>(gralloc,
+            GRALLOC1_FUNCTION_DESTROY_DESCRIPTOR)(gralloc, descriptor);
+
+    if (ret != GRALLOC1_ERROR_NONE) {
+        fprintf(stderr, "failed to allocate %ux%u buffer, format %u\n",
+                desc[0], desc[1], desc[2]);
+        return nullptr;
+    }
+
+    state->buffers[id] = {handle, desc};
+    return handle;
+}
+
+static void fill_buffer(replay_state *state, buffer_handle_t handle,
+        const std::array<uint32_t, 3> &desc, uint32_t row_size,
+        const uint8_t *pixels, size_t size)
+{
+    gralloc1_device_t *gralloc = state->gralloc;
+    uint32_t stride;
+    void *data;
+    int32_t release_fence = -1;
+
+    uint32_t bpp = hwc2_compositor::get_bpp(desc[2]);
+    if (!bpp || size < static_cast<size_t>(row_size) * desc[1])
+        return;
+
+    gralloc1_rect_t rect = {0, 0, static_cast<int32_t>(desc[0]),
+            static_cast<int32_t>(desc[1])};
+    if (get_function<GRALLOC1_PFN_GET_STRIDE>(gralloc,
+            GRALLOC1_FUNCTION_GET_STRIDE)(gralloc, handle, &stride)
+            != GRALLOC1_ERROR_NONE
+            || get_function<GRALLOC1_PFN_LOCK>(gralloc,
+            GRALLOC1_FUNCTION_LOCK)(gralloc, handle,
+            GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN,
+            GRALLOC1_CONSUMER_USAGE_NONE, &rect, &data, -1)
+            != GRALLOC1_ERROR_NONE)
+        return;
+
+    for (uint32_t y = 0; y < desc[1]; y++)
+        memcpy(static_cast<uint8_t *>(data) + y * stride * bpp,
+                pixels + y * row_size, row_size);
+
+    get_function<GRALLOC1_PFN_UNLOCK>(gralloc, GRALLOC1_FUNCTION_UNLOCK)(
+            gralloc, handle, &release_fence);
+    if (release_fence >= 0)
+        close(release_fence);
+}
+
+static hwc2_display_t map_display(replay_state *state, uint64_t display)
+{
+    auto it = state->displays.find(display);
+    return it != state->displays.end()? it->second: display;
+}
+
+static hwc2_layer_t map_layer(replay_state *state, hwc2_display_t display,
+        uint64_t layer)
+{
+    auto it = state->layers.find(std::make_pair(display, layer));
+    return it != state->layers.end()? it->second: layer;
+}
+
+static buffer_handle_t map_buffer(replay_state *state, uint64_t buffer)
+{
+    auto it = state->buffers.find(buffer);
+    return it != state->buffers.end()? it->second.handle: nullptr;
+}
+
+static hwc_region_t get_region(const uint8_t *blob, size_t size)
+{
+    hwc_region_t region;
+    region.numRects = size / sizeof(hwc_rect_t);
+    region.rects = reinterpret_cast<const hwc_rect_t *>(blob);
+    return region;
+}
+
+/* Issues one recorded call. Word counts were checked against the smallest
+ * each type needs before getting here. */
+static void replay_record(replay_state *state, uint16_t type,
+        const uint64_t *w, const uint8_t *blob, size_t blob_size)
+{
+    hwc2_device_t *hwc2 = state->hwc2;
+    hwc2_display_t dpy = 0;
+    hwc2_layer_t lyr = 0;
+
+    if (type != HWC2_RECORD_BUFFER
+            && type != HWC2_FUNCTION_CREATE_VIRTUAL_DISPLAY)
+        dpy = map_display(state, w[0]);
+    if (type >= HWC2_FUNCTION_SET_CURSOR_POSITION
+            && type <= HWC2_FUNCTION_SET_LAYER_Z_ORDER)
+        lyr = map_layer(state, dpy, w[1]);
+
+    switch (type) {
+    case HWC2_RECORD_BUFFER: {
+        std::array<uint32_t, 3> desc = {{static_cast<uint32_t>(w[1]),
+                static_cast<uint32_t>(w[2]), static_cast<uint32_t>(w[3])}};
+        buffer_handle_t handle = alloc_buffer(state, w[0], desc);
+        if (handle && w[4])
+            fill_buffer(state, handle, desc, w[4], blob, blob_size);
+        break;
+    }
+    case HWC2_FUNCTION_CREATE_VIRTUAL_DISPLAY: {
+        android_pixel_format_t format = static_cast<android_pixel_format_t>(
+                w[2]);
+        hwc2_display_t display;
+        if (get_function<HWC2_PFN_CREATE_VIRTUAL_DISPLAY>(hwc2, type)(hwc2,
+                w[0], w[1], reinterpret_cast<int32_t *>(&format), &display)
+                == HWC2_ERROR_NONE)
+            state->displays[w[3]] = display;
+        break;
+    }
+    case HWC2_FUNCTION_DESTROY_VIRTUAL_DISPLAY:
+        get_function<HWC2_PFN_DESTROY_VIRTUAL_DISPLAY>(hwc2, type)(hwc2, dpy);
+        state->displays.erase(w[0]);
+        break;
+    case HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES:
+        get_function<HWC2_PFN_ACCEPT_DISPLAY_CHANGES>(hwc2, type)(hwc2, dpy);
+        break;
+    case HWC2_FUNCTION_CREATE_LAYER: {
+        hwc2_layer_t layer;
+        if (get_function<HWC2_PFN_CREATE_LAYER>(hwc2, type)(hwc2, dpy, &layer)
+                == HWC2_ERROR_NONE)
+            state->layers[std::make_pair(dpy, w[1])] = layer;
+        break;
+    }
+    case HWC2_FUNCTION_DESTROY_LAYER:
+        get_function<HWC2_PFN_DESTROY_LAYER>(hwc2, type)(hwc2, dpy,
+                map_layer(state, dpy, w[1]));
+        state->layers.erase(std::make_pair(dpy, w[1]));
+        break;
+    case HWC2_FUNCTION_VALIDATE_DISPLAY: {
+        uint32_t num_types, num_requests;
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        get_function<HWC2_PFN_VALIDATE_DISPLAY>(hwc2, type)(hwc2, dpy,
+                &num_types, &num_requests);
+        state->validate_times.push_back(systemTime(SYSTEM_TIME_MONOTONIC)
+                - start);
+        break;
+    }
+    case HWC2_FUNCTION_PRESENT_DISPLAY: {
+        int32_t present_fence = -1;
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        get_function<HWC2_PFN_PRESENT_DISPLAY>(hwc2, type)(hwc2, dpy,
+                &present_fence);
+        state->present_times.push_back(systemTime(SYSTEM_TIME_MONOTONIC)
+                - start);
+        if (present_fence >= 0)
+            close(present_fence);
+        break;
+    }
+    case HWC2_FUNCTION_SET_ACTIVE_CONFIG:
+        get_function<HWC2_PFN_SET_ACTIVE_CONFIG>(hwc2, type)(hwc2, dpy, w[1]);
+        break;
+    case HWC2_FUNCTION_SET_CLIENT_TARGET:
+        get_function<HWC2_PFN_SET_CLIENT_TARGET>(hwc2, type)(hwc2, dpy,
+                map_buffer(state, w[1]), -1, w[2],
+                get_region(blob, blob_size));
+        break;
+    case HWC2_FUNCTION_SET_COLOR_MODE:
+        get_function<HWC2_PFN_SET_COLOR_MODE>(hwc2, type)(hwc2, dpy, w[1]);
+        break;
+    case HWC2_FUNCTION_SET_COLOR_TRANSFORM:
+        get_function<HWC2_PFN_SET_COLOR_TRANSFORM>(hwc2, type)(hwc2, dpy,
+                blob_size >= 16 * sizeof(float)?
+                reinterpret_cast<const float *>(blob): nullptr, w[1]);
+        break;
+    case HWC2_FUNCTION_SET_OUTPUT_BUFFER:
+        get_function<HWC2_PFN_SET_OUTPUT_BUFFER>(hwc2, type)(hwc2, dpy,
+                map_buffer(state, w[1]), -1);
+        break;
+    case HWC2_FUNCTION_SET_POWER_MODE:
+        get_function<HWC2_PFN_SET_POWER_MODE>(hwc2, type)(hwc2, dpy, w[1]);
+        break;
+    case HWC2_FUNCTION_SET_VSYNC_ENABLED:
+        get_function<HWC2_PFN_SET_VSYNC_ENABLED>(hwc2, type)(hwc2, dpy, w[1]);
+        break;
+    case HWC2_FUNCTION_SET_CURSOR_POSITION:
+        get_function<HWC2_PFN_SET_CURSOR_POSITION>(hwc2, type)(hwc2, dpy, lyr,
+                static_cast<int32_t>(w[2]), static_cast<int32_t>(w[3]));
+        break;
+    case HWC2_FUNCTION_SET_LAYER_BUFFER:
+        get_function<HWC2_PFN_SET_LAYER_BUFFER>(hwc2, type)(hwc2, dpy, lyr,
+                map_buffer(state, w[2]), -1);
+        break;
+    case HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE:
+        get_function<HWC2_PFN_SET_LAYER_SURFACE_DAMAGE>(hwc2, type)(hwc2, dpy,
+                lyr, get_region(blob, blob_size));
+        break;
+    case HWC2_FUNCTION_SET_LAYER_BLEND_MODE:
+        get_function<HWC2_PFN_SET_LAYER_BLEND_MODE>(hwc2, type)(hwc2, dpy, lyr,
+                w[2]);
+        break;
+    case HWC2_FUNCTION_SET_LAYER_COLOR:
+        if (blob_size >= sizeof(hwc_color_t))
+            get_function<HWC2_PFN_SET_LAYER_COLOR>(hwc2, type)(hwc2, dpy, lyr,
+                    *reinterpret_cast<const hwc_color_t *>(blob));
+        break;
+    case HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE:
+        get_function<HWC2_PFN_SET_LAYER_COMPOSITION_TYPE>(hwc2, type)(hwc2,
+                dpy, lyr, w[2]);
+        break;
+    case HWC2_FUNCTION_SET_LAYER_DATASPACE:
+        get_function<HWC2_PFN_SET_LAYER_DATASPACE>(hwc2, type)(hwc2, dpy, lyr,
+                w[2]);
+        break;
+    case HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME:
+        if (blob_size >= sizeof(hwc_rect_t))
+            get_function<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(hwc2, type)(hwc2,
+                    dpy, lyr, *reinterpret_cast<const hwc_rect_t *>(blob));
+        break;
+    case HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA:
+        if (blob_size >= sizeof(float))
+            get_function<HWC2_PFN_SET_LAYER_PLANE_ALPHA>(hwc2, type)(hwc2, dpy,
+                    lyr, *reinterpret_cast<const float *>(blob));
+        break;
+    case HWC2_FUNCTION_SET_LAYER_SOURCE_CROP:
+        if (blob_size >= sizeof(hwc_frect_t))
+            get_function<HWC2_PFN_SET_LAYER_SOURCE_CROP>(hwc2, type)(hwc2, dpy,
+                    lyr, *reinterpret_cast<const hwc_frect_t *>(blob));
+        break;
+    case HWC2_FUNCTION_SET_LAYER_TRANSFORM:
+        get_function<HWC2_PFN_SET_LAYER_TRANSFORM>(hwc2, type)(hwc2, dpy, lyr,
+                w[2]);
+        break;
+    case HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION:
+        get_function<HWC2_PFN_SET_LAYER_VISIBLE_REGION>(hwc2, type)(hwc2, dpy,
+                lyr, get_region(blob, blob_size));
+        break;
+    case HWC2_FUNCTION_SET_LAYER_Z_ORDER:
+        get_function<HWC2_PFN_SET_LAYER_Z_ORDER>(hwc2, type)(hwc2, dpy, lyr,
+                w[2]);
+        break;
+    default:
+        fprintf(stderr, "skipping unknown record type %u\n", type);
+        break;
+    }
+}
+
+/* Fewest words a record of each type carries */
+static uint32_t get_min_words(uint16_t type)
+{
+    switch (type) {
+    case HWC2_RECORD_BUFFER:
+        return 5;
+    case HWC2_FUNCTION_CREATE_VIRTUAL_DISPLAY:
+    case HWC2_FUNCTION_SET_CURSOR_POSITION:
+        return 4;
+    case HWC2_FUNCTION_SET_CLIENT_TARGET:
+    case HWC2_FUNCTION_SET_LAYER_BUFFER:
+    case HWC2_FUNCTION_SET_LAYER_BLEND_MODE:
+    case HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE:
+    case HWC2_FUNCTION_SET_LAYER_DATASPACE:
+    case HWC2_FUNCTION_SET_LAYER_TRANSFORM:
+    case HWC2_FUNCTION_SET_LAYER_Z_ORDER:
+        return 3;
+    case HWC2_FUNCTION_DESTROY_VIRTUAL_DISPLAY:
+    case HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES:
+    case HWC2_FUNCTION_PRESENT_DISPLAY:
+    case HWC2_FUNCTION_VALIDATE_DISPLAY:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+static void print_times(const char *name, std::vector<nsecs_t> &times)
+{
+    if (times.empty())
+        return;
+
+    std::sort(times.begin(), times.end());
+    nsecs_t total = 0;
+    for (nsecs_t time: times)
+        total += time;
+
+    printf("%-9s %6zu calls, us: avg %6" PRId64 " p50 %6" PRId64 " p99 %6"
+            PRId64 " max %6" PRId64 "\n", name, times.size(),
+            total / static_cast<nsecs_t>(times.size()) / 1000,
+            times[times.size() / 2] / 1000,
+            times[(times.size() - 1) * 99 / 100] / 1000,
+            times.back() / 1000);
+}
+
+int main(int argc, char *argv[])
+{
+    bool fast = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        if (opt != 'f') {
+            fprintf(stderr, "usage: %s [-f] <file>\n", argv[0]);
+            return 1;
+        }
+        fast = true;
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-f] <file>\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "failed to open %s: %s\n", argv[optind],
+                strerror(errno));
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    const uint8_t *data = nullptr;
+    if (size >= sizeof(hwc2_record_header))
+        data = static_cast<const uint8_t *>(mmap(nullptr, size, PROT_READ,
+                MAP_PRIVATE, fd, 0));
+    close(fd);
+
+    const hwc2_record_header *header =
+            reinterpret_cast<const hwc2_record_header *>(data);
+    if (!data || data == MAP_FAILED || header->magic != HWC2_RECORD_MAGIC
+            || header->version != HWC2_RECORD_VERSION) {
+        fprintf(stderr, "%s is not a call stream\n", argv[optind]);
+        return 1;
+    }
+
+    replay_state state = {};
+    if (open_devices(&state) < 0)
+        return 1;
+
+    nsecs_t first = 0, start = systemTime(SYSTEM_TIME_MONOTONIC);
+    size_t offset = sizeof(*header), cnt = 0;
+    std::vector<uint64_t> words, aligned_blob;
+
+    while (offset + sizeof(hwc2_record) <= size) {
+        hwc2_record rec;
+        memcpy(&rec, data + offset, sizeof(rec));
+
+        size_t words_size = rec.word_cnt * sizeof(uint64_t);
+        if (rec.size < sizeof(rec) + words_size || rec.size > size - offset) {
+            fprintf(stderr, "truncated record at offset %zu\n", offset);
+            break;
+        }
+
+        if (!cnt)
+            first = rec.timestamp;
+        if (!fast) {
+            nsecs_t due = start + rec.timestamp - first;
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (due > now) {
+                struct timespec ts = {static_cast<time_t>((due - now)
+                        / 1000000000), static_cast<long>((due - now)
+                        % 1000000000)};
+                nanosleep(&ts, nullptr);
+            }
+        }
+
+        /* Records are packed, copy the words and small blobs out to get
+         * them aligned. Pixels are only ever copied byte wise. */
+        const uint8_t *blob = data + offset + sizeof(rec) + words_size;
+        size_t blob_size = rec.size - sizeof(rec) - words_size;
+        words.assign(std::max<size_t>(rec.word_cnt, get_min_words(rec.type)),
+                0);
+        memcpy(words.data(), data + offset + sizeof(rec), words_size);
+        if (rec.type != HWC2_RECORD_BUFFER) {
+            aligned_blob.resize((blob_size + 7) / 8);
+            memcpy(aligned_blob.data(), blob, blob_size);
+            blob = reinterpret_cast<const uint8_t *>(aligned_blob.data());
+        }
+
+        if (rec.word_cnt >= get_min_words(rec.type))
+            replay_record(&state, rec.type, words.data(), blob, blob_size);
+        else
+            fprintf(stderr, "short record of type %u at offset %zu\n",
+                    rec.type, offset);
+
+        offset += rec.size;
+        cnt++;
+    }
+
+    printf("replayed %zu records in %" PRId64 " ms\n", cnt,
+            (systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1000000);
+    print_times("validate", state.validate_times);
+    print_times("present", state.present_times);
+
+    munmap(const_cast<uint8_t *>(data), size);
+    return 0;
+}
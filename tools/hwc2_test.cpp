@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Tests parts of the composer on the build host:
+ *
+ *     hwc2_test [group...]
+ *
+ * Every group is run unless some are named. Exits with 1 when any check
+ * failed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hwc2_test.h"
+
+static const struct {
+    const char *name;
+    int (*run)();
+} groups[] = {
+    {"kernels", test_kernels},
+    {"planes", test_planes},
+};
+
+int main(int argc, char *argv[])
+{
+    int ret = 0;
+
+    for (int arg = 1; arg < argc; arg++) {
+        bool found = false;
+        for (auto &group: groups)
+            found |= !strcmp(argv[arg], group.name);
+        if (!found) {
+            fprintf(stderr, "unknown test group %s\n", argv[arg]);
+            ret = 1;
+        }
+    }
+    if (ret)
+        return ret;
+
+    for (auto &group: groups) {
+        bool selected = argc == 1;
+        for (int arg = 1; arg < argc; arg++)
+            selected |= !strcmp(argv[arg], group.name);
+        if (!selected)
+            continue;
+
+        int failed = group.run();
+        printf("%s: %s\n", group.name, failed? "FAILED": "ok");
+        if (failed)
+            ret = 1;
+    }
+
+    return ret;
+}
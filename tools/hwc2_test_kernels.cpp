@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+
+#include "hwc2.h"
+#include "hwc2_test.h"
+
+/* Not a multiple of any SIMD width, so every row ends in a scalar tail */
+#define TEST_WIDTH 75
+#define TEST_HEIGHT 6
+/* The frame starts this many pixels into the target, off any alignment */
+#define TEST_OFFSET 3
+
+static const struct {
+    int32_t format;
+    const char *name;
+} test_formats[] = {
+    {HAL_PIXEL_FORMAT_RGBA_8888, "rgba"},
+    {HAL_PIXEL_FORMAT_RGBX_8888, "rgbx"},
+    {HAL_PIXEL_FORMAT_BGRA_8888, "bgra"},
+    {HAL_PIXEL_FORMAT_RGB_565, "rgb565"},
+};
+
+static const struct {
+    hwc2_blend_mode_t mode;
+    const char *name;
+} test_blends[] = {
+    {HWC2_BLEND_MODE_NONE, "none"},
+    {HWC2_BLEND_MODE_PREMULTIPLIED, "premultiplied"},
+    {HWC2_BLEND_MODE_COVERAGE, "coverage"},
+};
+
+/* Swaps red and blue and dims a bit, fits the Q12 coefficients */
+static const float test_matrix[16] = {
+    0.1f, 0.2f, 0.7f, 0.0f,
+    0.2f, 0.7f, 0.1f, 0.0f,
+    0.7f, 0.1f, 0.2f, 0.0f,
+    0.0f, 0.0f, 0.0f, 1.0f,
+};
+
+/* The sets besides the scalar reference, the CPU may lack some of them */
+static const char *const test_isas[] = {"sse4.1", "avx2", "neon"};
+
+/*
+ * Pixels come in runs of 4 of the same kind, so that the SIMD kernels see
+ * whole groups that are transparent, opaque or mixed, and groups with alpha
+ * 0 but some color, which are not all zero. Random pixels are not properly
+ * premultiplied and check that the sets saturate alike.
+ */
+static void fill_random(std::mt19937 &rng, std::vector<uint8_t> &data)
+{
+    std::vector<uint32_t> pixels((data.size() + 3) / 4);
+
+    for (size_t idx = 0; idx < pixels.size(); idx += 4) {
+        uint32_t kind = rng() % 6;
+        for (size_t px = idx; px < std::min(idx + 4, pixels.size()); px++) {
+            uint32_t pixel = rng();
+            uint32_t alpha = pixel >> 24;
+            switch (kind) {
+            case 0:
+                pixel = 0;
+                break;
+            case 1:
+                pixel &= 0x00ffffff;
+                break;
+            case 2:
+                pixel |= 0xff000000;
+                break;
+            case 3:
+                pixel = (pixel & 0xff) * alpha / 255
+                        | ((pixel >> 8) & 0xff) * alpha / 255 << 8
+                        | ((pixel >> 16) & 0xff) * alpha / 255 << 16
+                        | alpha << 24;
+                break;
+            case 4:
+                pixel = rng() % 2? pixel | 0xff000000: 0;
+                break;
+            default:
+                break;
+            }
+            pixels[px] = pixel;
+        }
+    }
+
+    memcpy(data.data(), pixels.data(), data.size());
+}
+
+struct test_case {
+    int32_t src_format;
+    int32_t dst_format;
+    hwc2_blend_mode_t blend;
+    float plane_alpha;
+    bool transformed;
+    bool scaled;
+};
+
+/* Draws one random layer onto a random target with the current kernels */
+static std::vector<uint8_t> draw_case(const test_case &test,
+        const std::vector<uint8_t> &src_data,
+        const std::vector<uint8_t> &dst_data)
+{
+    hwc2_compositor compositor;
+    uint32_t src_bpp = hwc2_compositor::get_bpp(test.src_format);
+    uint32_t dst_bpp = hwc2_compositor::get_bpp(test.dst_format);
+    uint32_t dst_width = TEST_WIDTH + TEST_OFFSET * 2;
+    std::vector<uint8_t> src_copy(src_data), dst_copy(dst_data);
+
+    hwc2_surface src = {src_copy.data(), TEST_WIDTH, TEST_HEIGHT,
+            TEST_WIDTH * src_bpp, test.src_format, nullptr, nullptr, 0, 0};
+    hwc2_surface dst = {dst_copy.data(), dst_width, TEST_HEIGHT,
+            dst_width * dst_bpp, test.dst_format, nullptr, nullptr, 0, 0};
+    hwc_frect_t crop = {0.0f, 0.0f,
+            test.scaled? TEST_WIDTH * 2 / 3.0f: TEST_WIDTH, TEST_HEIGHT};
+    hwc_rect_t frame = {TEST_OFFSET, 0, TEST_OFFSET + TEST_WIDTH,
+            TEST_HEIGHT};
+
+    if (test.transformed)
+        compositor.set_color_transform(test_matrix,
+                HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX);
+    compositor.draw(dst, src, crop, frame, test.blend, test.plane_alpha,
+            hwc2_region(frame), true, HAL_DATASPACE_UNKNOWN);
+
+    return dst_copy;
+}
+
+static const char *get_format_name(int32_t format)
+{
+    for (auto &test_format: test_formats)
+        if (test_format.format == format)
+            return test_format.name;
+    return "?";
+}
+
+static const char *get_blend_name(hwc2_blend_mode_t blend)
+{
+    for (auto &test_blend: test_blends)
+        if (test_blend.mode == blend)
+            return test_blend.name;
+    return "?";
+}
+
+/* Reports the first pixel that differs from the scalar result */
+static int compare(const char *isa, const test_case &test,
+        const std::vector<uint8_t> &expected,
+        const std::vector<uint8_t> &result)
+{
+    if (expected == result)
+        return 0;
+
+    uint32_t bpp = hwc2_compositor::get_bpp(test.dst_format);
+    size_t idx = std::mismatch(expected.begin(), expected.end(),
+            result.begin()).first - expected.begin();
+    size_t px = idx / bpp;
+    uint32_t want = 0, got = 0;
+    memcpy(&want, &expected[px * bpp], bpp);
+    memcpy(&got, &result[px * bpp], bpp);
+
+    fprintf(stderr, "  %s: %s onto %s, blend %s, plane alpha %.2f%s%s: "
+            "pixel %zu,%zu is %08x instead of %08x\n", isa,
+            get_format_name(test.src_format),
+            get_format_name(test.dst_format), get_blend_name(test.blend),
+            test.plane_alpha, test.transformed? ", transformed": "",
+            test.scaled? ", scaled": "",
+            px % (TEST_WIDTH + TEST_OFFSET * 2),
+            px / (TEST_WIDTH + TEST_OFFSET * 2), got, want);
+    return 1;
+}
+
+/*
+ * Runs every kernel table over the same random rows and compares the
+ * results with the scalar ones bit for bit, for every pairing of formats,
+ * blend mode, plane alpha, color transform and scaling.
+ */
+int test_kernels()
+{
+    std::mt19937 rng(34);
+    std::vector<test_case> tests;
+    int failed = 0;
+
+    for (auto &src: test_formats)
+        for (auto &dst: test_formats)
+            for (auto &blend: test_blends)
+                for (float plane_alpha: {1.0f, 0.6f})
+                    for (bool transformed: {false, true})
+                        for (bool scaled: {false, true})
+                            tests.push_back(test_case{src.format, dst.format,
+                                    blend.mode, plane_alpha, transformed,
+                                    scaled});
+
+    std::vector<const char *> isas;
+    for (const char *isa: test_isas) {
+        if (hwc2_compositor::set_isa(isa))
+            isas.push_back(isa);
+        else
+            printf("  %s: not supported, skipped\n", isa);
+    }
+
+    for (const test_case &test: tests) {
+        std::vector<uint8_t> src_data(TEST_WIDTH * TEST_HEIGHT
+                * hwc2_compositor::get_bpp(test.src_format));
+        std::vector<uint8_t> dst_data((TEST_WIDTH + TEST_OFFSET * 2)
+                * TEST_HEIGHT * hwc2_compositor::get_bpp(test.dst_format));
+        fill_random(rng, src_data);
+        fill_random(rng, dst_data);
+
+        hwc2_compositor::set_isa("scalar");
+        std::vector<uint8_t> expected = draw_case(test, src_data, dst_data);
+
+        for (const char *isa: isas) {
+            hwc2_compositor::set_isa(isa);
+            failed += compare(isa, test, expected,
+                    draw_case(test, src_data, dst_data));
+        }
+    }
+
+    return failed;
+}
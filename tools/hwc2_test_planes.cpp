@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2018 arttttt <artem-bambalov@yandex.ru>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hwc2.h"
+#include "hwc2_fake_gralloc.h"
+#include "hwc2_fake_planes.h"
+#include "hwc2_test.h"
+
+#define TEST_WIDTH 1920
+#define TEST_HEIGHT 1080
+
+/* A window below the framebuffer, one above it that takes video and one
+ * for the cursor */
+#define TEST_PLANES "below,rgb;above,rgb,yuv,scaling,blending;" \
+        "above,rgb,blending,cursor"
+
+struct test_layer {
+    int32_t format;
+    uint32_t width;
+    uint32_t height;
+    hwc_rect_t frame;
+    hwc2_composition_t type;
+    hwc2_blend_mode_t blend;
+    hwc_transform_t transform;
+    /* Plane it should end up on, 0 for the framebuffer */
+    uint32_t plane;
+};
+
+static const test_layer wallpaper = {HAL_PIXEL_FORMAT_RGBX_8888,
+        TEST_WIDTH, TEST_HEIGHT, {0, 0, TEST_WIDTH, TEST_HEIGHT},
+        HWC2_COMPOSITION_DEVICE, HWC2_BLEND_MODE_NONE,
+        static_cast<hwc_transform_t>(0), 1};
+static const test_layer app = {HAL_PIXEL_FORMAT_RGBA_8888,
+        1200, 800, {360, 140, 1560, 940},
+        HWC2_COMPOSITION_DEVICE, HWC2_BLEND_MODE_PREMULTIPLIED,
+        static_cast<hwc_transform_t>(0), 0};
+static const test_layer video = {HAL_PIXEL_FORMAT_YCbCr_420_888,
+        1280, 720, {320, 180, 1600, 900},
+        HWC2_COMPOSITION_DEVICE, HWC2_BLEND_MODE_NONE,
+        static_cast<hwc_transform_t>(0), 2};
+static const test_layer cursor = {HAL_PIXEL_FORMAT_RGBA_8888,
+        64, 64, {900, 500, 964, 564},
+        HWC2_COMPOSITION_CURSOR, HWC2_BLEND_MODE_PREMULTIPLIED,
+        static_cast<hwc_transform_t>(0), 3};
+
+static test_layer with_plane(test_layer lyr, uint32_t plane)
+{
+    lyr.plane = plane;
+    return lyr;
+}
+
+static const struct {
+    const char *name;
+    /* Whether the framebuffer has alpha, which planes below need */
+    bool fb_alpha;
+    bool color_transform;
+    std::vector<test_layer> layers;
+} plane_tests[] = {
+    {"video over ui", true, false, {wallpaper, app, video, cursor}},
+    {"framebuffer without alpha", false, false,
+            {with_plane(wallpaper, 0), app, video, cursor}},
+    {"color transform", true, true, {with_plane(wallpaper, 0), app,
+            with_plane(video, 0), with_plane(cursor, 0)}},
+    {"rotated video", true, false, {wallpaper, app, [] {
+            test_layer lyr = with_plane(video, 0);
+            lyr.transform = HWC_TRANSFORM_ROT_90;
+            return lyr;
+        }(), cursor}},
+    {"video off screen", true, false, {wallpaper, app, [] {
+            test_layer lyr = with_plane(video, 0);
+            lyr.frame = {1000, 500, 2280, 1220};
+            return lyr;
+        }(), cursor}},
+    {"translucent wallpaper", true, false, {[] {
+            test_layer lyr = with_plane(wallpaper, 0);
+            lyr.format = HAL_PIXEL_FORMAT_RGBA_8888;
+            lyr.blend = HWC2_BLEND_MODE_PREMULTIPLIED;
+            return lyr;
+        }(), app, video, cursor}},
+    {"app on top", true, false, {wallpaper, with_plane(video, 0),
+            with_plane(app, 2)}},
+};
+
+/* Fills in what FBIOGET_VSCREENINFO would report for a 32 bit panel */
+static struct nvfb_device get_fake_fb(bool alpha)
+{
+    struct nvfb_device dev;
+
+    memset(&dev, 0, sizeof(dev));
+    dev.fd = -1;
+    dev.vi.xres = dev.vi.xres_virtual = TEST_WIDTH;
+    dev.vi.yres = dev.vi.yres_virtual = TEST_HEIGHT;
+    dev.vi.bits_per_pixel = 32;
+    dev.vi.green.offset = 8;
+    dev.vi.blue.offset = 16;
+    dev.vi.transp.offset = 24;
+    dev.vi.transp.length = alpha? 8: 0;
+    dev.fi.line_length = TEST_WIDTH * 4;
+
+    return dev;
+}
+
+/*
+ * Builds the layers of every case on a panel with fake planes, validates
+ * it and checks which plane each layer was put on.
+ */
+int test_planes()
+{
+    int failed = 0;
+
+    for (auto &test: plane_tests) {
+        hwc2_display dpy(0, get_fake_fb(test.fb_alpha),
+                HWC2_CONNECTION_CONNECTED, HWC2_POWER_MODE_ON,
+                HWC2_DISPLAY_TYPE_PHYSICAL);
+        dpy.set_planes(fake_planes_parse(TEST_PLANES));
+
+        if (test.color_transform) {
+            static const float matrix[16] = {
+                0.5f, 0.0f, 0.0f, 0.0f,
+                0.0f, 0.5f, 0.0f, 0.0f,
+                0.0f, 0.0f, 0.5f, 0.0f,
+                0.0f, 0.0f, 0.0f, 1.0f,
+            };
+            dpy.set_color_transform(matrix,
+                    HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX);
+        }
+
+        std::vector<hwc2_layer_t> ids;
+        std::vector<buffer_handle_t> handles;
+        for (size_t idx = 0; idx < test.layers.size(); idx++) {
+            const test_layer &lyr = test.layers[idx];
+            hwc2_layer_t lyr_id;
+            buffer_handle_t handle = fake_gralloc_alloc(lyr.width,
+                    lyr.height, lyr.format);
+            hwc_region_t visible = {1, &lyr.frame};
+
+            dpy.create_layer(&lyr_id);
+            dpy.set_layer_composition_type(lyr_id, lyr.type);
+            dpy.set_layer_buffer(lyr_id, handle, -1);
+            dpy.set_layer_blend_mode(lyr_id, lyr.blend);
+            dpy.set_layer_transform(lyr_id, lyr.transform);
+            dpy.set_layer_display_frame(lyr_id, lyr.frame);
+            dpy.set_layer_source_crop(lyr_id, hwc_frect_t{0.0f, 0.0f,
+                    static_cast<float>(lyr.width),
+                    static_cast<float>(lyr.height)});
+            dpy.set_layer_visible_region(lyr_id, visible);
+            dpy.set_layer_plane_alpha(lyr_id, 1.0f);
+            dpy.set_layer_z_order(lyr_id, idx);
+
+            ids.push_back(lyr_id);
+            handles.push_back(handle);
+        }
+
+        uint32_t num_types, num_requests;
+        dpy.validate_display(&num_types, &num_requests);
+
+        for (size_t idx = 0; idx < test.layers.size(); idx++) {
+            uint32_t plane = dpy.get_layer_plane(ids[idx]);
+            if (plane != test.layers[idx].plane) {
+                fprintf(stderr, "  %s: layer %zu is on plane %u instead of "
+                        "%u\n", test.name, idx, plane,
+                        test.layers[idx].plane);
+                failed++;
+            }
+        }
+
+        for (hwc2_layer_t lyr_id: ids)
+            dpy.destroy_layer(lyr_id);
+        for (buffer_handle_t handle: handles)
+            fake_gralloc_free(handle);
+    }
+
+    return failed;
+}